@@ -0,0 +1,182 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Point read benchmark: reads random rows of a table by the primary key
+  (all its columns) using SELECT * ... WHERE pk = '...' and HANDLER ...
+  READ `PRIMARY` = (...) the way a row cache miss does, including the
+  database selection preceding every fetch, and prints the reads per
+  second of both. The sampled rows are read once before timing so both
+  ways find the pages cached, then the ways alternate for a few rounds
+  with the first one changing every round.
+
+  Syntax: bench-handler <server> <user> <password> <db> <table> [<reads>]
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <mysql/mysql.h>
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int run(MYSQL *sql, char *qry)
+{
+    MYSQL_RES *res;
+
+    if (mysql_real_query(sql, qry, strlen(qry)) != 0) {
+        fprintf(stderr, "Error: Query '%s' failed: %s\n", qry, mysql_error(sql));
+        return -1;
+    }
+    if ((res = mysql_store_result(sql)) != NULL)
+        mysql_free_result(res);
+
+    return 0;
+}
+
+#define ROUNDS                  4
+
+/* Read the rows of the sample picked by the seed, handler set reads them
+   by HANDLER. Returns the time taken or -1 on error */
+static double bench(MYSQL *sql, char *db, char *tab, char **pks, int numPk, char ***keys,
+                    int num, int reads, int handler)
+{
+    char qry[4096];
+    double start;
+    int i, j, k;
+
+    srand(1);
+    start = now();
+    for (i = 0; i < reads; i++) {
+        j = rand() % num;
+        if (mysql_select_db(sql, db) != 0)
+            return -1;
+
+        if (handler) {
+            snprintf(qry, sizeof(qry), "HANDLER `h1` READ `PRIMARY` = (");
+            for (k = 0; k < numPk; k++)
+                snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), "%s'%s'",
+                         (k > 0) ? "," : "", keys[j][k]);
+            snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), ")");
+        }
+        else {
+            snprintf(qry, sizeof(qry), "SELECT * FROM `%s` WHERE ", tab);
+            for (k = 0; k < numPk; k++)
+                snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), "%s`%s` = '%s'",
+                         (k > 0) ? " AND " : "", pks[k], keys[j][k]);
+        }
+        if (run(sql, qry) != 0)
+            return -1;
+    }
+
+    return now() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    char qry[1024] = { 0 };
+    char *pks[16], ***keys;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    MYSQL *sql;
+    int num = 0, numPk = 0, reads = 10000, i, k, r;
+    double t, tSelect = 0, tHandler = 0;
+
+    if (argc < 6) {
+        fprintf(stderr, "Syntax: %s <server> <user> <password> <db> <table> [<reads>]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 6)
+        reads = atoi(argv[6]);
+
+    sql = mysql_init(NULL);
+    if (mysql_real_connect(sql, argv[1], argv[2], argv[3], argv[4], 0, NULL, 0) == NULL) {
+        fprintf(stderr, "Error: Cannot connect: %s\n", mysql_error(sql));
+        return 1;
+    }
+
+    /* The key columns in index order */
+    snprintf(qry, sizeof(qry), "SHOW KEYS FROM `%s` WHERE Key_name = 'PRIMARY'", argv[5]);
+    if ((mysql_real_query(sql, qry, strlen(qry)) != 0) || ((res = mysql_store_result(sql)) == NULL)) {
+        fprintf(stderr, "Error: Cannot read the keys: %s\n", mysql_error(sql));
+        return 1;
+    }
+    while (((row = mysql_fetch_row(res)) != NULL) && (numPk < 16))
+        pks[numPk++] = strdup(row[4]);
+    mysql_free_result(res);
+    if (numPk == 0) {
+        fprintf(stderr, "Error: Table %s has no primary key\n", argv[5]);
+        return 1;
+    }
+
+    /* Sample of the keys, read in random order */
+    snprintf(qry, sizeof(qry), "SELECT ");
+    for (k = 0; k < numPk; k++)
+        snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), "%s`%s`", (k > 0) ? "," : "", pks[k]);
+    snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), " FROM `%s` LIMIT 100000", argv[5]);
+    if ((mysql_real_query(sql, qry, strlen(qry)) != 0) || ((res = mysql_store_result(sql)) == NULL))
+        return 1;
+    keys = (char ***)malloc( (mysql_num_rows(res) + 1) * sizeof(char **) );
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        for (k = 0; (k < numPk) && (row[k] != NULL); k++) ;
+        if (k < numPk)
+            continue;
+        keys[num] = (char **)malloc( numPk * sizeof(char *) );
+        for (k = 0; k < numPk; k++) {
+            keys[num][k] = (char *)malloc( (2 * strlen(row[k]) + 1) * sizeof(char) );
+            mysql_real_escape_string(sql, keys[num][k], row[k], strlen(row[k]));
+        }
+        num++;
+    }
+    mysql_free_result(res);
+    if (num == 0) {
+        fprintf(stderr, "Error: Table %s is empty\n", argv[5]);
+        return 1;
+    }
+
+    snprintf(qry, sizeof(qry), "HANDLER `%s` OPEN AS `h1`", argv[5]);
+    if (run(sql, qry) != 0)
+        return 1;
+
+    /* Warm up the pages of the sample */
+    if (bench(sql, argv[4], argv[5], pks, numPk, keys, num, reads, 0) < 0)
+        return 1;
+
+    for (r = 0; r < ROUNDS; r++)
+        for (i = 0; i < 2; i++) {
+            if ((t = bench(sql, argv[4], argv[5], pks, numPk, keys, num, reads, (r + i) % 2)) < 0)
+                return 1;
+            if ((r + i) % 2)
+                tHandler += t;
+            else
+                tSelect += t;
+        }
+    run(sql, "HANDLER `h1` CLOSE");
+
+    printf("%d rounds of %d point reads of %d keys from %s.%s\n", ROUNDS, reads, num,
+           argv[4], argv[5]);
+    printf("\tSELECT:  %8.3f s, %10.0f reads/s\n", tSelect, ROUNDS * reads / tSelect);
+    printf("\tHANDLER: %8.3f s, %10.0f reads/s\n", tHandler, ROUNDS * reads / tHandler);
+
+    for (i = 0; i < num; i++) {
+        for (k = 0; k < numPk; k++)
+            free(keys[i][k]);
+        free(keys[i]);
+    }
+    free(keys);
+    for (k = 0; k < numPk; k++)
+        free(pks[k]);
+    mysql_close(sql);
+
+    return 0;
+}
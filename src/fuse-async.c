@@ -0,0 +1,473 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Asynchronous queries: an operation submits its independent queries
+  using asyncSubmit() and collects the results using asyncWait(), so the
+  queries are in flight together and the operation costs about one round
+  trip instead of one per query. With --async the queries of all the
+  FUSE threads are run on the given number of extra connections. Built
+  against MariaDB Connector/C a single event loop thread drives all the
+  connections using the non-blocking API (mysql_real_query_start/_cont),
+  otherwise every connection has its own thread. Without --async the
+  queries are run on the main connection when they are waited for.
+
+  Only getattr of database and table directories submits its queries
+  here. Rows and columns are read by the row cache using one query per
+  row, they have no independent queries to send together and stay on the
+  connection of the FUSE thread.
+
+  The queries have to name their tables including the database as the
+  connections have no database selected. A connection which lost the
+  server is reopened before its next query, the queries still pending
+  when the connections are stopped fail as if the server was lost.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_ASYNC
+
+#ifdef DEBUG_ASYNC
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "async: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+#include <poll.h>
+
+struct tAsync {
+    char *qry;
+    MYSQL_RES *res;
+    int err;
+    int done;
+    int queued;
+    struct tAsync *next;
+};
+
+typedef struct tAsyncConn {
+    MYSQL *conn;
+    tAsync *cur;
+    int state;
+    int wait;
+} tAsyncConn;
+
+#define ASYNC_IDLE              0
+#define ASYNC_QUERY             1
+#define ASYNC_STORE             2
+
+#define CR_SERVER_GONE_ERROR    2006
+#define CR_SERVER_LOST          2013
+
+static tAsyncConn *asConns = NULL;
+static int asNum = 0;
+static tAsync *asHead = NULL;
+static tAsync *asTail = NULL;
+static volatile int asRunning = 0;
+static pthread_mutex_t asMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t asDoneCond = PTHREAD_COND_INITIALIZER;
+
+static void asyncWake(void);
+
+int asyncEnabled(void)
+{
+    return asRunning;
+}
+
+/* Queue the query, the result has to be collected using asyncWait() */
+tAsync *asyncSubmit(const char *qry)
+{
+    tAsync *a;
+
+    a = (tAsync *)malloc( sizeof(tAsync) );
+    memset(a, 0, sizeof(tAsync));
+    a->qry = strdup(qry);
+
+    if (!asyncEnabled())
+        return a;
+
+    DPRINTF("%s: Queueing \"%s\"\n", __FUNCTION__, qry);
+    pthread_mutex_lock(&asMutex);
+    /* Checked again under the lock, asyncStop() fails the queued ones */
+    if (!asRunning) {
+        pthread_mutex_unlock(&asMutex);
+        return a;
+    }
+    a->queued = 1;
+    if (asTail != NULL)
+        asTail->next = a;
+    else
+        asHead = a;
+    asTail = a;
+    asyncWake();
+    pthread_mutex_unlock(&asMutex);
+
+    return a;
+}
+
+/* Wait for the query and free the request. Returns the stored result or
+   NULL with the error number in err */
+MYSQL_RES *asyncWait(tAsync *a, int *err)
+{
+    MYSQL_RES *res;
+
+    if (!a->queued) {
+        /* Not queued, run on the main connection now */
+        if (mysql_real_query(&sql, a->qry, strlen(a->qry)) != 0)
+            a->err = mysql_errno(&sql);
+        else
+            a->res = mysql_store_result(&sql);
+        a->done = 1;
+    }
+
+    pthread_mutex_lock(&asMutex);
+    while (!a->done)
+        pthread_cond_wait(&asDoneCond, &asMutex);
+    pthread_mutex_unlock(&asMutex);
+
+    res = a->res;
+    if (err != NULL)
+        *err = a->err;
+    DPRINTF("%s: Query \"%s\" finished with %d\n", __FUNCTION__, a->qry, a->err);
+
+    free(a->qry);
+    free(a);
+    return res;
+}
+
+/* Take the next queued request, expects asMutex to be held */
+static tAsync *asyncNext(void)
+{
+    tAsync *a;
+
+    if ((a = asHead) != NULL) {
+        asHead = a->next;
+        if (asHead == NULL)
+            asTail = NULL;
+        a->next = NULL;
+    }
+
+    return a;
+}
+
+/* Complete the request, expects asMutex to be held */
+static void asyncComplete(tAsync *a, MYSQL_RES *res, int err)
+{
+    a->res = res;
+    a->err = err;
+    a->done = 1;
+    pthread_cond_broadcast(&asDoneCond);
+}
+
+static void asyncDone(tAsync *a, MYSQL *conn, MYSQL_RES *res)
+{
+    pthread_mutex_lock(&asMutex);
+    asyncComplete(a, res, (res == NULL) ? mysql_errno(conn) : 0);
+    pthread_mutex_unlock(&asMutex);
+}
+
+static void asyncFail(tAsync *a, int err)
+{
+    pthread_mutex_lock(&asMutex);
+    asyncComplete(a, NULL, err);
+    pthread_mutex_unlock(&asMutex);
+}
+
+/* Reopen the connection if it lost the server. Returns 0 if the
+   connection can be used */
+static int asyncReconnect(tAsyncConn *c)
+{
+    if (c->conn != NULL) {
+        if ((mysql_errno(c->conn) != CR_SERVER_GONE_ERROR) && (mysql_errno(c->conn) != CR_SERVER_LOST))
+            return 0;
+        DPRINTF("%s: Reconnecting after %s\n", __FUNCTION__, mysql_error(c->conn));
+        mysql_close(c->conn);
+    }
+
+    if ((c->conn = openConnection(NULL)) == NULL)
+        return -1;
+#ifdef MYSQL_WAIT_READ
+    mysql_options(c->conn, MYSQL_OPT_NONBLOCK, 0);
+#endif
+
+    return 0;
+}
+
+#ifdef MYSQL_WAIT_READ
+
+#include <fcntl.h>
+
+/* Non-blocking client: one thread polls all the connections */
+static int asPipe[2] = { -1, -1 };
+static pthread_t asThread;
+
+static void asyncWake(void)
+{
+    char c = 0;
+
+    if (write(asPipe[1], &c, 1) < 0)
+        DPRINTF("%s: Cannot wake the event loop\n", __FUNCTION__);
+}
+
+/* Advance the connection state machine after the events, ev is 0 to
+   start the request */
+static void asyncStep(tAsyncConn *c, int ev)
+{
+    MYSQL_RES *res = NULL;
+    int ret = 0;
+
+    if (c->state == ASYNC_QUERY) {
+        c->wait = (ev == 0) ? mysql_real_query_start(&ret, c->conn, c->cur->qry, strlen(c->cur->qry))
+                            : mysql_real_query_cont(&ret, c->conn, ev);
+        if (c->wait != 0)
+            return;
+        if (ret != 0) {
+            asyncDone(c->cur, c->conn, NULL);
+            c->state = ASYNC_IDLE;
+            c->cur = NULL;
+            return;
+        }
+        c->state = ASYNC_STORE;
+        ev = 0;
+    }
+
+    c->wait = (ev == 0) ? mysql_store_result_start(&res, c->conn)
+                        : mysql_store_result_cont(&res, c->conn, ev);
+    if (c->wait != 0)
+        return;
+
+    asyncDone(c->cur, c->conn, res);
+    c->state = ASYNC_IDLE;
+    c->cur = NULL;
+}
+
+static void *asyncLoop(void *arg)
+{
+    struct pollfd *fds;
+    tAsyncConn *c;
+    char buf[64];
+    int i, n, ev, timeout, ret;
+    (void) arg;
+
+    fds = (struct pollfd *)malloc( (asNum + 1) * sizeof(struct pollfd) );
+    while (asRunning) {
+        /* Hand the queued requests to the idle connections */
+        pthread_mutex_lock(&asMutex);
+        for (i = 0; i < asNum; i++)
+            if ((asConns[i].state == ASYNC_IDLE) && ((asConns[i].cur = asyncNext()) != NULL))
+                asConns[i].state = ASYNC_QUERY;
+        pthread_mutex_unlock(&asMutex);
+
+        for (i = 0; i < asNum; i++) {
+            c = &asConns[i];
+            if ((c->state != ASYNC_QUERY) || (c->wait != 0))
+                continue;
+            if (asyncReconnect(c) != 0) {
+                asyncFail(c->cur, CR_SERVER_GONE_ERROR);
+                c->state = ASYNC_IDLE;
+                c->cur = NULL;
+                continue;
+            }
+            asyncStep(c, 0);
+        }
+
+        fds[0].fd = asPipe[0];
+        fds[0].events = POLLIN;
+        timeout = -1;
+        for (i = 0, n = 1; i < asNum; i++) {
+            c = &asConns[i];
+            if (c->state == ASYNC_IDLE)
+                continue;
+            fds[n].fd = mysql_get_socket(c->conn);
+            fds[n].events = ((c->wait & MYSQL_WAIT_READ) ? POLLIN : 0)
+                          | ((c->wait & MYSQL_WAIT_WRITE) ? POLLOUT : 0)
+                          | ((c->wait & MYSQL_WAIT_EXCEPT) ? POLLPRI : 0);
+            fds[n].revents = 0;
+            if ((c->wait & MYSQL_WAIT_TIMEOUT)
+                && ((timeout < 0) || (mysql_get_timeout_value_ms(c->conn) < (unsigned int)timeout)))
+                timeout = mysql_get_timeout_value_ms(c->conn);
+            n++;
+        }
+
+        if ((ret = poll(fds, n, timeout)) < 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+            while (read(asPipe[0], buf, sizeof(buf)) == sizeof(buf))
+                ;
+
+        for (i = 0, n = 1; i < asNum; i++) {
+            c = &asConns[i];
+            if (c->state == ASYNC_IDLE)
+                continue;
+            ev = ((fds[n].revents & POLLIN) ? MYSQL_WAIT_READ : 0)
+               | ((fds[n].revents & POLLOUT) ? MYSQL_WAIT_WRITE : 0)
+               | ((fds[n].revents & POLLPRI) ? MYSQL_WAIT_EXCEPT : 0);
+            if ((ev == 0) && (c->wait & MYSQL_WAIT_TIMEOUT) && (ret == 0))
+                ev = MYSQL_WAIT_TIMEOUT;
+            if (ev != 0)
+                asyncStep(c, ev);
+            n++;
+        }
+    }
+    free(fds);
+
+    return NULL;
+}
+
+static int asyncStartThreads(void)
+{
+    int i;
+
+    if (pipe(asPipe) != 0)
+        return -1;
+    fcntl(asPipe[0], F_SETFL, O_NONBLOCK);
+
+    for (i = 0; i < asNum; i++)
+        mysql_options(asConns[i].conn, MYSQL_OPT_NONBLOCK, 0);
+
+    return pthread_create(&asThread, NULL, asyncLoop, NULL);
+}
+
+static void asyncStopThreads(void)
+{
+    asyncWake();
+    pthread_join(asThread, NULL);
+    close(asPipe[0]);
+    close(asPipe[1]);
+}
+
+#else
+
+/* Blocking client: a thread per connection */
+static pthread_cond_t asQueueCond = PTHREAD_COND_INITIALIZER;
+static pthread_t *asThreads = NULL;
+
+static void asyncWake(void)
+{
+    pthread_cond_signal(&asQueueCond);
+}
+
+static void *asyncWorker(void *arg)
+{
+    tAsyncConn *c = (tAsyncConn *)arg;
+    MYSQL_RES *res;
+
+    while (1) {
+        /* The queue is drained before the thread exits */
+        pthread_mutex_lock(&asMutex);
+        while (((c->cur = asyncNext()) == NULL) && (asRunning))
+            pthread_cond_wait(&asQueueCond, &asMutex);
+        pthread_mutex_unlock(&asMutex);
+        if (c->cur == NULL)
+            break;
+
+        if (asyncReconnect(c) != 0)
+            asyncFail(c->cur, CR_SERVER_GONE_ERROR);
+        else {
+            res = NULL;
+            if (mysql_real_query(c->conn, c->cur->qry, strlen(c->cur->qry)) == 0)
+                res = mysql_store_result(c->conn);
+            asyncDone(c->cur, c->conn, res);
+        }
+        c->cur = NULL;
+    }
+
+    return NULL;
+}
+
+static int asyncStartThreads(void)
+{
+    int i;
+
+    asThreads = (pthread_t *)malloc( asNum * sizeof(pthread_t) );
+    for (i = 0; i < asNum; i++)
+        if (pthread_create(&asThreads[i], NULL, asyncWorker, &asConns[i]) != 0)
+            return -1;
+
+    return 0;
+}
+
+static void asyncStopThreads(void)
+{
+    int i;
+
+    pthread_mutex_lock(&asMutex);
+    pthread_cond_broadcast(&asQueueCond);
+    pthread_mutex_unlock(&asMutex);
+    for (i = 0; i < asNum; i++)
+        pthread_join(asThreads[i], NULL);
+    free(asThreads);
+}
+
+#endif
+
+int asyncStart(void)
+{
+    int i;
+
+    if (mAsyncConns <= 0)
+        return 0;
+
+    asConns = (tAsyncConn *)malloc( mAsyncConns * sizeof(tAsyncConn) );
+    memset(asConns, 0, mAsyncConns * sizeof(tAsyncConn));
+    for (asNum = 0; asNum < mAsyncConns; asNum++)
+        if ((asConns[asNum].conn = openConnection(NULL)) == NULL)
+            break;
+
+    if (asNum == 0) {
+        fprintf(stderr, "Error: Cannot open the connections for asynchronous queries\n");
+        free(asConns);
+        return -1;
+    }
+
+    asRunning = 1;
+    if (asyncStartThreads() != 0) {
+        fprintf(stderr, "Error: Cannot start the asynchronous query threads\n");
+        asRunning = 0;
+        for (i = 0; i < asNum; i++)
+            mysql_close(asConns[i].conn);
+        free(asConns);
+        asNum = 0;
+        return -1;
+    }
+
+    DPRINTF("%s: Running queries on %d connections\n", __FUNCTION__, asNum);
+    return 0;
+}
+
+void asyncStop(void)
+{
+    tAsync *a;
+    int i;
+
+    if (!asRunning)
+        return;
+
+    pthread_mutex_lock(&asMutex);
+    asRunning = 0;
+    pthread_mutex_unlock(&asMutex);
+    asyncStopThreads();
+
+    /* The event loop leaves the queries in flight and the queued ones,
+       their waiters would never wake up */
+    pthread_mutex_lock(&asMutex);
+    for (i = 0; i < asNum; i++)
+        if (asConns[i].cur != NULL) {
+            asyncComplete(asConns[i].cur, NULL, CR_SERVER_LOST);
+            asConns[i].cur = NULL;
+        }
+    while ((a = asyncNext()) != NULL)
+        asyncComplete(a, NULL, CR_SERVER_LOST);
+    pthread_mutex_unlock(&asMutex);
+
+    for (i = 0; i < asNum; i++)
+        if (asConns[i].conn != NULL)
+            mysql_close(asConns[i].conn);
+    free(asConns);
+    asNum = 0;
+}
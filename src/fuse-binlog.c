@@ -0,0 +1,368 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Binlog invalidation: with --binlog a background thread connects to the
+  server as a replication client and follows the binary log from its
+  current position. Row events (which name their table using the table
+  map events) drop the cached rows, listings and attributes of the table,
+  other statements (DDL) drop everything including the column lists, so
+  the caches can be kept long while changes made by other clients show
+  up as soon as the event arrives. Requires the binlog enabled on the
+  server (ROW format for table granularity), the REPLICATION SLAVE
+  privilege and the binlog API of the MySQL 8 client library. Every
+  server of the mount is followed by its own thread.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_BINLOG
+
+#ifdef DEBUG_BINLOG
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "binlog: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#if defined(MYSQL_VERSION_ID) && (MYSQL_VERSION_ID >= 80000) && !defined(MARIADB_BASE_VERSION)
+#define HAVE_BINLOG_API
+#endif
+
+#ifdef HAVE_BINLOG_API
+
+/* Event types and header layout of the binlog format v4 */
+#define EVENT_HEADER_SIZE       19
+#define EVENT_TYPE_OFFSET       4
+#define QUERY_EVENT             2
+#define TABLE_MAP_EVENT         19
+#define WRITE_ROWS_EVENT_V1     23
+#define UPDATE_ROWS_EVENT_V1    24
+#define DELETE_ROWS_EVENT_V1    25
+#define WRITE_ROWS_EVENT        30
+#define UPDATE_ROWS_EVENT       31
+#define DELETE_ROWS_EVENT       32
+/* UPDATE of JSON columns with binlog_row_value_options=PARTIAL_JSON */
+#define PARTIAL_UPDATE_ROWS_EVENT 39
+
+/* Table ids are 6 bytes long on any server writing the v4 format */
+#define TABLE_ID_SIZE           6
+
+/* Heartbeats wake the fetch up so the thread notices it is stopped */
+#define BINLOG_HEARTBEAT        "1000000000"
+#define BINLOG_RETRY            1
+
+typedef struct tTableMap {
+    unsigned long long id;
+    char *db;
+    char *tab;
+    struct tTableMap *next;
+} tTableMap;
+
+typedef struct tBinlog {
+    int server;
+    pthread_t thread;
+    tTableMap *maps;
+    /* Set while the events are being followed */
+    volatile int live;
+} tBinlog;
+
+static tBinlog *blServers = NULL;
+static int blNum = 0;
+static volatile int blRunning = 0;
+
+/* Returns 1 if the caches are kept valid by the binlog events. While a
+   thread is reconnecting the caches work as without --binlog */
+int binlogEnabled(void)
+{
+    int i;
+
+    if (blNum == 0)
+        return 0;
+
+    for (i = 0; i < blNum; i++)
+        if (!blServers[i].live)
+            return 0;
+
+    return 1;
+}
+
+static unsigned long long binlogTableId(const unsigned char *p)
+{
+    unsigned long long id = 0;
+    int i;
+
+    for (i = TABLE_ID_SIZE - 1; i >= 0; i--)
+        id = (id << 8) | p[i];
+
+    return id;
+}
+
+static void binlogForgetMaps(tBinlog *bl)
+{
+    tTableMap *m, *next;
+
+    for (m = bl->maps; m != NULL; m = next) {
+        next = m->next;
+        free(m->db);
+        free(m->tab);
+        free(m);
+    }
+    bl->maps = NULL;
+}
+
+/* Remember the table of the table id, the table map event precedes the
+   row events of every statement */
+static void binlogTableMap(tBinlog *bl, const unsigned char *body, unsigned long len)
+{
+    unsigned long dbLen, tabLen;
+    tTableMap *m;
+
+    if (len < TABLE_ID_SIZE + 4)
+        return;
+    dbLen = body[TABLE_ID_SIZE + 2];
+    if (len < TABLE_ID_SIZE + 3 + dbLen + 2)
+        return;
+    tabLen = body[TABLE_ID_SIZE + 3 + dbLen + 1];
+    if (len < TABLE_ID_SIZE + 3 + dbLen + 2 + tabLen)
+        return;
+
+    for (m = bl->maps; m != NULL; m = m->next)
+        if (m->id == binlogTableId(body))
+            break;
+
+    if (m == NULL) {
+        m = (tTableMap *)malloc( sizeof(tTableMap) );
+        m->id = binlogTableId(body);
+        m->next = bl->maps;
+        bl->maps = m;
+    }
+    else {
+        free(m->db);
+        free(m->tab);
+    }
+    m->db = strndup((const char *)body + TABLE_ID_SIZE + 3, dbLen);
+    m->tab = strndup((const char *)body + TABLE_ID_SIZE + 3 + dbLen + 2, tabLen);
+}
+
+static void binlogRows(tBinlog *bl, const unsigned char *body, unsigned long len)
+{
+    unsigned long long id;
+    tTableMap *m;
+
+    if (len < TABLE_ID_SIZE)
+        return;
+
+    id = binlogTableId(body);
+    for (m = bl->maps; m != NULL; m = m->next)
+        if (m->id == id) {
+            DPRINTF("%s: Rows of %s.%s changed\n", __FUNCTION__, m->db, m->tab);
+            rowCacheInvalidate(m->db, m->tab, NULL);
+            return;
+        }
+
+    /* Unknown table, better safe than stale */
+    rowCacheInvalidate(NULL, NULL, NULL);
+}
+
+/* Statements other than BEGIN may change any table or the schema */
+static void binlogQuery(const unsigned char *body, unsigned long len)
+{
+    unsigned long dbLen, varLen, off;
+
+    if (len < 13)
+        return;
+    dbLen = body[8];
+    varLen = body[11] | (body[12] << 8);
+    off = 13 + varLen + dbLen + 1;
+    if ((off + 5 <= len) && (strncasecmp((const char *)body + off, "BEGIN", 5) == 0))
+        return;
+
+    DPRINTF("%s: Statement event, dropping all the caches\n", __FUNCTION__);
+    catalogInvalidate(NULL, NULL);
+    rowCacheInvalidate(NULL, NULL, NULL);
+}
+
+static void binlogEvent(tBinlog *bl, const unsigned char *ev, unsigned long len)
+{
+    if (len < EVENT_HEADER_SIZE)
+        return;
+
+    switch (ev[EVENT_TYPE_OFFSET]) {
+        case TABLE_MAP_EVENT:
+            binlogTableMap(bl, ev + EVENT_HEADER_SIZE, len - EVENT_HEADER_SIZE);
+            break;
+        case WRITE_ROWS_EVENT_V1:
+        case UPDATE_ROWS_EVENT_V1:
+        case DELETE_ROWS_EVENT_V1:
+        case WRITE_ROWS_EVENT:
+        case UPDATE_ROWS_EVENT:
+        case DELETE_ROWS_EVENT:
+        case PARTIAL_UPDATE_ROWS_EVENT:
+            binlogRows(bl, ev + EVENT_HEADER_SIZE, len - EVENT_HEADER_SIZE);
+            break;
+        case QUERY_EVENT:
+            binlogQuery(ev + EVENT_HEADER_SIZE, len - EVENT_HEADER_SIZE);
+            break;
+    }
+}
+
+/* Get the current binlog position to start following from */
+static int binlogPosition(MYSQL *conn, char **file, unsigned long long *pos)
+{
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    /* The statement was renamed in MySQL 8.2 */
+    if ((mysql_query(conn, "SHOW BINARY LOG STATUS") != 0)
+        && (mysql_query(conn, "SHOW MASTER STATUS") != 0))
+        return -1;
+    if ((res = mysql_store_result(conn)) == NULL)
+        return -1;
+
+    if (((row = mysql_fetch_row(res)) == NULL) || (row[0] == NULL) || (row[1] == NULL)) {
+        mysql_free_result(res);
+        return -1;
+    }
+    *file = strdup(row[0]);
+    *pos = strtoull(row[1], NULL, 10);
+    mysql_free_result(res);
+
+    return 0;
+}
+
+static void binlogFollow(tBinlog *bl, MYSQL *conn)
+{
+    MYSQL_RPL rpl;
+    char *file = NULL;
+    unsigned long long pos;
+
+    /* Announce the checksum support and ask for heartbeats, both the old
+       and the new variable names are set */
+    mysql_query(conn, "SET @master_binlog_checksum = @@global.binlog_checksum");
+    mysql_query(conn, "SET @source_binlog_checksum = @@global.binlog_checksum");
+    mysql_query(conn, "SET @master_heartbeat_period = " BINLOG_HEARTBEAT);
+    mysql_query(conn, "SET @source_heartbeat_period = " BINLOG_HEARTBEAT);
+
+    if (binlogPosition(conn, &file, &pos) != 0) {
+        fprintf(stderr, "Error: Cannot get the binlog position: %s\n", mysql_error(conn));
+        return;
+    }
+
+    memset(&rpl, 0, sizeof(rpl));
+    rpl.file_name = file;
+    rpl.file_name_length = strlen(file);
+    rpl.start_position = pos;
+    rpl.server_id = mBinlogServerId;
+
+    if (mysql_binlog_open(conn, &rpl) != 0) {
+        fprintf(stderr, "Error: Cannot open the binlog: %s\n", mysql_error(conn));
+        free(file);
+        return;
+    }
+    DPRINTF("%s: Following %s from %llu on server #%d\n", __FUNCTION__, file, pos, bl->server);
+
+    /* Events may have been missed since the caches were filled */
+    bl->live = 1;
+    catalogInvalidate(NULL, NULL);
+    rowCacheInvalidate(NULL, NULL, NULL);
+
+    while ((blRunning) && (mysql_binlog_fetch(conn, &rpl) == 0) && (rpl.size > 0))
+        /* The packet starts with the OK byte */
+        binlogEvent(bl, rpl.buffer + 1, rpl.size - 1);
+
+    bl->live = 0;
+    if (blRunning)
+        DPRINTF("%s: Binlog stream ended: %s\n", __FUNCTION__, mysql_error(conn));
+    mysql_binlog_close(conn, &rpl);
+    free(file);
+}
+
+static void *binlogThread(void *arg)
+{
+    tBinlog *bl = (tBinlog *)arg;
+    MYSQL *conn;
+
+    mysql_thread_init();
+    while (blRunning) {
+        if ((conn = mysql_init(NULL)) != NULL) {
+            if (routeConnect(conn, bl->server) == 0)
+                binlogFollow(bl, conn);
+            mysql_close(conn);
+            binlogForgetMaps(bl);
+        }
+
+        if (blRunning)
+            sleep(BINLOG_RETRY);
+    }
+
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int binlogStart(void)
+{
+    int num;
+
+    if (mBinlogServerId <= 0)
+        return 0;
+
+    num = routeServers();
+    blServers = (tBinlog *)calloc(num, sizeof(tBinlog));
+    blRunning = 1;
+    for (blNum = 0; blNum < num; blNum++) {
+        blServers[blNum].server = blNum;
+        if (pthread_create(&blServers[blNum].thread, NULL, binlogThread, &blServers[blNum]) != 0) {
+            fprintf(stderr, "Error: Cannot start the binlog thread\n");
+            binlogStop();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void binlogStop(void)
+{
+    int i;
+
+    if (!blRunning)
+        return;
+
+    /* The fetch returns at the next heartbeat at the latest */
+    blRunning = 0;
+    for (i = 0; i < blNum; i++)
+        pthread_join(blServers[i].thread, NULL);
+    free(blServers);
+    blServers = NULL;
+    blNum = 0;
+}
+
+#else
+
+int binlogEnabled(void)
+{
+    return 0;
+}
+
+int binlogStart(void)
+{
+    if (mBinlogServerId <= 0)
+        return 0;
+
+    fprintf(stderr, "Error: The MySQL client library has no binlog API, "
+                    "--binlog is not supported\n");
+    return -1;
+}
+
+void binlogStop(void)
+{
+}
+
+#endif
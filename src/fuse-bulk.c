@@ -0,0 +1,588 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Bulk row creation: level 3 mkdirs are acknowledged immediately and the
+  new rows are kept as pending. A background thread with its own
+  connection inserts the pending rows of a table using multi-row INSERT
+  queries inside one transaction once enough rows are pending, the oldest
+  one waits too long or an operation needs the row to exist in the table.
+  Pending rows are visible to getattr as row directories. A mkdir of a
+  row which is pending or cached fails right away, rows the thread fails
+  to insert are reported by the next access to their path.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_BULK
+
+#ifdef DEBUG_BULK
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "bulk: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define BULK_PENDING            0
+#define BULK_INSERTING          1
+
+/* Maximum size of a single INSERT query */
+#define BULK_QUERY_SIZE         (1024 * 1024)
+/* Failed rows kept for reporting, the older ones are only logged */
+#define BULK_FAILED_MAX         1024
+
+typedef struct tBulkRow {
+    char *db;
+    char *tab;
+    char *pkVal;
+    int state;
+    unsigned long long since;
+    struct tBulkTable *table;
+    struct tBulkRow *next;
+    struct tBulkRow *batch;
+} tBulkRow;
+
+/* Pending rows of a table in creation order, linked using the batch
+   pointer. The whole queue is taken as the next batch of the table */
+typedef struct tBulkTable {
+    char *db;
+    char *tab;
+    tBulkRow *head;
+    tBulkRow *tail;
+    int num;
+    int urgent;
+    struct tBulkTable *next;
+} tBulkTable;
+
+static tBulkRow *bkRows = NULL;
+static tBulkTable *bkTables = NULL;
+/* Rows the thread failed to insert, state holds the error */
+static tBulkRow *bkFailed = NULL;
+static int bkNumFailed = 0;
+static pthread_mutex_t bkMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bkDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t bkThread;
+static int bkRunning = 0;
+
+static unsigned long long bulkNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Does the pending row match the path? Database and table paths match
+   all their rows, deeper paths match all rows of the table */
+static int bulkMatch(tBulkRow *row, const char *path)
+{
+    int level;
+
+    if (path == NULL)
+        return 1;
+
+    level = getLevel(path);
+    if (strcmp(row->db, getPathComponent(path, 0)) != 0)
+        return 0;
+    if ((level > 1) && (strcmp(row->tab, getPathComponent(path, 1)) != 0))
+        return 0;
+
+    return 1;
+}
+
+/* All the functions below expect bkMutex to be held */
+static tBulkRow *bulkFind(const char *path)
+{
+    tBulkRow *row;
+    char *db, *tab, *pkVal;
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+    pkVal = getPathComponent(path, 2);
+    if ((db == NULL) || (tab == NULL) || (pkVal == NULL))
+        return NULL;
+
+    for (row = bkRows; row != NULL; row = row->next)
+        if ((strcmp(row->pkVal, pkVal) == 0) && (strcmp(row->tab, tab) == 0)
+            && (strcmp(row->db, db) == 0))
+            return row;
+
+    return NULL;
+}
+
+static void bulkFree(tBulkRow *row)
+{
+    free(row->db);
+    free(row->tab);
+    free(row->pkVal);
+    free(row);
+}
+
+static void bulkRemove(tBulkRow *row)
+{
+    tBulkRow **p;
+
+    for (p = &bkRows; *p != NULL; p = &(*p)->next)
+        if (*p == row) {
+            *p = row->next;
+            break;
+        }
+
+    bulkFree(row);
+}
+
+/* The queue of the table, the tables are freed by bulkStop() */
+static tBulkTable *bulkTable(const char *db, const char *tab)
+{
+    tBulkTable *t;
+
+    for (t = bkTables; t != NULL; t = t->next)
+        if ((strcmp(t->tab, tab) == 0) && (strcmp(t->db, db) == 0))
+            return t;
+
+    t = (tBulkTable *)malloc( sizeof(tBulkTable) );
+    memset(t, 0, sizeof(tBulkTable));
+    t->db = strdup(db);
+    t->tab = strdup(tab);
+    t->next = bkTables;
+    bkTables = t;
+
+    return t;
+}
+
+/* Take the pending row out of the queue of its table */
+static void bulkUnqueue(tBulkRow *row)
+{
+    tBulkTable *t = row->table;
+    tBulkRow **p, *prev = NULL;
+
+    for (p = &t->head; *p != NULL; prev = *p, p = &(*p)->batch)
+        if (*p == row) {
+            *p = row->batch;
+            if (t->tail == row)
+                t->tail = prev;
+            row->batch = NULL;
+            t->num--;
+            break;
+        }
+}
+
+/* Remove the failure recorded for the path, returns its error or 0 */
+static int bulkForget(const char *path)
+{
+    tBulkRow **p, *row;
+    char *db, *tab, *pkVal;
+    int err;
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+    pkVal = getPathComponent(path, 2);
+    if ((db == NULL) || (tab == NULL) || (pkVal == NULL))
+        return 0;
+
+    for (p = &bkFailed; *p != NULL; p = &(*p)->next) {
+        row = *p;
+        if ((strcmp(row->pkVal, pkVal) == 0) && (strcmp(row->tab, tab) == 0)
+            && (strcmp(row->db, db) == 0)) {
+            *p = row->next;
+            err = row->state;
+            bulkFree(row);
+            bkNumFailed--;
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+int bulkEnabled(void)
+{
+    return (mBulkCreate > 0) ? 1 : 0;
+}
+
+/* Queue the row given by the level 3 path for insertion. Rows known to
+   exist are refused here, the others fail later in the thread */
+int bulkCreate(const char *path)
+{
+    tBulkRow *row;
+    tBulkTable *t;
+
+    pthread_mutex_lock(&bkMutex);
+    if ((bulkFind(path) != NULL) || (rowCacheHasRow(path))) {
+        pthread_mutex_unlock(&bkMutex);
+        return -EEXIST;
+    }
+    /* A new attempt replaces the failed one */
+    bulkForget(path);
+
+    row = (tBulkRow *)malloc( sizeof(tBulkRow) );
+    memset(row, 0, sizeof(tBulkRow));
+    row->db = strdup(getPathComponent(path, 0));
+    row->tab = strdup(getPathComponent(path, 1));
+    row->pkVal = strdup(getPathComponent(path, 2));
+    row->state = BULK_PENDING;
+    row->since = bulkNow();
+    row->next = bkRows;
+    bkRows = row;
+
+    t = bulkTable(row->db, row->tab);
+    row->table = t;
+    if (t->tail != NULL)
+        t->tail->batch = row;
+    else
+        t->head = row;
+    t->tail = row;
+    t->num++;
+
+    /* Apply back-pressure when the inserts cannot keep up */
+    while ((bkRunning) && (t->num >= 4 * mBulkCreate)) {
+        pthread_cond_signal(&bkCond);
+        pthread_cond_wait(&bkDoneCond, &bkMutex);
+    }
+    if (t->num >= mBulkCreate)
+        pthread_cond_signal(&bkCond);
+    pthread_mutex_unlock(&bkMutex);
+
+    DPRINTF("%s: Row %s is pending\n", __FUNCTION__, path);
+    return 0;
+}
+
+int bulkIsPending(const char *path)
+{
+    int ret;
+
+    pthread_mutex_lock(&bkMutex);
+    ret = (bulkFind(path) != NULL) ? 1 : 0;
+    pthread_mutex_unlock(&bkMutex);
+
+    return ret;
+}
+
+/* Returns the error of the failed insert of the row of the path once, 0
+   if it didn't fail */
+int bulkError(const char *path)
+{
+    int ret;
+
+    if ((!bulkEnabled()) || (getLevel(path) < 3))
+        return 0;
+
+    pthread_mutex_lock(&bkMutex);
+    ret = (bkFailed != NULL) ? bulkForget(path) : 0;
+    pthread_mutex_unlock(&bkMutex);
+
+    return ret;
+}
+
+/* Record the row failed to be inserted for reporting */
+static void bulkFail(tBulkRow *row, int err)
+{
+    tBulkRow *f, **p;
+
+    f = (tBulkRow *)malloc( sizeof(tBulkRow) );
+    memset(f, 0, sizeof(tBulkRow));
+    f->db = strdup(row->db);
+    f->tab = strdup(row->tab);
+    f->pkVal = strdup(row->pkVal);
+    f->state = err;
+
+    pthread_mutex_lock(&bkMutex);
+    f->next = bkFailed;
+    bkFailed = f;
+    /* Drop the oldest failure */
+    if (++bkNumFailed > BULK_FAILED_MAX) {
+        for (p = &bkFailed; (*p)->next != NULL; p = &(*p)->next) ;
+        bulkFree(*p);
+        *p = NULL;
+        bkNumFailed--;
+    }
+    pthread_mutex_unlock(&bkMutex);
+}
+
+/* Columns of a pending row need the row to exist in the table so the
+   row is inserted first. Returns 1 if the path is a pending row directory
+   which can be answered without the database */
+int bulkCheck(const char *path)
+{
+    int level;
+
+    if ((!bulkEnabled()) || ((level = getLevel(path)) < 3) || (!bulkIsPending(path)))
+        return 0;
+
+    if (level == 3)
+        return 1;
+
+    bulkSync(path);
+    return 0;
+}
+
+/* Drop the pending row given by the level 3 path. Returns 1 if the row
+   was never inserted, 0 if it has to be deleted from the table */
+int bulkCancel(const char *path)
+{
+    tBulkRow *row;
+    int ret = 0;
+
+    pthread_mutex_lock(&bkMutex);
+    while (((row = bulkFind(path)) != NULL) && (row->state == BULK_INSERTING))
+        pthread_cond_wait(&bkDoneCond, &bkMutex);
+    if (row != NULL) {
+        bulkUnqueue(row);
+        bulkRemove(row);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&bkMutex);
+
+    return ret;
+}
+
+/* Insert all the pending rows matching the path and wait for them */
+void bulkSync(const char *path)
+{
+    tBulkRow *row;
+    int num;
+
+    if (!bulkEnabled())
+        return;
+
+    pthread_mutex_lock(&bkMutex);
+    do {
+        num = 0;
+        for (row = bkRows; row != NULL; row = row->next)
+            if (bulkMatch(row, path)) {
+                if (row->state == BULK_PENDING)
+                    row->table->urgent = 1;
+                num++;
+            }
+
+        if (num > 0) {
+            pthread_cond_signal(&bkCond);
+            pthread_cond_wait(&bkDoneCond, &bkMutex);
+        }
+    } while ((num > 0) && (bkRunning));
+    pthread_mutex_unlock(&bkMutex);
+}
+
+static int bulkInsert(MYSQL *conn, tBulkRow *batch, char *cols)
+{
+    tBulkRow *row;
+    char *qry, *vals;
+    unsigned long size;
+    int ret = 0, first = 1;
+
+    qry = (char *)malloc( BULK_QUERY_SIZE * sizeof(char) );
+    for (row = batch; (row != NULL) && (ret == 0); row = row->batch) {
+        /* Row names are encoded key values, see fuse-key.c */
+        if ((vals = keyValues(*conn, batch->tab, row->pkVal)) == NULL) {
+            DPRINTF("%s: Invalid key '%s'\n", __FUNCTION__, row->pkVal);
+            ret = -EINVAL;
+            break;
+        }
+
+        /* Send the query when the value doesn't fit */
+        if ((!first) && (strlen(qry) + strlen(vals) + 4 >= BULK_QUERY_SIZE)) {
+            if (mysql_real_query(conn, qry, strlen(qry)) != 0) {
+                DPRINTF("%s: Insert failed: %s\n", __FUNCTION__, mysql_error(conn));
+                ret = -EIO;
+            }
+            first = 1;
+        }
+
+        if (first) {
+            snprintf(qry, BULK_QUERY_SIZE, "INSERT INTO `%s`(%s) VALUES", batch->tab, cols);
+            first = 0;
+        }
+        else
+            strcat(qry, ",");
+
+        size = strlen(qry);
+        snprintf(qry + size, BULK_QUERY_SIZE - size, "(%s)", vals);
+        free(vals);
+    }
+
+    if ((!first) && (ret == 0) && (mysql_real_query(conn, qry, strlen(qry)) != 0)) {
+        DPRINTF("%s: Insert failed: %s\n", __FUNCTION__, mysql_error(conn));
+        ret = -EIO;
+    }
+    free(qry);
+
+    return ret;
+}
+
+/* Insert the batch of rows of one table in a single transaction. If the
+   transaction fails the rows are inserted one by one so only the
+   offending rows (e.g. duplicates) are lost */
+static void bulkFlush(MYSQL *conn, tBulkRow *batch)
+{
+    tBulkRow *row, *next;
+    char *pk;
+    int ret = -EIO;
+
+    if ((mysql_select_db(conn, batch->db) == 0)
+        && ((pk = keyColumns(*conn, batch->tab)) != NULL)) {
+        mysql_query(conn, "START TRANSACTION");
+        ret = bulkInsert(conn, batch, pk);
+        if (ret == 0)
+            ret = (mysql_query(conn, "COMMIT") == 0) ? 0 : -EIO;
+        else
+            mysql_query(conn, "ROLLBACK");
+
+        if (ret != 0)
+            for (row = batch; row != NULL; row = next) {
+                next = row->batch;
+                row->batch = NULL;
+                if ((ret = bulkInsert(conn, row, pk)) != 0) {
+                    fprintf(stderr, "Error: Cannot create row %s/%s/%s: %s\n",
+                            row->db, row->tab, row->pkVal, mysql_error(conn));
+                    bulkFail(row, ret);
+                }
+                row->batch = next;
+            }
+        free(pk);
+    }
+    else {
+        fprintf(stderr, "Error: Cannot create rows in %s/%s\n", batch->db, batch->tab);
+        for (row = batch; row != NULL; row = row->batch)
+            bulkFail(row, -EIO);
+    }
+
+    rowCacheInvalidate(batch->db, batch->tab, NULL);
+    routePin(batch->db, batch->tab);
+}
+
+/* Pick the table to be flushed next and take its queue of pending rows
+   as the batch, chained using the batch pointer. Returns NULL and the
+   time to wait in wait if no table is due yet */
+static tBulkRow *bulkNextBatch(unsigned long long *wait)
+{
+    unsigned long long now, due;
+    tBulkRow *batch, *row;
+    tBulkTable *t;
+
+    now = bulkNow();
+    *wait = 0;
+
+    for (t = bkTables; t != NULL; t = t->next) {
+        if (t->head == NULL)
+            continue;
+
+        /* The head of the queue is the oldest pending row */
+        due = t->head->since + mBulkCreateTime;
+        if ((!t->urgent) && (t->num < mBulkCreate) && (due > now) && (bkRunning)) {
+            if ((*wait == 0) || (due - now < *wait))
+                *wait = due - now;
+            continue;
+        }
+
+        batch = t->head;
+        for (row = batch; row != NULL; row = row->batch)
+            row->state = BULK_INSERTING;
+        t->head = t->tail = NULL;
+        t->num = 0;
+        t->urgent = 0;
+
+        return batch;
+    }
+
+    return NULL;
+}
+
+static void *bulkThread(void *arg)
+{
+    tBulkRow *batch, *row, *next;
+    unsigned long long wait;
+    struct timespec ts;
+    MYSQL **conns, *conn;
+
+    mysql_thread_init();
+    /* The connections to the servers are opened on first use */
+    conns = (MYSQL **)calloc(routeServers(), sizeof(MYSQL *));
+
+    pthread_mutex_lock(&bkMutex);
+    while ((bkRunning) || (bkRows != NULL)) {
+        if ((batch = bulkNextBatch(&wait)) == NULL) {
+            if (!bkRunning)
+                break;
+            if (wait > 0) {
+                wait += bulkNow();
+                ts.tv_sec = wait / 1000;
+                ts.tv_nsec = (wait % 1000) * 1000000;
+                pthread_cond_timedwait(&bkCond, &bkMutex, &ts);
+            }
+            else
+                pthread_cond_wait(&bkCond, &bkMutex);
+            continue;
+        }
+        pthread_mutex_unlock(&bkMutex);
+
+        DPRINTF("%s: Inserting pending rows into %s/%s\n", __FUNCTION__, batch->db, batch->tab);
+        if ((conn = routeConnection(conns, batch->db)) != NULL)
+            bulkFlush(conn, batch);
+        else {
+            fprintf(stderr, "Error: No connection to create rows in %s/%s\n",
+                    batch->db, batch->tab);
+            for (row = batch; row != NULL; row = row->batch)
+                bulkFail(row, -EIO);
+        }
+
+        pthread_mutex_lock(&bkMutex);
+        for (row = batch; row != NULL; row = next) {
+            next = row->batch;
+            bulkRemove(row);
+        }
+        pthread_cond_broadcast(&bkDoneCond);
+    }
+    pthread_mutex_unlock(&bkMutex);
+
+    routeCloseConnections(conns);
+    free(conns);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int bulkStart(void)
+{
+    if (!bulkEnabled())
+        return 0;
+
+    bkRunning = 1;
+    if (pthread_create(&bkThread, NULL, bulkThread, NULL) != 0) {
+        fprintf(stderr, "Error: Cannot start bulk create thread\n");
+        bkRunning = 0;
+        mBulkCreate = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void bulkStop(void)
+{
+    tBulkTable *t;
+
+    if (!bkRunning)
+        return;
+
+    /* The thread inserts all the remaining rows before exiting */
+    pthread_mutex_lock(&bkMutex);
+    bkRunning = 0;
+    pthread_cond_broadcast(&bkCond);
+    pthread_mutex_unlock(&bkMutex);
+
+    pthread_join(bkThread, NULL);
+
+    while (bkTables != NULL) {
+        t = bkTables;
+        bkTables = t->next;
+        free(t->db);
+        free(t->tab);
+        free(t);
+    }
+}
@@ -0,0 +1,1247 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Row cache: all columns of a row are fetched using a single query on the
+  first access to the row directory or one of its column files. Later
+  reads, getattrs and readdirs of the row are served from memory until
+  the entry expires or a local write invalidates it. The cache is a LRU
+  list bounded by the total size of the cached data. Rows walked in the
+  order of the table listing are read ahead in batches. Optionally the
+  rows are read using the HANDLER interface instead of SELECT.
+
+  Path cache: when the data cannot change under the mount (snapshot mode)
+  the results of getattr and readdir are kept for any path until the
+  cache is cleared.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_CACHE
+
+#ifdef DEBUG_CACHE
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "cache: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define ROWCACHE_BUCKETS        4096
+
+typedef struct tRowCache {
+    char *key;
+    char *db;
+    char *tab;
+    int numFields;
+    char **names;
+    char *isKey;
+    char **values;
+    unsigned long *lengths;
+    time_t mtime;
+    time_t fetched;
+    unsigned long size;
+    struct tRowCache *prev;
+    struct tRowCache *next;
+    struct tRowCache *hnext;
+} tRowCache;
+
+static tRowCache *rcBuckets[ROWCACHE_BUCKETS] = { NULL };
+static tRowCache *rcHead = NULL;
+static tRowCache *rcTail = NULL;
+static unsigned long rcSize = 0;
+/* Incremented by every invalidation, rows fetched before are dropped */
+static unsigned long rcGen = 0;
+static pthread_mutex_t rcMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int rowCacheHash(const char *key)
+{
+    unsigned int h = 5381;
+
+    while (*key)
+        h = (h * 33) ^ (unsigned char)*key++;
+
+    return h % ROWCACHE_BUCKETS;
+}
+
+static char *rowCacheKey(const char *db, const char *tab, const char *pkVal)
+{
+    char *key;
+    int size;
+
+    size = strlen(db) + strlen(tab) + strlen(pkVal) + 3;
+    key = (char *)malloc( size * sizeof(char) );
+    snprintf(key, size, "%s/%s/%s", db, tab, pkVal);
+
+    return key;
+}
+
+static void rowCacheFree(tRowCache *e)
+{
+    int i;
+
+    if (e == NULL)
+        return;
+
+    for (i = 0; i < e->numFields; i++) {
+        free(e->names[i]);
+        free(e->values[i]);
+    }
+    free(e->names);
+    free(e->values);
+    free(e->lengths);
+    free(e->isKey);
+    free(e->tab);
+    free(e->db);
+    free(e->key);
+    free(e);
+}
+
+/* All the functions below expect rcMutex to be held */
+static tRowCache *rowCacheFind(const char *key)
+{
+    tRowCache *e;
+
+    for (e = rcBuckets[rowCacheHash(key)]; e != NULL; e = e->hnext)
+        if (strcmp(e->key, key) == 0)
+            return e;
+
+    return NULL;
+}
+
+static void rowCacheUnlink(tRowCache *e)
+{
+    tRowCache **p;
+
+    for (p = &rcBuckets[rowCacheHash(e->key)]; *p != NULL; p = &(*p)->hnext)
+        if (*p == e) {
+            *p = e->hnext;
+            break;
+        }
+
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        rcHead = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        rcTail = e->prev;
+
+    rcSize -= e->size;
+    e->prev = e->next = e->hnext = NULL;
+}
+
+static void rowCacheTouch(tRowCache *e)
+{
+    if (rcHead == e)
+        return;
+
+    /* Move the entry to the head of the LRU list */
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        rcTail = e->prev;
+
+    e->prev = NULL;
+    e->next = rcHead;
+    if (rcHead != NULL)
+        rcHead->prev = e;
+    rcHead = e;
+    if (rcTail == NULL)
+        rcTail = e;
+}
+
+static void rowCacheInsert(tRowCache *e)
+{
+    tRowCache *old;
+    unsigned int h;
+
+    if ((old = rowCacheFind(e->key)) != NULL) {
+        rowCacheUnlink(old);
+        rowCacheFree(old);
+    }
+
+    h = rowCacheHash(e->key);
+    e->hnext = rcBuckets[h];
+    rcBuckets[h] = e;
+
+    e->prev = NULL;
+    e->next = rcHead;
+    if (rcHead != NULL)
+        rcHead->prev = e;
+    rcHead = e;
+    if (rcTail == NULL)
+        rcTail = e;
+
+    rcSize += e->size;
+}
+
+static void rowCacheEvict(void)
+{
+    tRowCache *e;
+
+    while ((rcSize > (unsigned long)mRowCacheSize) && ((e = rcTail) != NULL)) {
+        DPRINTF("%s: Evicting '%s' (%lu bytes)\n", __FUNCTION__, e->key, e->size);
+        rowCacheUnlink(e);
+        rowCacheFree(e);
+    }
+}
+
+static int rowCacheIsFresh(tRowCache *e)
+{
+    /* Rows of a snapshot never change, stale rows are better than none
+       while the server is down */
+    if ((snapshotEnabled()) || (routeOffline()))
+        return 1;
+
+    return (time(NULL) - e->fetched <= mRowCacheTTL) ? 1 : 0;
+}
+
+/* Replace the stored value of field i by its logical value if the column
+   is compressed */
+static void rowCacheDecode(tRowCache *e, int i, char *db, char *tab)
+{
+    unsigned long len;
+    char *val;
+
+    if ((e->values[i] == NULL) || (!compressColumn(db, tab, e->names[i])))
+        return;
+
+    if ((val = compressDecode(e->values[i], e->lengths[i], &len)) != NULL) {
+        free(e->values[i]);
+        e->values[i] = val;
+        e->lengths[i] = len;
+    }
+}
+
+/* Build the cache entry from the current row of the result set, name is
+   the encoded primary key of the row. The extra trailing field, if
+   requested, is UNIX_TIMESTAMP() of the row modification time column */
+static tRowCache *rowCacheFromRow(MYSQL_RES *res, MYSQL_ROW row, char *db, char *tab,
+                                  char *name, char **pkCols, int numPk, int hasMtime)
+{
+    tRowCache *e;
+    MYSQL_FIELD *fields;
+    unsigned long *lengths;
+    int i, j;
+
+    fields = mysql_fetch_fields(res);
+    lengths = mysql_fetch_lengths(res);
+
+    e = (tRowCache *)malloc( sizeof(tRowCache) );
+    memset(e, 0, sizeof(tRowCache));
+    e->numFields = mysql_num_fields(res) - (hasMtime ? 1 : 0);
+    e->names = (char **)malloc( e->numFields * sizeof(char *) );
+    e->values = (char **)malloc( e->numFields * sizeof(char *) );
+    e->lengths = (unsigned long *)malloc( e->numFields * sizeof(unsigned long) );
+    e->isKey = (char *)malloc( e->numFields * sizeof(char) );
+
+    for (i = 0; i < e->numFields; i++) {
+        e->names[i] = strdup(fields[i].name);
+        e->lengths[i] = lengths[i];
+        if (row[i] != NULL) {
+            e->values[i] = (char *)malloc( (lengths[i] + 1) * sizeof(char) );
+            memcpy(e->values[i], row[i], lengths[i]);
+            e->values[i][lengths[i]] = 0;
+        }
+        else
+            e->values[i] = NULL;
+        rowCacheDecode(e, i, db, tab);
+        e->size += strlen(fields[i].name) + e->lengths[i] + 3;
+        e->isKey[i] = 0;
+        for (j = 0; j < numPk; j++)
+            if (strcmp(fields[i].name, pkCols[j]) == 0)
+                e->isKey[i] = 1;
+    }
+
+    e->mtime = 0;
+    if ((hasMtime) && (row[e->numFields] != NULL) && (atol(row[e->numFields]) > 0))
+        e->mtime = atol(row[e->numFields]);
+
+    e->db = strdup(db);
+    e->tab = strdup(tab);
+    e->key = rowCacheKey(db, tab, (name != NULL) ? name : "");
+    e->fetched = time(NULL);
+    e->size += sizeof(tRowCache) + strlen(e->key) + 1;
+
+    return e;
+}
+
+/* Build the cache entry from the local copy of a --mirror table, returns
+   -1 if the row has to be fetched from the server */
+static int rowCacheMirror(char *db, char *tab, char *pkVal, tRowCache **entry)
+{
+    tRowCache *e;
+    int i;
+
+    *entry = NULL;
+
+    e = (tRowCache *)malloc( sizeof(tRowCache) );
+    memset(e, 0, sizeof(tRowCache));
+    if (mirrorRow(db, tab, pkVal, &e->numFields, &e->names, &e->isKey, &e->values,
+                  &e->lengths, &e->mtime) != 1) {
+        free(e);
+        return -1;
+    }
+
+    for (i = 0; i < e->numFields; i++) {
+        rowCacheDecode(e, i, db, tab);
+        e->size += strlen(e->names[i]) + e->lengths[i] + 3;
+    }
+    e->db = strdup(db);
+    e->tab = strdup(tab);
+    e->key = rowCacheKey(db, tab, pkVal);
+    e->fetched = time(NULL);
+    e->size += sizeof(tRowCache) + strlen(e->key) + 1;
+    *entry = e;
+
+    return 1;
+}
+
+/* HANDLER reads: with --handler rows are read using "HANDLER ... READ
+   `PRIMARY`" which skips the SQL parser and optimizer. The handlers are
+   opened once per connection (server thread id) and table under the h<n>
+   alias and forgotten when a read fails, e.g. after a reconnect */
+typedef struct tHandler {
+    unsigned long thread;
+    char *db;
+    char *tab;
+    int id;
+    struct tHandler *next;
+} tHandler;
+
+static tHandler *hList = NULL;
+static int hLastId = 0;
+static pthread_mutex_t hMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns the alias number of the handler, -1 if it cannot be opened */
+static int handlerOpen(MYSQL sql, char *db, char *tab)
+{
+    char qry[1024] = { 0 };
+    unsigned long thread;
+    tHandler *h;
+    int id = -1;
+
+    thread = mysql_thread_id(&sql);
+
+    pthread_mutex_lock(&hMutex);
+    for (h = hList; h != NULL; h = h->next)
+        if ((h->thread == thread) && (strcmp(h->db, db) == 0) && (strcmp(h->tab, tab) == 0)) {
+            id = h->id;
+            break;
+        }
+
+    if (id < 0) {
+        id = ++hLastId;
+        snprintf(qry, sizeof(qry), "HANDLER `%s`.`%s` OPEN AS `h%d`", db, tab, id);
+        DPRINTF("%s: Opening handler using \"%s\"\n", __FUNCTION__, qry);
+        if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
+            DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(&sql));
+            id = -1;
+        }
+        else {
+            h = (tHandler *)malloc( sizeof(tHandler) );
+            h->thread = thread;
+            h->db = strdup(db);
+            h->tab = strdup(tab);
+            h->id = id;
+            h->next = hList;
+            hList = h;
+        }
+    }
+    pthread_mutex_unlock(&hMutex);
+
+    return id;
+}
+
+static void handlerForget(MYSQL sql, int id)
+{
+    char qry[64] = { 0 };
+    tHandler *h, **ph;
+
+    /* The handler may be gone already, errors are ignored */
+    snprintf(qry, sizeof(qry), "HANDLER `h%d` CLOSE", id);
+    mysql_real_query(&sql, qry, strlen(qry));
+
+    pthread_mutex_lock(&hMutex);
+    for (ph = &hList; (h = *ph) != NULL; ph = &h->next)
+        if (h->id == id) {
+            *ph = h->next;
+            free(h->db);
+            free(h->tab);
+            free(h);
+            break;
+        }
+    pthread_mutex_unlock(&hMutex);
+}
+
+/* Fetch the row from the database. When limit is greater than one the
+   following rows in primary key order are fetched as well and chained
+   using the next pointer. Returns 1 if any row was found, 0 if none and
+   -1 if the row cannot be cached */
+static int rowCacheFetch(MYSQL sql, char *db, char *tab, char *pkVal, int limit,
+                         tRowCache **entry)
+{
+    tRowCache *e, *last = NULL;
+    char qry[4096] = { 0 };
+    char *mcol = NULL, *name, *cond;
+    char **pkCols, **pkTypes;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    time_t tabMtime = 0;
+    int hid = -1, numPk, i, ret;
+
+    *entry = NULL;
+
+    mysql_select_db(&sql, db);
+    if ((numPk = catalogPrimaryKeys(sql, db, tab, &pkCols, &pkTypes)) <= 0) {
+        for (i = 0; i < numPk; i++) {
+            free(pkCols[i]);
+            free(pkTypes[i]);
+        }
+        free(pkCols);
+        free(pkTypes);
+        return -1;
+    }
+    for (i = 0; i < numPk; i++)
+        free(pkTypes[i]);
+    free(pkTypes);
+
+    mcol = getMtimeColumnName(sql, tab);
+
+    /* HANDLER returns the raw columns only, the rows of the tables with a
+       modification time column are read by SELECT so UNIX_TIMESTAMP()
+       converts it in the session time zone like everywhere else */
+    if (flagIsSet(FLAG_HANDLER) && (mcol == NULL) && ((hid = handlerOpen(sql, db, tab)) >= 0)) {
+        if ((cond = keyValues(sql, tab, pkVal)) == NULL) {
+            ret = -1;
+            goto out;
+        }
+        snprintf(qry, sizeof(qry), "HANDLER `h%d` READ `PRIMARY` %s (%s)",
+                 hid, (limit > 1) ? ">=" : "=", cond);
+        free(cond);
+        if (limit > 1)
+            snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), " LIMIT %d", limit);
+
+        DPRINTF("%s: Fetching row using \"%s\"\n", __FUNCTION__, qry);
+        if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
+            DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(&sql));
+            handlerForget(sql, hid);
+            hid = -1;
+        }
+    }
+
+    if (hid < 0) {
+        char *order = NULL;
+
+        /* Names that don't decode to a key of the table match no row */
+        cond = keyCompare(sql, tab, pkVal, (limit > 1) ? ">=" : "=");
+        if ((limit > 1) && (cond != NULL))
+            order = keyColumns(sql, tab);
+        if ((cond == NULL) || ((limit > 1) && (order == NULL))) {
+            free(cond);
+            ret = -1;
+            goto out;
+        }
+
+        snprintf(qry, sizeof(qry), "SELECT *%s%s%s FROM `%s` WHERE %s",
+                 mcol ? ", UNIX_TIMESTAMP(`" : "", mcol ? mcol : "", mcol ? "`)" : "",
+                 tab, cond);
+        if (limit > 1)
+            snprintf(qry + strlen(qry), sizeof(qry) - strlen(qry), " ORDER BY %s LIMIT %d",
+                     order, limit);
+        free(cond);
+        free(order);
+
+        DPRINTF("%s: Fetching row using \"%s\"\n", __FUNCTION__, qry);
+        if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
+            DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(&sql));
+            ret = -1;
+            goto out;
+        }
+    }
+
+    res = mysql_store_result(&sql);
+    if (res == NULL) {
+        ret = -1;
+        goto out;
+    }
+
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        name = keyRowName(sql, tab, res, row);
+        e = rowCacheFromRow(res, row, db, tab, name, pkCols, numPk, (mcol != NULL));
+        free(name);
+        if (last != NULL)
+            last->next = e;
+        else
+            *entry = e;
+        last = e;
+    }
+
+    mysql_free_result(res);
+    ret = (*entry != NULL) ? 1 : 0;
+
+    /* Rows without a time of their own get the one of the table, a row with
+       the time of a failed query is not kept */
+    for (e = *entry; e != NULL; e = e->next) {
+        if (e->mtime > 0)
+            continue;
+        if ((tabMtime <= 0) && (catalogTableMtime(sql, db, tab, &tabMtime) != 0)) {
+            for (e = *entry; e != NULL; e = last) {
+                last = e->next;
+                rowCacheFree(e);
+            }
+            *entry = NULL;
+            ret = -1;
+            break;
+        }
+        e->mtime = tabMtime;
+    }
+
+out:
+    for (i = 0; i < numPk; i++)
+        free(pkCols[i]);
+    free(pkCols);
+    free(mcol);
+
+    return ret;
+}
+
+/* Readahead: the order of the rows emitted by the last level 2 readdir of
+   the table is remembered. When rows are accessed in that order a miss
+   fetches the next mReadahead rows using a single ranged query */
+typedef struct tReadahead {
+    char *db;
+    char *tab;
+    int num;
+    char **pks;
+    int *sorted;
+    int lastIdx;
+    int streak;
+    struct tReadahead *next;
+} tReadahead;
+
+typedef struct tReadaheadFill {
+    void *buf;
+    fuse_fill_dir_t filler;
+    int num;
+    int alloc;
+    char **pks;
+} tReadaheadFill;
+
+#define READAHEAD_TABLES        8
+
+static tReadahead *raList = NULL;
+static pthread_mutex_t raMutex = PTHREAD_MUTEX_INITIALIZER;
+static char **raSortKeys = NULL;
+
+static void readaheadFree(tReadahead *ra)
+{
+    int i;
+
+    for (i = 0; i < ra->num; i++)
+        free(ra->pks[i]);
+    free(ra->pks);
+    free(ra->sorted);
+    free(ra->db);
+    free(ra->tab);
+    free(ra);
+}
+
+static int readaheadCompare(const void *a, const void *b)
+{
+    return strcmp(raSortKeys[*(const int *)a], raSortKeys[*(const int *)b]);
+}
+
+/* Returns the position of the primary key value in the listing, expects
+   raMutex to be held */
+static int readaheadFind(tReadahead *ra, const char *pkVal)
+{
+    int lo, hi, mid, cmp;
+
+    if ((ra->lastIdx + 1 < ra->num) && (strcmp(ra->pks[ra->lastIdx + 1], pkVal) == 0))
+        return ra->lastIdx + 1;
+
+    lo = 0;
+    hi = ra->num - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        cmp = strcmp(ra->pks[ra->sorted[mid]], pkVal);
+        if (cmp == 0)
+            return ra->sorted[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return -1;
+}
+
+static int readaheadFiller(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+    tReadaheadFill *fill = (tReadaheadFill *)buf;
+
+    if (fill->num == fill->alloc) {
+        fill->alloc = (fill->alloc > 0) ? fill->alloc * 2 : 256;
+        fill->pks = (char **)realloc(fill->pks, fill->alloc * sizeof(char *));
+    }
+    fill->pks[fill->num++] = strdup(name);
+
+    return fill->filler(fill->buf, name, stbuf, off);
+}
+
+/* List the rows of the table and remember their order */
+int readaheadListing(MYSQL sql, char *path, fuse_fill_dir_t filler, void *buf)
+{
+    tReadaheadFill fill;
+    tReadahead *ra, **p;
+    char *tab;
+    int ret, i;
+
+    tab = getPathComponent(path, 1);
+    if ((mReadahead <= 1) || (mRowCacheSize <= 0))
+        return keyListing(sql, tab, NULL, S_IFDIR | 0755, buf, filler);
+
+    memset(&fill, 0, sizeof(fill));
+    fill.buf = buf;
+    fill.filler = filler;
+
+    ret = keyListing(sql, tab, NULL, S_IFDIR | 0755, &fill, readaheadFiller);
+
+    ra = (tReadahead *)malloc( sizeof(tReadahead) );
+    ra->db = strdup(getPathComponent(path, 0));
+    ra->tab = strdup(getPathComponent(path, 1));
+    ra->num = fill.num;
+    ra->pks = fill.pks;
+    ra->sorted = (int *)malloc( (fill.num + 1) * sizeof(int) );
+    for (i = 0; i < fill.num; i++)
+        ra->sorted[i] = i;
+    ra->lastIdx = -1;
+    ra->streak = 0;
+
+    pthread_mutex_lock(&raMutex);
+    raSortKeys = ra->pks;
+    qsort(ra->sorted, ra->num, sizeof(int), readaheadCompare);
+
+    /* Replace the previous listing of the table and keep only a few */
+    for (p = &raList, i = 0; *p != NULL; ) {
+        tReadahead *cur = *p;
+
+        if (((strcmp(cur->db, ra->db) == 0) && (strcmp(cur->tab, ra->tab) == 0))
+            || (++i >= READAHEAD_TABLES)) {
+            *p = cur->next;
+            readaheadFree(cur);
+        }
+        else
+            p = &cur->next;
+    }
+    ra->next = raList;
+    raList = ra;
+    pthread_mutex_unlock(&raMutex);
+
+    DPRINTF("%s: Remembered %d rows of %s\n", __FUNCTION__, ra->num, path);
+    return ret;
+}
+
+/* Note the access to the row and return the number of rows to fetch on
+   a miss: mReadahead when the rows are being walked in listing order */
+static int readaheadWindow(char *db, char *tab, char *pkVal)
+{
+    tReadahead *ra;
+    int idx, ret = 1;
+
+    if (mReadahead <= 1)
+        return 1;
+
+    pthread_mutex_lock(&raMutex);
+    for (ra = raList; ra != NULL; ra = ra->next)
+        if ((strcmp(ra->db, db) == 0) && (strcmp(ra->tab, tab) == 0))
+            break;
+
+    if ((ra != NULL) && ((idx = readaheadFind(ra, pkVal)) >= 0)) {
+        if (idx == ra->lastIdx + 1)
+            ra->streak++;
+        else
+        if (idx != ra->lastIdx)
+            ra->streak = 0;
+        ra->lastIdx = idx;
+
+        if (ra->streak > 0)
+            ret = mReadahead;
+    }
+    pthread_mutex_unlock(&raMutex);
+
+    return ret;
+}
+
+/* Look up the row the path belongs to, fetching it if necessary. Returns
+   with rcMutex held: 1 if the row is found (stored to entry), 0 if the row
+   doesn't exist and -1 if the cache cannot serve the path */
+static int rowCacheAcquire(MYSQL sql, char *path, tRowCache **entry)
+{
+    char *db, *tab, *pkVal, *key;
+    unsigned long gen;
+    tRowCache *e;
+    int ret, limit;
+
+    *entry = NULL;
+
+    if (getLevel(path) < 3) {
+        pthread_mutex_lock(&rcMutex);
+        return -1;
+    }
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+    pkVal = getPathComponent(path, 2);
+    if ((db == NULL) || (tab == NULL) || (pkVal == NULL)) {
+        pthread_mutex_lock(&rcMutex);
+        return -1;
+    }
+
+    /* Without the cache only the rows of the mirrors are served, the entry
+       is evicted on release */
+    if (mRowCacheSize <= 0) {
+        ret = rowCacheMirror(db, tab, pkVal, &e);
+        pthread_mutex_lock(&rcMutex);
+        if (ret == 1) {
+            rowCacheInsert(e);
+            *entry = e;
+        }
+        return ret;
+    }
+
+    /* Every access moves the readahead position, hit or not */
+    limit = readaheadWindow(db, tab, pkVal);
+
+    key = rowCacheKey(db, tab, pkVal);
+    pthread_mutex_lock(&rcMutex);
+    if (((e = rowCacheFind(key)) != NULL) && (rowCacheIsFresh(e))) {
+        DPRINTF("%s: Cache hit for '%s'\n", __FUNCTION__, key);
+        rowCacheTouch(e);
+        free(key);
+        *entry = e;
+        return 1;
+    }
+    gen = rcGen;
+    pthread_mutex_unlock(&rcMutex);
+
+    /* The mutex is not held while talking to the server */
+    DPRINTF("%s: Cache miss for '%s', fetching %d row(s)\n", __FUNCTION__, key, limit);
+    if ((ret = rowCacheMirror(db, tab, pkVal, &e)) < 0)
+        ret = rowCacheFetch(sql, db, tab, pkVal, limit, &e);
+
+    /* Readahead starts at the requested row which may not exist */
+    if ((ret == 1) && (limit > 1) && (strcasecmp(e->key, key) != 0))
+        ret = 0;
+
+    pthread_mutex_lock(&rcMutex);
+    /* The rows may be older than an invalidation done during the fetch */
+    if (gen != rcGen) {
+        tRowCache *next;
+
+        DPRINTF("%s: Dropping '%s' fetched before an invalidation\n", __FUNCTION__, key);
+        for (; e != NULL; e = next) {
+            next = e->next;
+            rowCacheFree(e);
+        }
+        free(key);
+        return -1;
+    }
+    if ((ret == 1) || (e != NULL)) {
+        tRowCache *next;
+
+        /* Key the entry by the requested path, the collation may have matched
+           a primary key value spelled differently */
+        if (ret == 1) {
+            free(e->key);
+            e->key = strdup(key);
+            *entry = e;
+        }
+
+        for (; e != NULL; e = next) {
+            next = e->next;
+            rowCacheInsert(e);
+        }
+    }
+    if (ret != 1) {
+        if ((e = rowCacheFind(key)) != NULL) {
+            rowCacheUnlink(e);
+            rowCacheFree(e);
+        }
+    }
+    free(key);
+
+    return ret;
+}
+
+static void rowCacheRelease(void)
+{
+    rowCacheEvict();
+    pthread_mutex_unlock(&rcMutex);
+}
+
+static int rowCacheFieldIndex(tRowCache *e, char *col)
+{
+    int i;
+
+    if (col == NULL)
+        return -1;
+
+    for (i = 0; i < e->numFields; i++)
+        if (strcmp(e->names[i], col) == 0)
+            return i;
+
+    return -1;
+}
+
+int rowCacheGetType(MYSQL sql, char *path)
+{
+    tRowCache *e;
+    int ret;
+
+    ret = rowCacheAcquire(sql, path, &e);
+    if (ret == 1) {
+        if (getLevel(path) == 3)
+            ret = TYPE_DIR;
+        else
+            ret = (rowCacheFieldIndex(e, getPathComponent(path, 3)) >= 0) ? TYPE_FILE
+                                                                          : TYPE_NOENT;
+    }
+    else
+    if (ret == 0)
+        ret = TYPE_NOENT;
+    else
+        ret = TYPE_UNCACHED;
+    rowCacheRelease();
+
+    DPRINTF("%s: Type of '%s' is %d\n", __FUNCTION__, path, ret);
+    return ret;
+}
+
+/* Returns 1 if the row of the path is cached as existing, the server is
+   not asked */
+int rowCacheHasRow(const char *path)
+{
+    char *db, *tab, *pkVal, *key;
+    tRowCache *e;
+    int ret;
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+    pkVal = getPathComponent(path, 2);
+    if ((db == NULL) || (tab == NULL) || (pkVal == NULL))
+        return 0;
+
+    key = rowCacheKey(db, tab, pkVal);
+    pthread_mutex_lock(&rcMutex);
+    ret = (((e = rowCacheFind(key)) != NULL) && (rowCacheIsFresh(e))) ? 1 : 0;
+    pthread_mutex_unlock(&rcMutex);
+    free(key);
+
+    return ret;
+}
+
+int rowCacheStat(MYSQL sql, char *path, struct stat *stbuf)
+{
+    tRowCache *e;
+    int ret, idx;
+
+    ret = rowCacheAcquire(sql, path, &e);
+    if (ret == 1) {
+        stbuf->st_nlink = 1;
+        stbuf->st_mtime = stbuf->st_atime = stbuf->st_ctime = e->mtime;
+        if (getLevel(path) == 3) {
+            stbuf->st_mode = S_IFDIR | 0755;
+            stbuf->st_size = e->numFields;
+        }
+        else
+        if ((idx = rowCacheFieldIndex(e, getPathComponent(path, 3))) >= 0) {
+            stbuf->st_mode = S_IFREG | (e->isKey[idx] ? 0444 : 0666);
+            stbuf->st_size = (e->values[idx] != NULL) ? e->lengths[idx] + 1 : 0;
+        }
+        else
+            ret = 0;
+    }
+    rowCacheRelease();
+
+    return ret;
+}
+
+char *rowCacheRead(MYSQL sql, char *path, unsigned int *len)
+{
+    tRowCache *e;
+    char *val = NULL;
+    int idx;
+
+    if (rowCacheAcquire(sql, path, &e) == 1) {
+        idx = rowCacheFieldIndex(e, getPathComponent(path, 3));
+        if ((idx >= 0) && (e->values[idx] != NULL)) {
+            val = (char *)malloc( (e->lengths[idx] + 2) * sizeof(char) );
+            memcpy(val, e->values[idx], e->lengths[idx]);
+            val[e->lengths[idx]] = '\n';
+            val[e->lengths[idx] + 1] = 0;
+            if (len != NULL)
+                *len = e->lengths[idx] + 1;
+        }
+        else
+        if (idx >= 0) {
+            /* NULL value, consistent with mysql_read() */
+            val = strdup("\n");
+            if (len != NULL)
+                *len = 0;
+        }
+    }
+    rowCacheRelease();
+
+    return val;
+}
+
+int rowCacheFill(MYSQL sql, char *path, void *buf, fuse_fill_dir_t filler)
+{
+    tRowCache *e;
+    int ret, i;
+
+    ret = rowCacheAcquire(sql, path, &e);
+    if (ret == 1)
+        for (i = 0; i < e->numFields; i++)
+            filler(buf, e->names[i], NULL, 0);
+    rowCacheRelease();
+
+    return ret;
+}
+
+void rowCacheInvalidate(char *db, char *tab, char *pkVal)
+{
+    tRowCache *e, *next;
+
+    DPRINTF("%s: Invalidating %s/%s/%s\n", __FUNCTION__, db, tab, pkVal);
+
+    /* The rows without a modification time column take the table's */
+    catalogTouch(db, tab);
+
+    pthread_mutex_lock(&rcMutex);
+    rcGen++;
+    for (e = rcHead; e != NULL; e = next) {
+        next = e->next;
+        if ((db != NULL) && (strcmp(e->db, db) != 0))
+            continue;
+        if ((tab != NULL) && (strcmp(e->tab, tab) != 0))
+            continue;
+        if (pkVal != NULL) {
+            char *key = rowCacheKey(e->db, e->tab, pkVal);
+            int match = (strcmp(e->key, key) == 0);
+
+            free(key);
+            if (!match)
+                continue;
+        }
+
+        rowCacheUnlink(e);
+        rowCacheFree(e);
+    }
+    pthread_mutex_unlock(&rcMutex);
+
+    /* Listings and sizes of the table and its parents change as well */
+    pathCacheInvalidate(db, tab);
+    shmInvalidate(SHM_ATTR, db, tab);
+    mirrorInvalidate(db, tab, pkVal);
+}
+
+void rowCacheInvalidatePath(const char *path)
+{
+    int level;
+
+    level = getLevel(path);
+    if (level == 0)
+        rowCacheInvalidate(NULL, NULL, NULL);
+    else
+        rowCacheInvalidate(getPathComponent(path, 0),
+                           (level > 1) ? getPathComponent(path, 1) : NULL,
+                           (level > 2) ? getPathComponent(path, 2) : NULL);
+}
+
+#define PATHCACHE_BUCKETS       4096
+
+typedef struct tPathCache {
+    char *path;
+    /* getattr result, valid if hasStat is set */
+    int hasStat;
+    int ret;
+    struct stat st;
+    /* readdir result, valid if hasListing is set */
+    int hasListing;
+    int numNames;
+    char **names;
+    mode_t *modes;
+    struct tPathCache *hnext;
+} tPathCache;
+
+typedef struct tPathFill {
+    void *buf;
+    fuse_fill_dir_t filler;
+    int num;
+    int alloc;
+    char **names;
+    mode_t *modes;
+} tPathFill;
+
+static tPathCache *pcBuckets[PATHCACHE_BUCKETS] = { NULL };
+/* Bumped by every invalidation, results of queries started before are
+   not stored */
+static unsigned long pcGen = 0;
+static pthread_mutex_t pcMutex = PTHREAD_MUTEX_INITIALIZER;
+
+int pathCacheEnabled(void)
+{
+    return (snapshotEnabled() || binlogEnabled());
+}
+
+/* Expects pcMutex to be held */
+static tPathCache *pathCacheFind(const char *path, int create)
+{
+    tPathCache *p;
+    unsigned int h;
+
+    h = rowCacheHash(path) % PATHCACHE_BUCKETS;
+    for (p = pcBuckets[h]; p != NULL; p = p->hnext)
+        if (strcmp(p->path, path) == 0)
+            return p;
+
+    if (!create)
+        return NULL;
+
+    p = (tPathCache *)malloc( sizeof(tPathCache) );
+    memset(p, 0, sizeof(tPathCache));
+    p->path = strdup(path);
+    p->hnext = pcBuckets[h];
+    pcBuckets[h] = p;
+
+    return p;
+}
+
+static void pathCacheFreeListing(tPathCache *p)
+{
+    int i;
+
+    for (i = 0; i < p->numNames; i++)
+        free(p->names[i]);
+    free(p->names);
+    free(p->modes);
+    p->names = NULL;
+    p->modes = NULL;
+    p->numNames = 0;
+    p->hasListing = 0;
+}
+
+/* Returns 1 and the result of the getattr in ret if the path is cached */
+int pathCacheGetattr(const char *path, struct stat *stbuf, int *ret)
+{
+    tPathCache *p;
+    int hit = 0;
+
+    if ((!pathCacheEnabled()) && (!routeOffline()))
+        return 0;
+
+    pthread_mutex_lock(&pcMutex);
+    if (((p = pathCacheFind(path, 0)) != NULL) && (p->hasStat)) {
+        memcpy(stbuf, &p->st, sizeof(struct stat));
+        *ret = p->ret;
+        hit = 1;
+    }
+    pthread_mutex_unlock(&pcMutex);
+
+    DPRINTF("%s: Path %s %s\n", __FUNCTION__, path, hit ? "cached" : "not cached");
+    return hit;
+}
+
+/* Generation to be taken before querying the server for a result to
+   be stored */
+unsigned long pathCacheGeneration(void)
+{
+    unsigned long gen;
+
+    pthread_mutex_lock(&pcMutex);
+    gen = pcGen;
+    pthread_mutex_unlock(&pcMutex);
+
+    return gen;
+}
+
+/* Only the attributes and verified misses are kept, the other errors and
+   the results of failed (err is the error the queries reported) or killed
+   queries are transient. Results older than an invalidation (gen
+   differs) are dropped */
+void pathCacheSetattr(const char *path, struct stat *stbuf, int ret, int err, unsigned long gen)
+{
+    tPathCache *p;
+
+    if (!pathCacheEnabled())
+        return;
+    if (((ret != 0) && (ret != -ENOENT)) || (!queryVerified(err)))
+        return;
+
+    pthread_mutex_lock(&pcMutex);
+    if (gen != pcGen) {
+        pthread_mutex_unlock(&pcMutex);
+        return;
+    }
+    p = pathCacheFind(path, 1);
+    memcpy(&p->st, stbuf, sizeof(struct stat));
+    p->ret = ret;
+    p->hasStat = 1;
+    pthread_mutex_unlock(&pcMutex);
+}
+
+/* Pass the cached listing to the filler, returns 1 if the path is cached */
+int pathCacheReaddir(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+    struct stat st;
+    tPathCache *p;
+    int i, hit = 0;
+
+    if ((!pathCacheEnabled()) && (!routeOffline()))
+        return 0;
+
+    pthread_mutex_lock(&pcMutex);
+    if (((p = pathCacheFind(path, 0)) != NULL) && (p->hasListing)) {
+        memset(&st, 0, sizeof(st));
+        for (i = 0; i < p->numNames; i++) {
+            st.st_mode = p->modes[i];
+            filler(buf, p->names[i], p->modes[i] ? &st : NULL, 0);
+        }
+        hit = 1;
+    }
+    pthread_mutex_unlock(&pcMutex);
+
+    return hit;
+}
+
+static int pathCacheFiller(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+    tPathFill *fill = (tPathFill *)buf;
+
+    if (fill->num == fill->alloc) {
+        fill->alloc = (fill->alloc > 0) ? fill->alloc * 2 : 64;
+        fill->names = (char **)realloc(fill->names, fill->alloc * sizeof(char *));
+        fill->modes = (mode_t *)realloc(fill->modes, fill->alloc * sizeof(mode_t));
+    }
+    fill->names[fill->num] = strdup(name);
+    fill->modes[fill->num++] = (stbuf != NULL) ? stbuf->st_mode : 0;
+
+    return fill->filler(fill->buf, name, stbuf, off);
+}
+
+/* Run the readdir function passing its entries to the filler and keep
+   them if it succeeds */
+int pathCacheListing(const char *path, void *buf, fuse_fill_dir_t filler,
+                     int (*readdir)(const char *, void *, fuse_fill_dir_t))
+{
+    unsigned long gen;
+    tPathFill fill;
+    tPathCache *p;
+    int ret, i;
+
+    if (!pathCacheEnabled())
+        return readdir(path, buf, filler);
+
+    memset(&fill, 0, sizeof(fill));
+    fill.buf = buf;
+    fill.filler = filler;
+
+    gen = pathCacheGeneration();
+    ret = readdir(path, &fill, pathCacheFiller);
+    pthread_mutex_lock(&pcMutex);
+    /* The listing functions return an error when a query fails */
+    if ((ret != 0) || (!queryVerified(0)) || (gen != pcGen)) {
+        pthread_mutex_unlock(&pcMutex);
+        for (i = 0; i < fill.num; i++)
+            free(fill.names[i]);
+        free(fill.names);
+        free(fill.modes);
+        return ret;
+    }
+
+    p = pathCacheFind(path, 1);
+    pathCacheFreeListing(p);
+    p->names = fill.names;
+    p->modes = fill.modes;
+    p->numNames = fill.num;
+    p->hasListing = 1;
+    pthread_mutex_unlock(&pcMutex);
+
+    DPRINTF("%s: Remembered %d entries of %s\n", __FUNCTION__, fill.num, path);
+    return 0;
+}
+
+/* Drop the paths of the table (all tables of db if tab is NULL) along
+   with its parent directories, everything if db is NULL */
+void pathCacheInvalidate(char *db, char *tab)
+{
+    tPathCache *p, **pp;
+    char prefix[1024];
+    int i, len, dbLen;
+
+    if (!pathCacheEnabled())
+        return;
+    if (db == NULL) {
+        pathCacheClear();
+        return;
+    }
+
+    dbLen = len = snprintf(prefix, sizeof(prefix), "/%s", db);
+    if (tab != NULL)
+        len += snprintf(prefix + len, sizeof(prefix) - len, "/%s", tab);
+
+    pthread_mutex_lock(&pcMutex);
+    pcGen++;
+    for (i = 0; i < PATHCACHE_BUCKETS; i++) {
+        pp = &pcBuckets[i];
+        while ((p = *pp) != NULL) {
+            /* The prefix matches the paths below it (not /db2 for /db) and
+               the table dumps (/db/tab.csv), the parents are / and /db */
+            if (((strncmp(p->path, prefix, len) == 0)
+                 && ((p->path[len] == 0) || (p->path[len] == '/')
+                     || ((tab != NULL) && (p->path[len] == '.'))))
+                || (strcmp(p->path, "/") == 0)
+                || ((strncmp(p->path, prefix, dbLen) == 0) && (p->path[dbLen] == 0))) {
+                *pp = p->hnext;
+                pathCacheFreeListing(p);
+                free(p->path);
+                free(p);
+            }
+            else
+                pp = &p->hnext;
+        }
+    }
+    pthread_mutex_unlock(&pcMutex);
+
+    DPRINTF("%s: Dropped paths of %s\n", __FUNCTION__, prefix);
+}
+
+void pathCacheClear(void)
+{
+    tPathCache *p, *next;
+    int i;
+
+    pthread_mutex_lock(&pcMutex);
+    pcGen++;
+    for (i = 0; i < PATHCACHE_BUCKETS; i++) {
+        for (p = pcBuckets[i]; p != NULL; p = next) {
+            next = p->hnext;
+            pathCacheFreeListing(p);
+            free(p->path);
+            free(p);
+        }
+        pcBuckets[i] = NULL;
+    }
+    pthread_mutex_unlock(&pcMutex);
+}
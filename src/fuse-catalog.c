@@ -0,0 +1,786 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Catalog: the column list of a table (SHOW FIELDS) is fetched once and
+  kept for CATALOG_TTL seconds, so the primary key and modification time
+  column lookups done by nearly every operation don't cost a query each.
+  The leading columns of the table indexes (SHOW INDEX) are kept along
+  with the columns. Schema changes done through the filesystem invalidate
+  the table. With --shared-cache the fetched tables are also stored in the
+  shared memory segment for the other mounts of the host. With
+  --catalog-cache the tables are saved to a file of the directory when the
+  mount ends and loaded by the next mount. A loaded table is used once
+  its creation time (changed by the schema changes rebuilding it) matches
+  information_schema, all loaded tables of a database are checked by a
+  single query. The last modification time of the table is kept with it
+  for the rows having no time of their own.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_CATALOG
+
+#ifdef DEBUG_CATALOG
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "catalog: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CATALOG_TTL             30
+/* Header of the catalog file */
+#define CATALOG_MAGIC           0x43424446
+#define CATALOG_VERSION         1
+/* Largest table record of the catalog file */
+#define CATALOG_RECORD          65536
+
+/* Column indexes of the SHOW FIELDS result */
+#define FIELD_NAME              0
+#define FIELD_TYPE              1
+#define FIELD_KEY               3
+#define FIELD_EXTRA             5
+
+/* Column indexes of the SHOW INDEX result */
+#define INDEX_NAME              2
+#define INDEX_SEQ               3
+#define INDEX_COLUMN            4
+
+typedef struct tCatalog {
+    char *db;
+    char *tab;
+    int numCols;
+    char **cols;
+    char **types;
+    char **extras;
+    char *pk;
+    /* Primary key columns in the key order */
+    int numPk;
+    char **pkCols;
+    /* Columns usable for index seeks */
+    int numIdx;
+    char **idxCols;
+    time_t fetched;
+    /* CREATE_TIME of the table with --catalog-cache */
+    char *created;
+    /* Loaded from the catalog file and not checked yet */
+    int loaded;
+    /* Last modification time of the table and when it was queried */
+    time_t mtime;
+    time_t mtimeFetched;
+    struct tCatalog *next;
+} tCatalog;
+
+static tCatalog *catalog = NULL;
+static int catLoaded = 0;
+static pthread_mutex_t catMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void catalogFree(tCatalog *c)
+{
+    int i;
+
+    if (c->loaded)
+        catLoaded--;
+
+    for (i = 0; i < c->numCols; i++) {
+        free(c->cols[i]);
+        free(c->types[i]);
+        free(c->extras[i]);
+    }
+    free(c->cols);
+    free(c->types);
+    free(c->extras);
+    for (i = 0; i < c->numIdx; i++)
+        free(c->idxCols[i]);
+    free(c->idxCols);
+    for (i = 0; i < c->numPk; i++)
+        free(c->pkCols[i]);
+    free(c->pkCols);
+    free(c->pk);
+    free(c->created);
+    free(c->db);
+    free(c->tab);
+    free(c);
+}
+
+static tCatalog *catalogFetch(MYSQL sql, char *db, char *tab, int *error)
+{
+    char qry[1024] = { 0 };
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    tCatalog *c;
+    int i;
+
+    snprintf(qry, sizeof(qry), "SHOW FIELDS FROM `%s`.`%s`", db, tab);
+
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, strlen(qry)) != 0)
+        || ((res = mysql_store_result(&sql)) == NULL)) {
+        DPRINTF("%s: Error #%d = \"%s\"\n", __FUNCTION__,
+                mysql_errno(&sql), mysql_error(&sql));
+        if (error != NULL)
+            *error = mysql_errno(&sql);
+        return NULL;
+    }
+
+    c = (tCatalog *)malloc( sizeof(tCatalog) );
+    memset(c, 0, sizeof(tCatalog));
+    c->db = strdup(db);
+    c->tab = strdup(tab);
+    c->numCols = mysql_num_rows(res);
+    c->cols = (char **)malloc( c->numCols * sizeof(char *) );
+    c->types = (char **)malloc( c->numCols * sizeof(char *) );
+    c->extras = (char **)malloc( c->numCols * sizeof(char *) );
+    c->fetched = time(NULL);
+
+    for (i = 0; (i < c->numCols) && ((row = mysql_fetch_row(res)) != NULL); i++) {
+        c->cols[i] = strdup(row[FIELD_NAME]);
+        c->types[i] = strdup(row[FIELD_TYPE] ? row[FIELD_TYPE] : "");
+        c->extras[i] = strdup(row[FIELD_EXTRA] ? row[FIELD_EXTRA] : "");
+        if ((c->pk == NULL) && (row[FIELD_KEY] != NULL) && (strcmp(row[FIELD_KEY], "PRI") == 0))
+            c->pk = strdup(row[FIELD_NAME]);
+    }
+    c->numCols = i;
+    mysql_free_result(res);
+
+    /* Missing index information only disables the browse directories */
+    snprintf(qry, sizeof(qry), "SHOW INDEX FROM `%s`.`%s`", db, tab);
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, strlen(qry)) == 0)
+        && ((res = mysql_store_result(&sql)) != NULL)) {
+        while ((row = mysql_fetch_row(res)) != NULL) {
+            if ((row[INDEX_SEQ] == NULL) || (row[INDEX_COLUMN] == NULL))
+                continue;
+            /* The rows of an index are ordered by the sequence number */
+            if ((row[INDEX_NAME] != NULL) && (strcmp(row[INDEX_NAME], "PRIMARY") == 0)) {
+                c->pkCols = (char **)realloc(c->pkCols, (c->numPk + 1) * sizeof(char *));
+                c->pkCols[c->numPk++] = strdup(row[INDEX_COLUMN]);
+            }
+            if (atoi(row[INDEX_SEQ]) != 1)
+                continue;
+            for (i = 0; i < c->numIdx; i++)
+                if (strcmp(c->idxCols[i], row[INDEX_COLUMN]) == 0)
+                    break;
+            if (i < c->numIdx)
+                continue;
+            c->idxCols = (char **)realloc(c->idxCols, (c->numIdx + 1) * sizeof(char *));
+            c->idxCols[c->numIdx++] = strdup(row[INDEX_COLUMN]);
+        }
+        mysql_free_result(res);
+    }
+
+    /* Without the index information the key is the first PRI column */
+    if (c->numPk > 0) {
+        free(c->pk);
+        c->pk = strdup(c->pkCols[0]);
+    }
+    else
+    if (c->pk != NULL) {
+        c->pkCols = (char **)malloc( sizeof(char *) );
+        c->pkCols[c->numPk++] = strdup(c->pk);
+    }
+
+    /* The creation time validates the table saved to the catalog file */
+    if (mCatalogCache != NULL) {
+        snprintf(qry, sizeof(qry), "SELECT CREATE_TIME FROM information_schema.TABLES "
+                 "WHERE TABLE_SCHEMA = '%s' AND TABLE_NAME = '%s'", db, tab);
+        DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+        if ((mysql_real_query(&sql, qry, strlen(qry)) == 0)
+            && ((res = mysql_store_result(&sql)) != NULL)) {
+            if (((row = mysql_fetch_row(res)) != NULL) && (row[0] != NULL))
+                c->created = strdup(row[0]);
+            mysql_free_result(res);
+        }
+    }
+
+    return c;
+}
+
+static int catalogPackString(char *buf, int size, int len, const char *str)
+{
+    int n;
+
+    n = strlen(str ? str : "") + 1;
+    if ((len < 0) || (len + n > size))
+        return -1;
+    memcpy(buf + len, str ? str : "", n);
+
+    return len + n;
+}
+
+/* Serialize the table for the shared cache, returns the length or -1 if
+   it does not fit */
+static int catalogPack(tCatalog *c, char *buf, int size)
+{
+    int i, len;
+
+    len = 3 * sizeof(int);
+    if (len > size)
+        return -1;
+    memcpy(buf, &c->numCols, sizeof(int));
+    memcpy(buf + sizeof(int), &c->numPk, sizeof(int));
+    memcpy(buf + 2 * sizeof(int), &c->numIdx, sizeof(int));
+
+    len = catalogPackString(buf, size, len, c->pk);
+    for (i = 0; i < c->numCols; i++) {
+        len = catalogPackString(buf, size, len, c->cols[i]);
+        len = catalogPackString(buf, size, len, c->types[i]);
+        len = catalogPackString(buf, size, len, c->extras[i]);
+    }
+    for (i = 0; i < c->numPk; i++)
+        len = catalogPackString(buf, size, len, c->pkCols[i]);
+    for (i = 0; i < c->numIdx; i++)
+        len = catalogPackString(buf, size, len, c->idxCols[i]);
+    len = catalogPackString(buf, size, len, c->created);
+
+    return len;
+}
+
+static char *catalogUnpackString(char *buf, int len, int *pos)
+{
+    char *str;
+
+    if ((*pos >= len) || (memchr(buf + *pos, 0, len - *pos) == NULL))
+        return NULL;
+    str = strdup(buf + *pos);
+    *pos += strlen(str) + 1;
+
+    return str;
+}
+
+static tCatalog *catalogUnpack(char *buf, int len, char *db, char *tab)
+{
+    tCatalog *c;
+    int i, pos, bad;
+
+    if (len < (int)(3 * sizeof(int)))
+        return NULL;
+
+    c = (tCatalog *)malloc( sizeof(tCatalog) );
+    memset(c, 0, sizeof(tCatalog));
+    c->db = strdup(db);
+    c->tab = strdup(tab);
+    memcpy(&c->numCols, buf, sizeof(int));
+    memcpy(&c->numPk, buf + sizeof(int), sizeof(int));
+    memcpy(&c->numIdx, buf + 2 * sizeof(int), sizeof(int));
+    if ((c->numCols < 0) || (c->numPk < 0) || (c->numIdx < 0) || (c->numCols + c->numPk + c->numIdx > len)) {
+        c->numCols = c->numPk = c->numIdx = 0;
+        catalogFree(c);
+        return NULL;
+    }
+    c->cols = (char **)calloc(c->numCols + 1, sizeof(char *));
+    c->types = (char **)calloc(c->numCols + 1, sizeof(char *));
+    c->extras = (char **)calloc(c->numCols + 1, sizeof(char *));
+    c->pkCols = (char **)calloc(c->numPk + 1, sizeof(char *));
+    c->idxCols = (char **)calloc(c->numIdx + 1, sizeof(char *));
+
+    pos = 3 * sizeof(int);
+    bad = ((c->pk = catalogUnpackString(buf, len, &pos)) == NULL);
+    if ((!bad) && (*c->pk == 0)) {
+        free(c->pk);
+        c->pk = NULL;
+    }
+    for (i = 0; i < c->numCols; i++) {
+        c->cols[i] = catalogUnpackString(buf, len, &pos);
+        c->types[i] = catalogUnpackString(buf, len, &pos);
+        c->extras[i] = catalogUnpackString(buf, len, &pos);
+        bad |= (c->cols[i] == NULL) || (c->types[i] == NULL) || (c->extras[i] == NULL);
+    }
+    for (i = 0; i < c->numPk; i++)
+        bad |= ((c->pkCols[i] = catalogUnpackString(buf, len, &pos)) == NULL);
+    for (i = 0; i < c->numIdx; i++)
+        bad |= ((c->idxCols[i] = catalogUnpackString(buf, len, &pos)) == NULL);
+    if (((c->created = catalogUnpackString(buf, len, &pos)) != NULL) && (*c->created == 0)) {
+        free(c->created);
+        c->created = NULL;
+    }
+
+    if (bad) {
+        catalogFree(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+/* Take the table from the shared cache if another mount fetched it */
+static tCatalog *catalogShared(char *db, char *tab, tShmTag *tag)
+{
+    char buf[4096], key[1024];
+    time_t stored;
+    tCatalog *c;
+    int len;
+
+    snprintf(key, sizeof(key), "%s/%s", db, tab);
+    if ((len = shmGet(SHM_CATALOG, db, tab, key, buf, sizeof(buf), &stored, tag)) < 0)
+        return NULL;
+    if ((!routeOffline()) && (time(NULL) - stored >= CATALOG_TTL))
+        return NULL;
+    if ((c = catalogUnpack(buf, len, db, tab)) == NULL)
+        return NULL;
+    c->fetched = stored;
+
+    DPRINTF("%s: Table %s taken from the shared cache\n", __FUNCTION__, key);
+    return c;
+}
+
+static void catalogShare(tCatalog *c, tShmTag *tag)
+{
+    char buf[4096], key[1024];
+    int len;
+
+    if (!shmEnabled())
+        return;
+
+    snprintf(key, sizeof(key), "%s/%s", c->db, c->tab);
+    if ((len = catalogPack(c, buf, sizeof(buf))) >= 0)
+        shmPut(SHM_CATALOG, key, buf, len, tag);
+}
+
+/* Check the loaded tables of the database against their creation times,
+   the changed, dropped and views (having none) are dropped. Expects
+   catMutex to be held */
+static void catalogValidate(MYSQL sql, char *db)
+{
+    char qry[1024] = { 0 };
+    tCatalog *c, **pc;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    time_t now;
+
+    for (c = catalog; c != NULL; c = c->next)
+        if ((c->loaded) && (strcmp(c->db, db) == 0))
+            break;
+    if (c == NULL)
+        return;
+
+    snprintf(qry, sizeof(qry), "SELECT TABLE_NAME, CREATE_TIME FROM information_schema.TABLES "
+             "WHERE TABLE_SCHEMA = '%s'", db);
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, strlen(qry)) == 0)
+        && ((res = mysql_store_result(&sql)) != NULL)) {
+        now = time(NULL);
+        while ((row = mysql_fetch_row(res)) != NULL) {
+            if ((row[0] == NULL) || (row[1] == NULL))
+                continue;
+            for (c = catalog; c != NULL; c = c->next)
+                if ((c->loaded) && (strcmp(c->db, db) == 0) && (strcmp(c->tab, row[0]) == 0)
+                    && (c->created != NULL) && (strcmp(c->created, row[1]) == 0)) {
+                    c->loaded = 0;
+                    c->fetched = now;
+                    catLoaded--;
+                }
+        }
+        mysql_free_result(res);
+    }
+
+    pc = &catalog;
+    while ((c = *pc) != NULL) {
+        if ((c->loaded) && (strcmp(c->db, db) == 0)) {
+            DPRINTF("%s: Saved table %s.%s is outdated\n", __FUNCTION__, db, c->tab);
+            *pc = c->next;
+            catalogFree(c);
+        }
+        else
+            pc = &c->next;
+    }
+}
+
+/* Find or fetch the table, returns with catMutex held on success */
+static tCatalog *catalogAcquire(MYSQL sql, char *db, char *tab, int *error)
+{
+    tCatalog *c, **pc;
+    tShmTag tag;
+
+    if (error != NULL)
+        *error = 0;
+    if ((db == NULL) || (tab == NULL))
+        return NULL;
+
+    pthread_mutex_lock(&catMutex);
+    /* A server that is down leaves the saved tables as they are */
+    if ((catLoaded > 0) && (!routeOffline()))
+        catalogValidate(sql, db);
+
+    for (pc = &catalog; (c = *pc) != NULL; pc = &c->next) {
+        if ((strcmp(c->db, db) != 0) || (strcmp(c->tab, tab) != 0))
+            continue;
+        /* The schema of a snapshot mount is not revalidated, nor while
+           the server is down */
+        if ((snapshotEnabled()) || (routeOffline()) || (time(NULL) - c->fetched < CATALOG_TTL))
+            return c;
+        *pc = c->next;
+        catalogFree(c);
+        break;
+    }
+
+    if ((c = catalogShared(db, tab, &tag)) == NULL) {
+        if ((c = catalogFetch(sql, db, tab, error)) == NULL) {
+            pthread_mutex_unlock(&catMutex);
+            return NULL;
+        }
+        catalogShare(c, &tag);
+    }
+    c->next = catalog;
+    catalog = c;
+
+    return c;
+}
+
+static void catalogRelease(void)
+{
+    pthread_mutex_unlock(&catMutex);
+}
+
+char *catalogPrimaryKey(MYSQL sql, char *db, char *tab, int *error)
+{
+    tCatalog *c;
+    char *pk;
+
+    if ((c = catalogAcquire(sql, db, tab, error)) == NULL)
+        return NULL;
+    pk = (c->pk != NULL) ? strdup(c->pk) : NULL;
+    catalogRelease();
+
+    return pk;
+}
+
+/* Returns 1 if the table exists, 0 if it doesn't or -1 if it cannot be
+   told */
+int catalogExists(MYSQL sql, char *db, char *tab)
+{
+    int error = 0;
+
+    if (catalogAcquire(sql, db, tab, &error) != NULL) {
+        catalogRelease();
+        return 1;
+    }
+
+    /* Unknown table or database */
+    return ((error == 1146) || (error == 1049)) ? 0 : -1;
+}
+
+/* Returns the number of the primary key columns, their names and types
+   are to be freed by the caller */
+int catalogPrimaryKeys(MYSQL sql, char *db, char *tab, char ***cols, char ***types)
+{
+    tCatalog *c;
+    int i, j, num;
+
+    *cols = *types = NULL;
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return -1;
+
+    num = c->numPk;
+    *cols = (char **)malloc( (num + 1) * sizeof(char *) );
+    *types = (char **)malloc( (num + 1) * sizeof(char *) );
+    for (i = 0; i < num; i++) {
+        (*cols)[i] = strdup(c->pkCols[i]);
+        (*types)[i] = NULL;
+        for (j = 0; j < c->numCols; j++)
+            if (strcmp(c->cols[j], c->pkCols[i]) == 0)
+                (*types)[i] = strdup(c->types[j]);
+        if ((*types)[i] == NULL)
+            (*types)[i] = strdup("");
+    }
+    catalogRelease();
+
+    return num;
+}
+
+/* Explicitly configured column wins, otherwise use the first column
+   maintained by the server using ON UPDATE CURRENT_TIMESTAMP */
+char *catalogMtimeColumn(MYSQL sql, char *db, char *tab)
+{
+    tCatalog *c;
+    char *val = NULL;
+    int i;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return NULL;
+
+    for (i = 0; (i < c->numCols) && (val == NULL); i++) {
+        if (mMtimeColumn != NULL) {
+            if (strcmp(c->cols[i], mMtimeColumn) == 0)
+                val = strdup(c->cols[i]);
+        }
+        else
+        if (strcasestr(c->extras[i], "on update current_timestamp") != NULL)
+            val = strdup(c->cols[i]);
+    }
+    catalogRelease();
+
+    return val;
+}
+
+/* Returns the column type (e.g. "varchar(64)") or NULL if there is no
+   such column */
+char *catalogColumnType(MYSQL sql, char *db, char *tab, char *col)
+{
+    tCatalog *c;
+    char *type = NULL;
+    int i;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return NULL;
+
+    for (i = 0; i < c->numCols; i++)
+        if (strcmp(c->cols[i], col) == 0) {
+            type = strdup(c->types[i]);
+            break;
+        }
+    catalogRelease();
+
+    return type;
+}
+
+/* Returns the names of the columns whose type starts with type, the
+   array and the names are to be freed by the caller */
+char **catalogColumnsOfType(MYSQL sql, char *db, char *tab, char *type, int *num)
+{
+    char **cols = NULL;
+    tCatalog *c;
+    int i;
+
+    *num = 0;
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return NULL;
+
+    for (i = 0; i < c->numCols; i++)
+        if (strncasecmp(c->types[i], type, strlen(type)) == 0) {
+            cols = (char **)realloc(cols, (*num + 1) * sizeof(char *));
+            cols[(*num)++] = strdup(c->cols[i]);
+        }
+    catalogRelease();
+
+    return cols;
+}
+
+/* Returns 1 if the column is the first column of an index */
+int catalogIsIndexed(MYSQL sql, char *db, char *tab, char *col)
+{
+    tCatalog *c;
+    int i, ret = 0;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return 0;
+
+    for (i = 0; (i < c->numIdx) && (!ret); i++)
+        ret = (strcmp(c->idxCols[i], col) == 0);
+    catalogRelease();
+
+    return ret;
+}
+
+/* Pass the indexed columns of the table to the filler as directories */
+int catalogIndexes(MYSQL sql, char *db, char *tab, void *buf, fuse_fill_dir_t filler)
+{
+    struct stat st;
+    tCatalog *c;
+    int i;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return -ENOENT;
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0555;
+    for (i = 0; i < c->numIdx; i++)
+        filler(buf, c->idxCols[i], &st, 0);
+    catalogRelease();
+
+    return 0;
+}
+
+/* Drop the cached table, all tables of db if tab is NULL and everything
+   if db is NULL */
+/* Stores the last modification time of the table to mtime, it is queried
+   at most once per --row-cache-ttl seconds. Returns -1 if the query fails */
+int catalogTableMtime(MYSQL sql, char *db, char *tab, time_t *mtime)
+{
+    char path[1024];
+    tCatalog *c;
+    int err = 0;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) == NULL)
+        return -1;
+    if ((c->mtimeFetched > 0) && (time(NULL) - c->mtimeFetched <= mRowCacheTTL)) {
+        *mtime = c->mtime;
+        catalogRelease();
+        return 0;
+    }
+    catalogRelease();
+
+    /* The mutex is not held while talking to the server */
+    snprintf(path, sizeof(path), "/%s/%s", db, tab);
+    *mtime = getMtime(sql, path, &err);
+    if (err != 0)
+        return -1;
+
+    if ((c = catalogAcquire(sql, db, tab, NULL)) != NULL) {
+        c->mtime = *mtime;
+        c->mtimeFetched = time(NULL);
+        catalogRelease();
+    }
+
+    return 0;
+}
+
+/* The data of the table changed, its modification time is queried again */
+void catalogTouch(char *db, char *tab)
+{
+    tCatalog *c;
+
+    pthread_mutex_lock(&catMutex);
+    for (c = catalog; c != NULL; c = c->next)
+        if (((db == NULL) || (strcmp(c->db, db) == 0))
+            && ((tab == NULL) || (strcmp(c->tab, tab) == 0)))
+            c->mtimeFetched = 0;
+    pthread_mutex_unlock(&catMutex);
+}
+
+void catalogInvalidate(char *db, char *tab)
+{
+    tCatalog *c, **pc;
+
+    pthread_mutex_lock(&catMutex);
+    pc = &catalog;
+    while ((c = *pc) != NULL) {
+        if (((db == NULL) || (strcmp(c->db, db) == 0))
+            && ((tab == NULL) || (strcmp(c->tab, tab) == 0))) {
+            *pc = c->next;
+            catalogFree(c);
+        }
+        else
+            pc = &c->next;
+    }
+    pthread_mutex_unlock(&catMutex);
+
+    shmInvalidate(SHM_CATALOG, db, tab);
+}
+
+static void catalogFileName(char *name, size_t size)
+{
+    char *p;
+    int len;
+
+    len = snprintf(name, size, "%s/", mCatalogCache);
+    snprintf(name + len, size - len, "%s@%s.catalog", mUser, mServer);
+    for (p = name + len; *p; p++)
+        if (*p == '/')
+            *p = '_';
+}
+
+/* Load the tables saved by the previous mount of the user and servers */
+int catalogLoad(void)
+{
+    char name[1024], *buf, *rec, *db, *tab;
+    unsigned int hdr[2];
+    struct stat st;
+    tCatalog *c;
+    int fd, len, pos, off;
+
+    if (mCatalogCache == NULL)
+        return 0;
+
+    catalogFileName(name, sizeof(name));
+    if ((fd = open(name, O_RDONLY)) < 0)
+        return 0;
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(hdr))
+        || ((buf = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+
+    memcpy(hdr, buf, sizeof(hdr));
+    if ((hdr[0] != CATALOG_MAGIC) || (hdr[1] != CATALOG_VERSION)) {
+        fprintf(stderr, "Warning: Ignoring catalog file %s of another version\n", name);
+        munmap(buf, st.st_size);
+        return 0;
+    }
+
+    pthread_mutex_lock(&catMutex);
+    for (pos = sizeof(hdr); pos + (int)sizeof(int) <= st.st_size; pos += len) {
+        memcpy(&len, buf + pos, sizeof(int));
+        pos += sizeof(int);
+        if ((len <= 0) || (pos + len > st.st_size))
+            break;
+
+        rec = buf + pos;
+        off = 0;
+        if (((db = catalogUnpackString(rec, len, &off)) == NULL)
+            || ((tab = catalogUnpackString(rec, len, &off)) == NULL)) {
+            free(db);
+            break;
+        }
+        if ((c = catalogUnpack(rec + off, len - off, db, tab)) != NULL) {
+            c->loaded = 1;
+            c->fetched = 0;
+            c->next = catalog;
+            catalog = c;
+            catLoaded++;
+        }
+        free(db);
+        free(tab);
+    }
+    pthread_mutex_unlock(&catMutex);
+    munmap(buf, st.st_size);
+
+    DPRINTF("%s: Loaded %d tables from %s\n", __FUNCTION__, catLoaded, name);
+    return 0;
+}
+
+/* Save the tables having a creation time for the next mount */
+void catalogSave(void)
+{
+    char name[1024], tmp[1040], *buf;
+    unsigned int hdr[2] = { CATALOG_MAGIC, CATALOG_VERSION };
+    tCatalog *c;
+    FILE *fp;
+    int len, off, num = 0;
+
+    if (mCatalogCache == NULL)
+        return;
+
+    catalogFileName(name, sizeof(name));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+        fprintf(stderr, "Warning: Cannot save the catalog to %s\n", tmp);
+        return;
+    }
+
+    buf = (char *)malloc( CATALOG_RECORD );
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    pthread_mutex_lock(&catMutex);
+    for (c = catalog; c != NULL; c = c->next) {
+        if (c->created == NULL)
+            continue;
+        off = catalogPackString(buf, CATALOG_RECORD, 0, c->db);
+        off = catalogPackString(buf, CATALOG_RECORD, off, c->tab);
+        if ((off < 0) || ((len = catalogPack(c, buf + off, CATALOG_RECORD - off)) < 0))
+            continue;
+        len += off;
+        fwrite(&len, sizeof(int), 1, fp);
+        fwrite(buf, len, 1, fp);
+        num++;
+    }
+    pthread_mutex_unlock(&catMutex);
+    free(buf);
+
+    /* The previous file is replaced only by a complete one */
+    if ((fclose(fp) != 0) || (rename(tmp, name) != 0)) {
+        fprintf(stderr, "Warning: Cannot save the catalog to %s\n", name);
+        unlink(tmp);
+        return;
+    }
+
+    DPRINTF("%s: Saved %d tables to %s\n", __FUNCTION__, num, name);
+}
@@ -0,0 +1,246 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Compression: the values of the columns given by --compress (a whole
+  table or a single column) are stored compressed. A value written to
+  such a column is deflated at the fastest level and stored as the header
+  "FDBZ1:<length>:" followed by the base64 of the deflated data, so it
+  fits text columns as well and stays within the string handling of the
+  rest of the connector. Values which are short or don't shrink are
+  stored as they are. Reads inflate the values carrying the header and
+  return the other ones unchanged, values stored before the column got
+  compressed thus remain readable. The size of a compressed file is the
+  length from the header, the value doesn't have to be transferred.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_COMPRESS
+
+#ifdef DEBUG_COMPRESS
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "compress: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <zlib.h>
+
+#define COMPRESS_MAGIC          "FDBZ1:"
+#define COMPRESS_MAGIC_LEN      6
+/* Values shorter than this are not worth compressing */
+#define COMPRESS_MIN            128
+/* Deflate compresses at most about 1032:1, a larger length in the header
+   of a stored value means it is damaged or not ours */
+#define COMPRESS_MAX_RATIO      1032
+/* Largest logical value, the size of a LONGTEXT */
+#define COMPRESS_MAX_LENGTH     0xffffffffL
+
+typedef struct tCompress {
+    char *db;
+    char *tab;
+    /* NULL for all the columns of the table */
+    char *col;
+    struct tCompress *next;
+} tCompress;
+
+static tCompress *compressions = NULL;
+
+/* Parse a --compress "db.table[.column]" setting */
+int compressParse(char *arg)
+{
+    tCompress *c;
+    char *dot, *dot2;
+
+    if (((dot = strchr(arg, '.')) == NULL) || (dot == arg) || (dot[1] == 0) || (dot[1] == '.')) {
+        fprintf(stderr, "Error: Invalid compressed table %s\n", arg);
+        return -1;
+    }
+
+    c = (tCompress *)malloc( sizeof(tCompress) );
+    c->db = strndup(arg, dot - arg);
+    if (((dot2 = strchr(dot + 1, '.')) != NULL) && (dot2[1] != 0)) {
+        c->tab = strndup(dot + 1, dot2 - dot - 1);
+        c->col = strdup(dot2 + 1);
+    }
+    else {
+        c->tab = (dot2 != NULL) ? strndup(dot + 1, dot2 - dot - 1) : strdup(dot + 1);
+        c->col = NULL;
+    }
+    c->next = compressions;
+    compressions = c;
+
+    return 0;
+}
+
+void compressDump(void)
+{
+    tCompress *c;
+
+    for (c = compressions; c != NULL; c = c->next)
+        printf("\tCompress: %s.%s.%s\n", c->db, c->tab, c->col ? c->col : "*");
+}
+
+/* The settings as "db.tab.col;..." to tell the mounts apart, has to be
+   freed */
+char *compressList(void)
+{
+    unsigned long len = 1;
+    tCompress *c;
+    char *list;
+
+    for (c = compressions; c != NULL; c = c->next)
+        len += strlen(c->db) + strlen(c->tab) + (c->col ? strlen(c->col) : 1) + 3;
+
+    list = (char *)malloc( len * sizeof(char) );
+    list[0] = 0;
+    for (c = compressions; c != NULL; c = c->next)
+        snprintf(list + strlen(list), len - strlen(list), "%s.%s.%s;", c->db, c->tab,
+                 c->col ? c->col : "*");
+
+    return list;
+}
+
+/* Returns 1 if the values of the column are stored compressed */
+int compressColumn(const char *db, const char *tab, const char *col)
+{
+    tCompress *c;
+
+    if ((compressions == NULL) || (db == NULL) || (tab == NULL) || (col == NULL))
+        return 0;
+
+    for (c = compressions; c != NULL; c = c->next)
+        if ((strcmp(c->db, db) == 0) && (strcmp(c->tab, tab) == 0)
+            && ((c->col == NULL) || (strcmp(c->col, col) == 0)))
+            return 1;
+
+    return 0;
+}
+
+/* Returns 1 if the value of the /db/table/pk/column path is compressed */
+int compressPath(const char *path)
+{
+    if (compressions == NULL)
+        return 0;
+
+    return compressColumn(getPathComponent(path, 0), getPathComponent(path, 1),
+                          getPathComponent(path, 3));
+}
+
+/* Logical length of a stored value, -1 if the value is not compressed */
+long compressLength(const char *val, unsigned long len)
+{
+    unsigned long i;
+    long size = 0;
+
+    if ((val == NULL) || (len <= COMPRESS_MAGIC_LEN)
+        || (strncmp(val, COMPRESS_MAGIC, COMPRESS_MAGIC_LEN) != 0))
+        return -1;
+
+    /* The value doesn't have to be NUL terminated */
+    for (i = COMPRESS_MAGIC_LEN; (i < len) && (i < COMPRESS_MAGIC_LEN + 18) && (isdigit(val[i])); i++)
+        size = size * 10 + (val[i] - '0');
+    if ((i == COMPRESS_MAGIC_LEN) || (i >= len) || (val[i] != ':'))
+        return -1;
+
+    return size;
+}
+
+/* Value to store for the value of the given length, NULL to store it as
+   it is. The result is NUL terminated, has to be freed */
+char *compressEncode(const char *val, unsigned long len, unsigned long *outLen)
+{
+    unsigned char *data;
+    uLongf dataLen;
+    char *out;
+    int hdr, magic;
+
+    if (val == NULL)
+        return NULL;
+
+    /* A plain value looking compressed has to be wrapped */
+    magic = (compressLength(val, len) >= 0) ? 1 : 0;
+    if ((len < COMPRESS_MIN) && (!magic))
+        return NULL;
+
+    dataLen = compressBound(len);
+    if ((data = (unsigned char *)malloc( dataLen )) == NULL)
+        return NULL;
+    if (compress2(data, &dataLen, (const Bytef *)val, len, Z_BEST_SPEED) != Z_OK) {
+        DPRINTF("%s: Cannot compress %lu bytes\n", __FUNCTION__, len);
+        free(data);
+        return NULL;
+    }
+
+    hdr = COMPRESS_MAGIC_LEN + 24;
+    if ((!magic) && (hdr + base64_encoded_size(dataLen) >= len)) {
+        DPRINTF("%s: Value of %lu bytes doesn't shrink\n", __FUNCTION__, len);
+        free(data);
+        return NULL;
+    }
+
+    if ((out = (char *)malloc( hdr + base64_encoded_size(dataLen) + 1 )) == NULL) {
+        free(data);
+        return NULL;
+    }
+    hdr = sprintf(out, "%s%lu:", COMPRESS_MAGIC, len);
+    base64_encode_binary(out + hdr, data, dataLen);
+    free(data);
+
+    if (outLen != NULL)
+        *outLen = strlen(out);
+    DPRINTF("%s: Compressed %lu bytes to %lu\n", __FUNCTION__, len, (unsigned long)strlen(out));
+    return out;
+}
+
+/* Logical value of a stored value, NULL if it is not compressed or it is
+   damaged. The result is NUL terminated, has to be freed */
+char *compressDecode(const char *val, unsigned long len, unsigned long *outLen)
+{
+    unsigned char *data;
+    char *out, *payload;
+    uLongf size;
+    long logical;
+    int dataLen;
+
+    if ((logical = compressLength(val, len)) < 0)
+        return NULL;
+
+    payload = strchr(val + COMPRESS_MAGIC_LEN, ':') + 1;
+    if ((logical > COMPRESS_MAX_LENGTH)
+        || ((unsigned long)logical / COMPRESS_MAX_RATIO > base64_decoded_size(strlen(payload)) + 1)) {
+        DPRINTF("%s: Invalid length %ld for %lu bytes\n", __FUNCTION__, logical,
+                (unsigned long)strlen(payload));
+        return NULL;
+    }
+
+    if ((data = (unsigned char *)malloc( base64_decoded_size(strlen(payload)) + 3 )) == NULL)
+        return NULL;
+    if ((dataLen = base64_decode_binary(data, payload)) < 0) {
+        DPRINTF("%s: Invalid payload\n", __FUNCTION__);
+        free(data);
+        return NULL;
+    }
+
+    size = logical;
+    if ((out = (char *)malloc( logical + 1 )) == NULL) {
+        free(data);
+        return NULL;
+    }
+    if ((uncompress((Bytef *)out, &size, data, dataLen) != Z_OK) || (size != logical)) {
+        DPRINTF("%s: Cannot uncompress %d bytes to %ld\n", __FUNCTION__, dataLen, logical);
+        free(data);
+        free(out);
+        return NULL;
+    }
+    free(data);
+    out[logical] = 0;
+
+    if (outLen != NULL)
+        *outLen = logical;
+    return out;
+}
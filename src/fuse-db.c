@@ -22,9 +22,14 @@ do {} while(0)
 
 #include "fuse-db.h"
 
+/* Connect timeout of all the connections in seconds */
+#define CONNECT_TIMEOUT 5
+
 long flags = 0;
 
-/* Connection parameters */
+__thread MYSQL sql;
+
+/* Connection parameters, the server may be a comma separated list */
 char *mServer   = NULL;
 char *mUser     = NULL;
 char *mPass     = NULL;
@@ -32,6 +37,69 @@ char *mMntPoint = NULL;
 char *mLogFile  = NULL;
 char *mPwdType  = "plain";
 
+/* Optional column holding the row modification time */
+char *mMtimeColumn = NULL;
+
+/* Row cache budget in bytes (0 disables the cache) and entry lifetime */
+long mRowCacheSize = 16 * 1048576;
+int mRowCacheTTL   = 1;
+
+/* Number of rows fetched at once when rows are walked sequentially */
+int mReadahead = 32;
+
+/* Number of write-behind flusher threads, 0 writes synchronously */
+int mWriteBehind = 0;
+
+/* Dirty columns of a row are held up to the time (in ms) or column count
+   and written together using a single UPDATE */
+int mCoalesceTime    = 50;
+int mCoalesceColumns = 64;
+
+/* Level 3 mkdirs are inserted in batches of up to the given number of rows
+   (0 inserts them immediately) at most the time (in ms) after creation */
+int mBulkCreate     = 0;
+int mBulkCreateTime = 500;
+
+/* Rows per INSERT and INSERTs per transaction of the .import files */
+int mImportBatch  = 1000;
+int mImportCommit = 10;
+
+/* Server id used to follow the binlog for cache invalidation, 0 disables */
+int mBinlogServerId = 0;
+
+/* Extra connections running the queries submitted asynchronously */
+int mAsyncConns = 0;
+
+/* Replicas of the first server serving the reads, comma separated */
+char *mReplicas = NULL;
+
+/* Replicas lagging more seconds are not read from */
+int mReplicaMaxLag = 5;
+
+/* Operations running at once (0 disables the scheduler) and waiting */
+int mSchedSlots = 0;
+int mSchedQueue = 1024;
+
+/* Idle connections are pinged after the time in seconds, 0 disables */
+int mKeepalive = 30;
+
+/* Name and size of the shared memory segment holding the metadata shared
+   by the mounts of the host, NULL keeps it private */
+char *mSharedCache     = NULL;
+long mSharedCacheSize  = 16 * 1048576;
+
+/* Directory of the catalog file kept between the mounts, NULL for none */
+char *mCatalogCache = NULL;
+
+/* Directory of the local copies of the --mirror tables and their refresh
+   interval in seconds */
+char *mMirrorDir     = "/var/tmp";
+int mMirrorInterval  = 5;
+
+/* Databases routed to the given servers ("db=host") */
+char **mRoutes = NULL;
+int mNumRoutes = 0;
+
 unsigned char *unbase64(char *input) {
     size_t size = 0;
     unsigned char *val = NULL;
@@ -135,23 +203,33 @@ char *getPathComponent(const char *path, int idx) {
 
 static struct fuse_operations fmysql_oper = {
     /* Directories/files listing */
-    .getattr    = fmysql_getattr,
-    .readdir    = fmysql_readdir,
+    .getattr    = schedGetattr,
+    .readdir    = schedReaddir,
+    .readlink   = schedReadlink,
     /* Read functions */
-    .read       = fmysql_read,
-    .open       = fmysql_open,
+    .read       = schedRead,
+    .open       = schedOpen,
     /* Directory operations */
-    .mkdir      = fmysql_mkdir,
-    .rmdir      = fmysql_rmdir,
+    .mkdir      = schedMkdir,
+    .rmdir      = schedRmdir,
     /* Write operations */
-    .create     = fmysql_create,
-    .write      = fmysql_write,
+    .create     = schedCreate,
+    .write      = schedWrite,
+    .flush      = fmysql_flush,
+    .release    = fmysql_release,
+    .fsync      = fmysql_fsync,
+    .fsyncdir   = fmysql_fsyncdir,
     /* File operations */
-    .unlink     = fmysql_rm,
-    .truncate   = fmysql_truncate,
+    .unlink     = schedRm,
+    .truncate   = schedTruncate,
+    /* Initialization and cleanup */
+    .init       = fmysql_init,
+    .destroy    = fmysql_destroy,
 };
 
 void dumpArgs() {
+    int i;
+
     if (!flagIsSet(FLAG_DEBUG))
         return;
     printf("\nDump argument settings:\n");
@@ -167,18 +245,97 @@ void dumpArgs() {
     printf("\tMountpoint: %s\n", mMntPoint);
     printf("\tForce: %s\n", flagIsSet(FLAG_FORCE) ? "True" : "False");
     printf("\tUnmount: %s\n", flagIsSet(FLAG_UNMOUNT) ? "True" : "False");
+    printf("\tMtime column: %s\n", mMtimeColumn ? mMtimeColumn : "Auto-detect");
+    printf("\tRow cache: %ld bytes, TTL %d s\n", mRowCacheSize, mRowCacheTTL);
+    printf("\tReadahead: %d rows\n", mReadahead);
+    printf("\tHANDLER reads: %s\n", flagIsSet(FLAG_HANDLER) ? "True" : "False");
+    printf("\tSnapshot: %s\n", flagIsSet(FLAG_SNAPSHOT) ? "True" : "False");
+    printf("\tBinlog server id: %d\n", mBinlogServerId);
+    printf("\tAsynchronous query connections: %d\n", mAsyncConns);
+    for (i = 0; i < mNumRoutes; i++)
+        printf("\tRoute: %s\n", mRoutes[i]);
+    printf("\tReplicas: %s, max lag %d s\n", mReplicas ? mReplicas : "None", mReplicaMaxLag);
+    deadlineDump();
+    printf("\tKeepalive: %d s\n", mKeepalive);
+    schedDump();
+    printf("\tServe stale data: %s\n", flagIsSet(FLAG_STALE) ? "True" : "False");
+    shmDump();
+    printf("\tCatalog cache: %s\n", mCatalogCache ? mCatalogCache : "None");
+    mirrorDump();
+    compressDump();
+    printf("\tWrite-behind threads: %d\n", mWriteBehind);
+    printf("\tRow coalescing: %d ms, %d columns\n", mCoalesceTime, mCoalesceColumns);
+    printf("\tBulk create: %d rows, %d ms\n", mBulkCreate, mBulkCreateTime);
+    printf("\tImport: %d rows per batch, commit every %d batches\n", mImportBatch, mImportCommit);
     printf("\n");
 }
 
 void usage(char *name) {
     fprintf(stderr, "Syntax: %s --server <server> --user <user> --password <password> --password-type <type*1>\n"
                     "        --mountpoint <mountpoint> [--log-file <log-file>] [--debug] [--force-password-dump]\n"
-                    "        [--force] [--use-correct-codes] [--read-only] [--unmount]\n\n"
+                    "        [--force] [--use-correct-codes] [--read-only] [--unmount] [--mtime-column <column>]\n"
+                    "        [--row-cache-size <bytes>] [--row-cache-ttl <seconds>] [--readahead <rows>] [--handler]\n"
+                    "        [--write-behind <threads>] [--coalesce-time <ms>] [--coalesce-columns <count>]\n"
+                    "        [--bulk-create <rows>] [--bulk-create-time <ms>] [--import-batch <rows>]\n"
+                    "        [--import-commit <batches>] [--snapshot] [--binlog <server-id>]\n"
+                    "        [--async <connections>] [--route <database>=<server>]\n"
+                    "        [--replica <replicas>] [--replica-max-lag <seconds>]\n"
+                    "        [--deadline [<class>=]<ms>] [--keepalive <seconds>] [--serve-stale]\n"
+                    "        [--sched-slots <count>] [--sched-queue <count>] [--sched-cap <class>=<count>]\n"
+                    "        [--sched-weight <uid>=<weight>] [--shared-cache <name>]\n"
+                    "        [--shared-cache-size <bytes>] [--catalog-cache <directory>]\n"
+                    "        [--mirror <database>.<table>] [--mirror-dir <directory>] [--mirror-interval <seconds>]\n"
+                    "        [--compress <database>.<table>[.<column>]]\n\n"
                     "You can also use short version of the parameters by using the lowercase first letters except for\n"
                     "-t for password type and -g for debugging. Forcing the password dump will enforce dumping the\n"
                     "password in the debug output if enabled.\nFor the password-type you can use plain text type"
                     "which is the default or you can use 'b64' type\nthat specifies the password is in base64 encoded "
-                    "format.\n", name);
+                    "format.\nThe mtime-column option names the column used for row and column file modification\n"
+                    "times. When not set the first 'ON UPDATE CURRENT_TIMESTAMP' column of the table is used.\n"
+                    "Rows are cached as a whole for row-cache-ttl seconds (default 1) using up to row-cache-size\n"
+                    "bytes (default 16 MiB). Setting the row cache size to 0 disables the row cache.\n"
+                    "When rows are accessed in listing order the next readahead rows (default 32) are fetched\n"
+                    "into the row cache using one query, values lower than 2 disable the readahead.\n"
+                    "The handler option reads rows using HANDLER ... READ on the primary key index which skips\n"
+                    "the query optimizer. HANDLER reads don't use consistent reads.\n"
+                    "With write-behind set writes are queued and applied by the given number of flusher threads,\n"
+                    "flush and fsync wait for the queued writes of the file. Dirty columns of a row are held for\n"
+                    "coalesce-time ms (default 50) or until coalesce-columns (default 64) columns are dirty and\n"
+                    "written using a single UPDATE, fsync of the row directory writes them immediately.\n"
+                    "With bulk-create set new row directories are inserted in multi-row INSERT batches of up to\n"
+                    "the given number of rows, at latest bulk-create-time ms (default 500) after the mkdir.\n"
+                    "Data written to /db/table/.import is inserted using INSERTs of import-batch rows (default\n"
+                    "1000) committed every import-commit batches (default 10) and on close.\n"
+                    "The snapshot option mounts read-only with all connections reading from a consistent snapshot,\n"
+                    "cached data never expires. Sending SIGHUP to the process switches to a new snapshot.\n"
+                    "With binlog set the binary log is followed as a replica with the given (unique) server id\n"
+                    "and the changed tables are dropped from the caches.\n"
+                    "With async set the independent queries of an operation are run together on the given number\n"
+                    "of extra connections.\n"
+                    "The server may be a comma separated list of host[:port] servers, every database is used on\n"
+                    "the first server having it unless routed to a server using the route option.\n"
+                    "With replica set to a comma separated list of replicas of the first server its databases are\n"
+                    "read from the replicas lagging at most replica-max-lag seconds (default 5). Tables written\n"
+                    "recently are read from the primary until the replicas caught up.\n"
+                    "With deadline set the queries of operations running longer than the time (for the stat, list,\n"
+                    "read or write class or all of them) or interrupted are killed and the operation fails with\n"
+                    "ETIMEDOUT or EINTR. The option can be repeated, 0 only kills the interrupted queries.\n"
+                    "Servers are pinged every keepalive seconds (default 30), a server that is down fails the\n"
+                    "operations at once until it is back. With serve-stale the reads are answered from the caches\n"
+                    "while it is down.\n"
+                    "With sched-slots set at most the given number of operations run at once, the meta, read and\n"
+                    "write classes up to their sched-cap. Waiting operations are admitted fairly among the uids\n"
+                    "(weighted by sched-weight) and classes, more than sched-queue (default 1024) waiting ones or\n"
+                    "ones which would take the last FUSE worker threads fail with EBUSY.\n"
+                    "With shared-cache set the table catalogs and file attributes are kept in the shared memory\n"
+                    "segment /dev/shm/fuse-db-<name> of shared-cache-size bytes (default 16 MiB) used by all the\n"
+                    "mounts of the host with the same name, user and servers.\n"
+                    "With catalog-cache set the table catalogs are saved to the directory on unmount and loaded\n"
+                    "by the next mount, tables not changed since then are used without fetching them again.\n"
+                    "The rows of the mirror tables (the option can be repeated) are read from local copies in\n"
+                    "mirror-dir (default /var/tmp) refreshed every mirror-interval seconds (default 5).\n"
+                    "The values of the compress tables or columns (the option can be repeated) are stored\n"
+                    "compressed, values stored before remain readable.\n", name);
 
     dumpArgs();
     exit(EXIT_FAILURE);
@@ -200,6 +357,38 @@ long parseArgs(int argc, char * const argv[]) {
         {"unmount", 0, 0, 'n'},
         {"use-correct-codes", 0, 0, 'c'},
         {"read-only", 0, 0, 'r'},
+        {"mtime-column", 1, 0, 'M'},
+        {"row-cache-size", 1, 0, 'C'},
+        {"row-cache-ttl", 1, 0, 'L'},
+        {"readahead", 1, 0, 'A'},
+        {"handler", 0, 0, 'H'},
+        {"write-behind", 1, 0, 'W'},
+        {"coalesce-time", 1, 0, 'O'},
+        {"coalesce-columns", 1, 0, 'K'},
+        {"bulk-create", 1, 0, 'B'},
+        {"bulk-create-time", 1, 0, 'E'},
+        {"import-batch", 1, 0, 'I'},
+        {"import-commit", 1, 0, 'J'},
+        {"snapshot", 0, 0, 'S'},
+        {"binlog", 1, 0, 'Y'},
+        {"async", 1, 0, 'Q'},
+        {"route", 1, 0, 'R'},
+        {"replica", 1, 0, 'P'},
+        {"replica-max-lag", 1, 0, 'X'},
+        {"deadline", 1, 0, 'D'},
+        {"keepalive", 1, 0, 'k'},
+        {"serve-stale", 0, 0, 'V'},
+        {"sched-slots", 1, 0, 'G'},
+        {"sched-queue", 1, 0, 'U'},
+        {"sched-cap", 1, 0, 'T'},
+        {"sched-weight", 1, 0, 'w'},
+        {"shared-cache", 1, 0, 'Z'},
+        {"shared-cache-size", 1, 0, 'z'},
+        {"catalog-cache", 1, 0, 'F'},
+        {"mirror", 1, 0, 'N'},
+        {"mirror-dir", 1, 0, 'e'},
+        {"mirror-interval", 1, 0, 'i'},
+        {"compress", 1, 0, 'x'},
         {0, 0, 0, 0}
     };
 
@@ -249,6 +438,108 @@ long parseArgs(int argc, char * const argv[]) {
             case 'r':
                 retVal |= FLAG_READONLY;
                 break;
+            case 'M':
+                mMtimeColumn = strdup(optarg);
+                break;
+            case 'C':
+                mRowCacheSize = atol(optarg);
+                break;
+            case 'L':
+                mRowCacheTTL = atoi(optarg);
+                break;
+            case 'A':
+                mReadahead = atoi(optarg);
+                break;
+            case 'H':
+                retVal |= FLAG_HANDLER;
+                break;
+            case 'W':
+                mWriteBehind = atoi(optarg);
+                break;
+            case 'O':
+                mCoalesceTime = atoi(optarg);
+                break;
+            case 'K':
+                mCoalesceColumns = atoi(optarg);
+                break;
+            case 'B':
+                mBulkCreate = atoi(optarg);
+                break;
+            case 'E':
+                mBulkCreateTime = atoi(optarg);
+                break;
+            case 'I':
+                mImportBatch = atoi(optarg);
+                break;
+            case 'J':
+                mImportCommit = atoi(optarg);
+                break;
+            case 'S':
+                retVal |= FLAG_SNAPSHOT;
+                break;
+            case 'Y':
+                mBinlogServerId = atoi(optarg);
+                break;
+            case 'Q':
+                mAsyncConns = atoi(optarg);
+                break;
+            case 'R':
+                mRoutes = (char **)realloc(mRoutes, (mNumRoutes + 1) * sizeof(char *));
+                mRoutes[mNumRoutes++] = strdup(optarg);
+                break;
+            case 'P':
+                mReplicas = strdup(optarg);
+                break;
+            case 'X':
+                mReplicaMaxLag = atoi(optarg);
+                break;
+            case 'D':
+                if (deadlineParse(optarg) != 0)
+                    usage(argv[0]);
+                break;
+            case 'k':
+                mKeepalive = atoi(optarg);
+                break;
+            case 'V':
+                retVal |= FLAG_STALE;
+                break;
+            case 'G':
+                mSchedSlots = atoi(optarg);
+                break;
+            case 'U':
+                mSchedQueue = atoi(optarg);
+                break;
+            case 'T':
+                if (schedParseCap(optarg) != 0)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                if (schedParseWeight(optarg) != 0)
+                    usage(argv[0]);
+                break;
+            case 'Z':
+                mSharedCache = strdup(optarg);
+                break;
+            case 'z':
+                mSharedCacheSize = atol(optarg);
+                break;
+            case 'F':
+                mCatalogCache = strdup(optarg);
+                break;
+            case 'N':
+                if (mirrorParse(optarg) != 0)
+                    usage(argv[0]);
+                break;
+            case 'e':
+                mMirrorDir = strdup(optarg);
+                break;
+            case 'i':
+                mMirrorInterval = atoi(optarg);
+                break;
+            case 'x':
+                if (compressParse(optarg) != 0)
+                    usage(argv[0]);
+                break;
             default:
                 usage(argv[0]);
         }
@@ -257,6 +548,44 @@ long parseArgs(int argc, char * const argv[]) {
     return retVal;
 }
 
+int connectServer(MYSQL *conn, const char *host, unsigned int port)
+{
+    unsigned int timeout = CONNECT_TIMEOUT;
+
+    /* A server that is down is noticed quickly. The affected rows of an
+       UPDATE count the rows matched, so 0 means the row is gone rather
+       than the value unchanged */
+    mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (!mysql_real_connect(conn, host, mUser, mPass, NULL, port, NULL, CLIENT_FOUND_ROWS)) {
+        fprintf(stderr, "MySQL connection error: %s (%d)\n", mysql_error(conn),
+                mysql_errno(conn));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Open a new connection to the server of the database */
+MYSQL *openConnection(const char *db)
+{
+    MYSQL *conn;
+
+    if ((conn = mysql_init(NULL)) == NULL)
+        return NULL;
+
+    if (routeConnect(conn, routeServer(db)) != 0) {
+        mysql_close(conn);
+        return NULL;
+    }
+
+    if (snapshotBegin(conn) != 0) {
+        mysql_close(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
 int unmount(char *binaryPath, char *mountpoint, int suppressMessages)
 {
     char cmd[256], *tmp;
@@ -307,9 +636,22 @@ int main(int argc, char *argv[])
 
     flags = parseArgs(argc, argv);
 
+    /* Snapshots are read-only and HANDLER reads ignore them */
+    if (flagIsSet(FLAG_SNAPSHOT)) {
+        if (flagIsSet(FLAG_HANDLER))
+            fprintf(stderr, "Warning: HANDLER reads are disabled in snapshot mode\n");
+        flags = (flags | FLAG_READONLY) & ~FLAG_HANDLER;
+        /* Nothing changes under a snapshot, the extra connections would
+           not share it */
+        mBinlogServerId = 0;
+        mAsyncConns = 0;
+    }
+
     if (!mServer || !mUser || !mPass || !mMntPoint)
         usage(argv[0]);
 
+    schedInit();
+
     if (strcmp(mPwdType, "b64") == 0)
         mPass = strdup(unbase64(mPass));
 
@@ -333,27 +675,51 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (mysql_init(&sql) == NULL)
-        return EXIT_FAILURE;
+    if (routeParseServers(mServer) != 0)
+        usage(argv[0]);
 
-    if (!mysql_real_connect(&sql, mServer, mUser, mPass, NULL, 0, NULL, 0)) {
-        fprintf(stderr, "MySQL connection error: %s (%d)\n", mysql_error(&sql),
-                mysql_errno(&sql));
-        mysql_close(&sql);
-        return EXIT_FAILURE;
+    for (i = 0; i < mNumRoutes; i++)
+        if (routeAdd(mRoutes[i]) != 0)
+            return EXIT_FAILURE;
+
+    if ((mReplicas != NULL) && (routeParseReplicas(mReplicas) != 0))
+        usage(argv[0]);
+
+    /* The binlog of the primary may invalidate the caches before the
+       replicas the data was read from have the change */
+    if ((routeReplicas() > 0) && (mBinlogServerId > 0)) {
+        fprintf(stderr, "Warning: Binlog invalidation is disabled with replicas\n");
+        mBinlogServerId = 0;
+    }
+
+    /* The asynchronous queries have no database to route by */
+    if ((routeServers() > 1) && (mAsyncConns > 0)) {
+        fprintf(stderr, "Warning: Asynchronous queries are disabled with multiple servers\n");
+        mAsyncConns = 0;
     }
 
+    /* Checks the connection to the servers, the FUSE threads open their
+       own connections */
+    if ((routeDiscover() != 0) || (routeStart() != 0) || (deadlineInstall() != 0)
+        || (shmStart() != 0) || (catalogLoad() != 0))
+        return EXIT_FAILURE;
+
     /* Unset all the arguments for fuse_main */
     for (i = 1; i > argc; i++)
         free(argv[i]);
     argc = 2;
     /* Set only the mountpoint argument */
     argv[1] = mMntPoint;
+    /* A single thread keeps a single snapshot of every server */
+    if (flagIsSet(FLAG_SNAPSHOT))
+        argv[argc++] = "-s";
+    /* Interrupted requests are signalled to their threads */
+    if (deadlineEnabled())
+        argv[argc++] = "-ointr";
 
     printf("Process %s started successfully\n", argv[0]);
 
     rc = fuse_main(argc, argv, &fmysql_oper, NULL);
-    mysql_close(&sql);
 
     return rc;
 }
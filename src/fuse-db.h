@@ -1,6 +1,7 @@
 #ifndef FUSE_DB_H
 #define FUSE_DB_H
 
+#define _GNU_SOURCE
 #define FUSE_USE_VERSION 26
 #define EXT_LOG_SIZE     40960 /* 40 kiB */
 
@@ -13,6 +14,8 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <time.h>
+#include <ctype.h>
 #include <sys/mount.h>
 #include <mysql/mysql.h>
 
@@ -20,6 +23,9 @@
 #define TYPE_FILE       0
 #define TYPE_DIR        1
 #define TYPE_DIR_NOPK   2
+#define TYPE_UNCACHED   -2
+
+typedef struct tAsync tAsync;
 
 #define FLAG_READONLY           4
 #define FLAG_CORRECT_CODES      8
@@ -27,9 +33,58 @@
 #define FLAG_FORCE              32
 #define FLAG_DEBUGPWD           64
 #define FLAG_DEBUG              128
+#define FLAG_HANDLER            256
+#define FLAG_SNAPSHOT           512
+#define FLAG_STALE              1024
+
+/* Operation classes having their own deadline */
+#define DEADLINE_STAT           0
+#define DEADLINE_LIST           1
+#define DEADLINE_READ           2
+#define DEADLINE_WRITE          3
+#define DEADLINE_CLASSES        4
+
+/* Kinds of the shared cache entries */
+#define SHM_ATTR                0
+#define SHM_CATALOG             1
+#define SHM_KINDS               2
 
-MYSQL sql;
+/* Generations a shared cache entry is stored under */
+typedef struct tShmTag {
+    unsigned long long gens[3];
+} tShmTag;
+
+/* Connection of the calling thread to the server of the routed path */
+extern __thread MYSQL sql;
+extern char *mServer;
+extern char *mUser;
+extern char *mMtimeColumn;
+extern long mRowCacheSize;
+extern int mRowCacheTTL;
+extern int mReadahead;
+extern int mWriteBehind;
+extern int mCoalesceTime;
+extern int mCoalesceColumns;
+extern int mBulkCreate;
+extern int mBulkCreateTime;
+extern int mImportBatch;
+extern int mImportCommit;
+extern int mBinlogServerId;
+extern int mAsyncConns;
+extern int mReplicaMaxLag;
+extern int mKeepalive;
+extern int mSchedSlots;
+extern int mSchedQueue;
+extern char *mSharedCache;
+extern long mSharedCacheSize;
+extern char *mCatalogCache;
+extern char *mMirrorDir;
+extern int mMirrorInterval;
 unsigned char *base64_decode(const char *in, size_t *size);
+size_t base64_encoded_size(size_t len);
+size_t base64_decoded_size(size_t len);
+void base64_encode_binary(char *out, const unsigned char *in, size_t len);
+int base64_decode_binary(unsigned char *out, const char *in);
 
 /* Core functions */
 unsigned char *unbase64(char *input);
@@ -40,15 +95,22 @@ int getErrorCode(int err, int code, int retTrue, int retFalse);
 char *replace(char *input, char *what, char *with);
 char *escape(char *input);
 char *getPathComponent(const char *path, int idx);
+int connectServer(MYSQL *conn, const char *host, unsigned int port);
+MYSQL *openConnection(const char *db);
 
 /* MySQL functions */
 int getFieldNumber(MYSQL sql, char *qry, char *fieldName);
 char *getValue(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRows);
+char *getValueError(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRows,
+                    int *error);
 char *getPrimaryKeyName(MYSQL sql, char *table, int *error);
+int queryVerified(int err);
 int getSize(MYSQL sql, char *path, int *error);
 int getMySQLResults(MYSQL sql, char *qry, char *field, fuse_fill_dir_t filler, void *buf);
 int isReadOnly(MYSQL sql, const char *path, char *tab);
 int getType(char *path, int *error);
+char *getMtimeColumnName(MYSQL sql, char *table);
+time_t getMtime(MYSQL sql, char *path, int *error);
 int fmysql_getattr(const char *path, struct stat *stbuf);
 char *mysql_read(MYSQL sql, char *path, unsigned int *len);
 int fmysql_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
@@ -60,5 +122,225 @@ int fmysql_rm(const char *path);
 int fmysql_create(const char *path, mode_t mode, struct fuse_file_info *fi);
 int fmysql_truncate(const char *path, off_t size);
 int fmysql_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int fmysql_readlink(const char *path, char *buf, size_t size);
+int fmysql_release(const char *path, struct fuse_file_info *fi);
+int fmysql_flush(const char *path, struct fuse_file_info *fi);
+int fmysql_fsync(const char *path, int datasync, struct fuse_file_info *fi);
+int fmysql_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi);
+void *fmysql_init(struct fuse_conn_info *conn);
+void fmysql_destroy(void *data);
+
+/* Catalog functions */
+char *catalogPrimaryKey(MYSQL sql, char *db, char *tab, int *error);
+int catalogExists(MYSQL sql, char *db, char *tab);
+int catalogTableMtime(MYSQL sql, char *db, char *tab, time_t *mtime);
+void catalogTouch(char *db, char *tab);
+int catalogPrimaryKeys(MYSQL sql, char *db, char *tab, char ***cols, char ***types);
+char *catalogMtimeColumn(MYSQL sql, char *db, char *tab);
+char *catalogColumnType(MYSQL sql, char *db, char *tab, char *col);
+char **catalogColumnsOfType(MYSQL sql, char *db, char *tab, char *type, int *num);
+int catalogIsIndexed(MYSQL sql, char *db, char *tab, char *col);
+int catalogIndexes(MYSQL sql, char *db, char *tab, void *buf, fuse_fill_dir_t filler);
+void catalogInvalidate(char *db, char *tab);
+int catalogLoad(void);
+void catalogSave(void);
+
+/* Key codec functions */
+char *keyWhere(MYSQL sql, char *tab, const char *name);
+char *keyCompare(MYSQL sql, char *tab, const char *name, const char *op);
+char *keyValues(MYSQL sql, char *tab, const char *name);
+char *keyColumns(MYSQL sql, char *tab);
+int keyIsColumn(MYSQL sql, char *tab, char *col);
+char *keyRowName(MYSQL sql, char *tab, MYSQL_RES *res, MYSQL_ROW row);
+char *keyRowNameOf(char **cols, int num, MYSQL_RES *res, MYSQL_ROW row);
+char *keyValueName(char *val, unsigned long len);
+char *keyNameValue(const char *name, unsigned long *len);
+int keyListing(MYSQL sql, char *tab, char *where, mode_t mode, void *buf, fuse_fill_dir_t filler);
+
+/* Row cache functions */
+int rowCacheGetType(MYSQL sql, char *path);
+int rowCacheHasRow(const char *path);
+int rowCacheStat(MYSQL sql, char *path, struct stat *stbuf);
+char *rowCacheRead(MYSQL sql, char *path, unsigned int *len);
+int rowCacheFill(MYSQL sql, char *path, void *buf, fuse_fill_dir_t filler);
+void rowCacheInvalidate(char *db, char *tab, char *pkVal);
+void rowCacheInvalidatePath(const char *path);
+int readaheadListing(MYSQL sql, char *path, fuse_fill_dir_t filler, void *buf);
+int pathCacheEnabled(void);
+int pathCacheGetattr(const char *path, struct stat *stbuf, int *ret);
+unsigned long pathCacheGeneration(void);
+void pathCacheSetattr(const char *path, struct stat *stbuf, int ret, int err, unsigned long gen);
+int pathCacheReaddir(const char *path, void *buf, fuse_fill_dir_t filler);
+int pathCacheListing(const char *path, void *buf, fuse_fill_dir_t filler,
+                     int (*readdir)(const char *, void *, fuse_fill_dir_t));
+void pathCacheInvalidate(char *db, char *tab);
+void pathCacheClear(void);
+
+/* Snapshot mode functions */
+int snapshotEnabled(void);
+int snapshotBegin(MYSQL *conn);
+void snapshotStart(void);
+void snapshotCheck(void);
+unsigned int snapshotGeneration(void);
+
+/* Server routing functions */
+int routeParseServers(char *list);
+int routeParseReplicas(char *list);
+int routeServers(void);
+int routeReplicas(void);
+int routeTotal(void);
+int routeAdd(char *mapping);
+int routeConnect(MYSQL *conn, int server);
+int routeDiscover(void);
+int routeServer(const char *db);
+void routeCreated(const char *db);
+void routeDropped(const char *db);
+int routeListing(void *buf, fuse_fill_dir_t filler);
+MYSQL *routeConnection(MYSQL **conns, const char *db);
+void routeCloseConnections(MYSQL **conns);
+int routeStart(void);
+void routePin(const char *db, const char *tab);
+int routePath(const char *path, int write);
+int routeOffline(void);
+int routeEnd(int ret);
+int routeReplicaStart(void);
+void routeReplicaStop(void);
+
+/* Server health functions */
+int healthUp(int server);
+unsigned int healthEpoch(int server);
+void healthFailed(int server);
+void healthSuspect(int server);
+int healthStart(void);
+void healthStop(void);
+
+/* Scheduler functions */
+int schedParseCap(char *arg);
+int schedParseWeight(char *arg);
+void schedInit(void);
+void schedDump(void);
+int schedGetattr(const char *path, struct stat *stbuf);
+int schedReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
+int schedReadlink(const char *path, char *buf, size_t size);
+int schedRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int schedOpen(const char *path, struct fuse_file_info *fi);
+int schedMkdir(const char *path, mode_t mode);
+int schedRmdir(const char *path);
+int schedRm(const char *path);
+int schedCreate(const char *path, mode_t mode, struct fuse_file_info *fi);
+int schedTruncate(const char *path, off_t size);
+int schedWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+
+/* Shared cache functions */
+int shmEnabled(void);
+void shmDump(void);
+int shmStart(void);
+int shmGet(int kind, const char *db, const char *tab, const char *key, void *val, int size,
+           time_t *stored, tShmTag *tag);
+void shmPut(int kind, const char *key, const void *val, int len, tShmTag *tag);
+void shmInvalidate(int kind, const char *db, const char *tab);
+
+/* Mirror functions */
+int mirrorParse(char *arg);
+void mirrorDump(void);
+int mirrorStart(void);
+void mirrorStop(void);
+int mirrorRow(const char *db, const char *tab, const char *name, int *numFields, char ***names,
+              char **isKey, char ***values, unsigned long **lengths, time_t *mtime);
+int mirrorListing(const char *db, const char *tab, void *buf, fuse_fill_dir_t filler);
+int mirrorRows(const char *db, const char *tab);
+void mirrorInvalidate(const char *db, const char *tab, const char *name);
+
+/* Compression functions */
+int compressParse(char *arg);
+void compressDump(void);
+char *compressList(void);
+int compressColumn(const char *db, const char *tab, const char *col);
+int compressPath(const char *path);
+long compressLength(const char *val, unsigned long len);
+char *compressEncode(const char *val, unsigned long len, unsigned long *outLen);
+char *compressDecode(const char *val, unsigned long len, unsigned long *outLen);
+
+/* Deadline functions */
+int deadlineParse(char *arg);
+int deadlineEnabled(void);
+void deadlineDump(void);
+int deadlineInstall(void);
+void deadlineBegin(int cls);
+void deadlineConnection(int server, unsigned long connId);
+int deadlineEnd(int ret);
+int deadlineFired(void);
+int deadlineStart(void);
+void deadlineStop(void);
+
+
+/* Binlog invalidation functions */
+int binlogEnabled(void);
+int binlogStart(void);
+void binlogStop(void);
+
+/* Asynchronous query functions */
+int asyncEnabled(void);
+tAsync *asyncSubmit(const char *qry);
+MYSQL_RES *asyncWait(tAsync *a, int *err);
+int asyncStart(void);
+void asyncStop(void);
+
+/* Write-behind functions */
+int writebackEnabled(void);
+int writebackWrite(const char *path, const char *buf, size_t size, off_t offset);
+int writebackTruncate(const char *path, off_t size);
+char *writebackRead(const char *path, unsigned long *len);
+int writebackStat(const char *path, struct stat *stbuf);
+int writebackSync(const char *path);
+int writebackStart(void);
+void writebackStop(void);
+
+/* Bulk create functions */
+int bulkEnabled(void);
+int bulkCreate(const char *path);
+int bulkIsPending(const char *path);
+int bulkCheck(const char *path);
+int bulkError(const char *path);
+int bulkCancel(const char *path);
+void bulkSync(const char *path);
+int bulkStart(void);
+void bulkStop(void);
+
+/* Table export functions */
+int exportFormat(const char *path);
+int exportGetattr(const char *path, struct stat *stbuf);
+int exportOpen(const char *path, struct fuse_file_info *fi);
+int exportRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int exportRelease(const char *path, struct fuse_file_info *fi);
+
+/* Table import functions */
+int importIsPath(const char *path);
+int importGetattr(const char *path, struct stat *stbuf);
+int importOpen(const char *path, struct fuse_file_info *fi);
+int importWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int importFlush(const char *path, struct fuse_file_info *fi);
+int importRelease(const char *path, struct fuse_file_info *fi);
+
+/* Filter and browse directory functions */
+int filterIsPath(const char *path);
+int filterGetattr(const char *path, struct stat *stbuf);
+int filterReaddir(const char *path, void *buf, fuse_fill_dir_t filler);
+int filterReadlink(const char *path, char *buf, size_t size);
+
+/* JSON view functions */
+int jsonIsPath(const char *path);
+void jsonFill(const char *path, void *buf, fuse_fill_dir_t filler);
+int jsonGetattr(const char *path, struct stat *stbuf);
+int jsonReaddir(const char *path, void *buf, fuse_fill_dir_t filler);
+int jsonOpen(const char *path, struct fuse_file_info *fi);
+int jsonRead(const char *path, char *buf, size_t size, off_t offset,
+             struct fuse_file_info *fi);
+int jsonRelease(const char *path, struct fuse_file_info *fi);
+int jsonWrite(const char *path, const char *buf, size_t size, off_t offset);
+int jsonTruncate(const char *path, off_t size);
+int jsonCreate(const char *path);
+int jsonMkdir(const char *path);
+int jsonRemove(const char *path, int dir);
 
 #endif
@@ -0,0 +1,374 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Deadlines: with --deadline every operation of the stat, list, read and
+  write classes may run for at most the time given for its class. A
+  watchdog thread checks the running operations and sends KILL QUERY for
+  the connection of an operation past its deadline or interrupted by its
+  caller (FUSE sends the thread SIGUSR1 when the request is interrupted,
+  e.g. by Ctrl-C) using its own connection to the server. The operation
+  then returns -ETIMEDOUT or -EINTR and the connection is made usable for
+  the next operation.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_DEADLINE
+
+#ifdef DEBUG_DEADLINE
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "deadline: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+#include <sys/time.h>
+
+/* Watchdog check interval in ms */
+#define DEADLINE_TICK           20
+/* Read and write timeout of the watchdog connections in seconds */
+#define DEADLINE_CONN_TIMEOUT   2
+/* Server error of a killed query */
+#define ER_QUERY_INTERRUPTED    1317
+
+typedef struct tWatch {
+    int active;
+    /* Deadline in ms since the epoch, 0 for none */
+    unsigned long long deadline;
+    int server;
+    unsigned long connId;
+    volatile sig_atomic_t interrupted;
+    /* Error to return once the query has been killed */
+    int fired;
+    /* The kill is being sent */
+    int killing;
+    struct tWatch *prev;
+    struct tWatch *next;
+} tWatch;
+
+static const char *dlClasses[DEADLINE_CLASSES] = { "stat", "list", "read", "write" };
+static int dlLimits[DEADLINE_CLASSES] = { 0 };
+static int dlConfigured = 0;
+
+static tWatch *dlWatches = NULL;
+static __thread tWatch *dlWatch = NULL;
+static pthread_key_t dlKey;
+static pthread_mutex_t dlMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dlKilled = PTHREAD_COND_INITIALIZER;
+static pthread_t dlThread;
+static volatile int dlRunning = 0;
+
+static unsigned long long deadlineNow(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Parse a --deadline "class=ms" setting, a plain time sets all the
+   classes. 0 disables the deadline but keeps the interrupt handling */
+int deadlineParse(char *arg)
+{
+    char *val;
+    int i;
+
+    dlConfigured = 1;
+    if ((val = strchr(arg, '=')) == NULL) {
+        for (i = 0; i < DEADLINE_CLASSES; i++)
+            dlLimits[i] = atoi(arg);
+        return 0;
+    }
+
+    for (i = 0; i < DEADLINE_CLASSES; i++)
+        if ((strncmp(arg, dlClasses[i], val - arg) == 0) && (strlen(dlClasses[i]) == val - arg)) {
+            dlLimits[i] = atoi(val + 1);
+            return 0;
+        }
+
+    fprintf(stderr, "Error: Unknown deadline class in %s\n", arg);
+    return -1;
+}
+
+int deadlineEnabled(void)
+{
+    return dlConfigured;
+}
+
+void deadlineDump(void)
+{
+    int i;
+
+    for (i = 0; i < DEADLINE_CLASSES; i++)
+        printf("\tDeadline of %s: %d ms\n", dlClasses[i], dlLimits[i]);
+}
+
+static void deadlineSignal(int sig)
+{
+    (void) sig;
+
+    if ((dlWatch != NULL) && (dlWatch->active))
+        dlWatch->interrupted = 1;
+}
+
+static void deadlineThreadEnd(void *arg)
+{
+    tWatch *w = (tWatch *)arg;
+
+    pthread_mutex_lock(&dlMutex);
+    while (w->killing)
+        pthread_cond_wait(&dlKilled, &dlMutex);
+    if (w->prev != NULL)
+        w->prev->next = w->next;
+    else
+        dlWatches = w->next;
+    if (w->next != NULL)
+        w->next->prev = w->prev;
+    pthread_mutex_unlock(&dlMutex);
+    free(w);
+}
+
+/* Install the handler of the FUSE interrupt signal, has to be called
+   before fuse_main() which keeps an installed handler */
+int deadlineInstall(void)
+{
+    struct sigaction sa;
+
+    if (!dlConfigured)
+        return 0;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = deadlineSignal;
+    sigemptyset(&sa.sa_mask);
+    /* The client library sees no EINTR, the query is ended by the kill */
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    return pthread_key_create(&dlKey, deadlineThreadEnd);
+}
+
+/* Start watching the operation of the calling thread */
+void deadlineBegin(int cls)
+{
+    tWatch *w;
+
+    if (!dlRunning)
+        return;
+
+    if ((w = dlWatch) == NULL) {
+        w = (tWatch *)malloc( sizeof(tWatch) );
+        memset(w, 0, sizeof(tWatch));
+        pthread_mutex_lock(&dlMutex);
+        w->next = dlWatches;
+        if (dlWatches != NULL)
+            dlWatches->prev = w;
+        dlWatches = w;
+        pthread_mutex_unlock(&dlMutex);
+        pthread_setspecific(dlKey, w);
+        dlWatch = w;
+    }
+
+    pthread_mutex_lock(&dlMutex);
+    w->deadline = (dlLimits[cls] > 0) ? deadlineNow() + dlLimits[cls] : 0;
+    w->connId = 0;
+    w->fired = 0;
+    w->interrupted = 0;
+    w->active = 1;
+    pthread_mutex_unlock(&dlMutex);
+}
+
+/* The operation runs its queries on the connection */
+void deadlineConnection(int server, unsigned long connId)
+{
+    tWatch *w;
+
+    if ((w = dlWatch) == NULL)
+        return;
+
+    pthread_mutex_lock(&dlMutex);
+    w->server = server;
+    w->connId = connId;
+    pthread_mutex_unlock(&dlMutex);
+}
+
+/* Stop watching the operation, returns its result or the error if its
+   query has been killed */
+int deadlineEnd(int ret)
+{
+    tWatch *w;
+    int fired, i;
+
+    ret = routeEnd(ret);
+    if ((w = dlWatch) == NULL)
+        return ret;
+
+    /* No kill is sent once the watch is inactive */
+    pthread_mutex_lock(&dlMutex);
+    w->active = 0;
+    fired = w->fired;
+    /* The kill must not end a query of the next operation */
+    while (w->killing)
+        pthread_cond_wait(&dlKilled, &dlMutex);
+    pthread_mutex_unlock(&dlMutex);
+
+    if (fired == 0)
+        return ret;
+
+    /* The kill may have arrived after the query, it would end the next one */
+    for (i = 0; i < 2; i++)
+        if ((mysql_query(&sql, "DO 0") == 0) || (mysql_errno(&sql) != ER_QUERY_INTERRUPTED))
+            break;
+
+    DPRINTF("%s: Operation ended by the watchdog, returning %d instead of %d\n",
+            __FUNCTION__, fired, ret);
+    return fired;
+}
+
+/* Returns 1 if a query of the running operation has been killed */
+int deadlineFired(void)
+{
+    tWatch *w;
+    int fired;
+
+    if ((w = dlWatch) == NULL)
+        return 0;
+
+    pthread_mutex_lock(&dlMutex);
+    fired = (w->active) && (w->fired != 0);
+    pthread_mutex_unlock(&dlMutex);
+
+    return fired;
+}
+
+static void deadlineKill(MYSQL **conns, int server, unsigned long connId)
+{
+    unsigned int timeout = DEADLINE_CONN_TIMEOUT;
+    char qry[64];
+    int i;
+
+    snprintf(qry, sizeof(qry), "KILL QUERY %lu", connId);
+    for (i = 0; i < 2; i++) {
+        if (conns[server] == NULL) {
+            if ((conns[server] = mysql_init(NULL)) == NULL)
+                return;
+            mysql_options(conns[server], MYSQL_OPT_READ_TIMEOUT, &timeout);
+            mysql_options(conns[server], MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+            if (routeConnect(conns[server], server) != 0) {
+                mysql_close(conns[server]);
+                conns[server] = NULL;
+                return;
+            }
+        }
+
+        if (mysql_query(conns[server], qry) == 0)
+            return;
+
+        DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(conns[server]));
+        mysql_close(conns[server]);
+        conns[server] = NULL;
+    }
+}
+
+typedef struct tKillTarget {
+    tWatch *watch;
+    int server;
+    unsigned long connId;
+} tKillTarget;
+
+static void *deadlineWatchdog(void *arg)
+{
+    MYSQL **conns;
+    unsigned long long now;
+    tKillTarget *targets = NULL;
+    int i, num, alloc = 0;
+    tWatch *w;
+    (void) arg;
+
+    mysql_thread_init();
+    conns = (MYSQL **)calloc(routeTotal(), sizeof(MYSQL *));
+    while (dlRunning) {
+        now = deadlineNow();
+        num = 0;
+
+        /* The kills connect to the servers, they are sent without dlMutex
+           held so the operations don't wait for a slow server */
+        pthread_mutex_lock(&dlMutex);
+        for (w = dlWatches; w != NULL; w = w->next) {
+            if ((!w->active) || (w->fired) || (w->connId == 0))
+                continue;
+
+            if (w->interrupted)
+                w->fired = -EINTR;
+            else
+            if ((w->deadline > 0) && (now >= w->deadline))
+                w->fired = -ETIMEDOUT;
+            else
+                continue;
+
+            DPRINTF("%s: Killing query of connection %lu (%d)\n", __FUNCTION__, w->connId, w->fired);
+            if (num == alloc) {
+                alloc = (alloc > 0) ? alloc * 2 : 16;
+                targets = (tKillTarget *)realloc(targets, alloc * sizeof(tKillTarget));
+            }
+            w->killing = 1;
+            targets[num].watch = w;
+            targets[num].server = w->server;
+            targets[num++].connId = w->connId;
+        }
+        pthread_mutex_unlock(&dlMutex);
+
+        if (num == 0) {
+            usleep(DEADLINE_TICK * 1000);
+            continue;
+        }
+
+        for (i = 0; i < num; i++)
+            deadlineKill(conns, targets[i].server, targets[i].connId);
+
+        pthread_mutex_lock(&dlMutex);
+        for (i = 0; i < num; i++)
+            targets[i].watch->killing = 0;
+        pthread_cond_broadcast(&dlKilled);
+        pthread_mutex_unlock(&dlMutex);
+
+        usleep(DEADLINE_TICK * 1000);
+    }
+
+    for (i = 0; i < routeTotal(); i++)
+        if (conns[i] != NULL)
+            mysql_close(conns[i]);
+    free(conns);
+    free(targets);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int deadlineStart(void)
+{
+    if (!dlConfigured)
+        return 0;
+
+    dlRunning = 1;
+    if (pthread_create(&dlThread, NULL, deadlineWatchdog, NULL) != 0) {
+        fprintf(stderr, "Error: Cannot start the deadline watchdog thread\n");
+        dlRunning = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void deadlineStop(void)
+{
+    if (!dlRunning)
+        return;
+
+    dlRunning = 0;
+    pthread_join(dlThread, NULL);
+}
@@ -0,0 +1,428 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Table export: /db/table.csv and /db/table.jsonl are read-only virtual
+  files containing the whole table. Opening the file starts a single
+  SELECT * query on a dedicated connection read using mysql_use_result()
+  and rows are encoded on the fly into a bounded ring buffer drained by
+  sequential reads, so the memory use doesn't depend on the table size.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_EXPORT
+
+#ifdef DEBUG_EXPORT
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "export: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define EXPORT_CSV              1
+#define EXPORT_JSONL            2
+
+#define EXPORT_RING_SIZE        (1024 * 1024)
+
+typedef struct tExport {
+    /* FUSE may read the same open file from several threads */
+    pthread_mutex_t mutex;
+    MYSQL *conn;
+    MYSQL_RES *res;
+    MYSQL_FIELD *fields;
+    unsigned int numFields;
+    int format;
+    int eof;
+    /* Error ending the result set early, reported after the data read */
+    int err;
+    /* Ring buffer of encoded data, base is the file offset of ring[head] */
+    char *ring;
+    unsigned long head;
+    unsigned long count;
+    off_t base;
+    /* Encoded row not fitting into the ring buffer yet */
+    char *row;
+    unsigned long rowLen;
+    unsigned long rowPos;
+    unsigned long rowSize;
+} tExport;
+
+/* Returns the export format of the path, 0 for regular paths */
+int exportFormat(const char *path)
+{
+    char *name;
+    int len;
+
+    if (getLevel(path) != 2)
+        return 0;
+
+    name = getPathComponent(path, 1);
+    len = strlen(name);
+    if ((len > 4) && (strcmp(name + len - 4, ".csv") == 0))
+        return EXPORT_CSV;
+    if ((len > 6) && (strcmp(name + len - 6, ".jsonl") == 0))
+        return EXPORT_JSONL;
+
+    return 0;
+}
+
+static char *exportTable(const char *path)
+{
+    char *tab;
+
+    tab = strdup(getPathComponent(path, 1));
+    *strrchr(tab, '.') = 0;
+
+    return tab;
+}
+
+static void exportAppend(tExport *ex, const char *data, unsigned long len)
+{
+    if (ex->rowLen + len + 1 > ex->rowSize) {
+        ex->rowSize = (ex->rowLen + len + 1) * 2;
+        ex->row = (char *)realloc(ex->row, ex->rowSize * sizeof(char));
+    }
+    memcpy(ex->row + ex->rowLen, data, len);
+    ex->rowLen += len;
+}
+
+static void exportAppendCSV(tExport *ex, const char *val, unsigned long len)
+{
+    unsigned long i;
+    int quote = 0;
+
+    /* Empty strings are quoted to tell them from NULL values */
+    if (len == 0)
+        quote = 1;
+    for (i = 0; (i < len) && (!quote); i++)
+        if ((val[i] == ',') || (val[i] == '"') || (val[i] == '\n') || (val[i] == '\r'))
+            quote = 1;
+
+    if (!quote) {
+        exportAppend(ex, val, len);
+        return;
+    }
+
+    exportAppend(ex, "\"", 1);
+    for (i = 0; i < len; i++) {
+        if (val[i] == '"')
+            exportAppend(ex, "\"", 1);
+        exportAppend(ex, val + i, 1);
+    }
+    exportAppend(ex, "\"", 1);
+}
+
+static void exportAppendJSON(tExport *ex, const char *val, unsigned long len)
+{
+    unsigned long i;
+    char tmp[8];
+
+    exportAppend(ex, "\"", 1);
+    for (i = 0; i < len; i++) {
+        switch (val[i]) {
+            case '"':
+                exportAppend(ex, "\\\"", 2);
+                break;
+            case '\\':
+                exportAppend(ex, "\\\\", 2);
+                break;
+            case '\n':
+                exportAppend(ex, "\\n", 2);
+                break;
+            case '\r':
+                exportAppend(ex, "\\r", 2);
+                break;
+            case '\t':
+                exportAppend(ex, "\\t", 2);
+                break;
+            default:
+                if ((unsigned char)val[i] < 0x20) {
+                    snprintf(tmp, sizeof(tmp), "\\u%04x", (unsigned char)val[i]);
+                    exportAppend(ex, tmp, 6);
+                }
+                else
+                    exportAppend(ex, val + i, 1);
+        }
+    }
+    exportAppend(ex, "\"", 1);
+}
+
+static int exportIsNumeric(MYSQL_FIELD *field)
+{
+    switch (field->type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_DECIMAL:
+        case MYSQL_TYPE_NEWDECIMAL:
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Encode the next row (or the CSV header) into the row buffer. Returns 0
+   at the end of the result set and -1 if the fetch failed */
+static int exportEncodeRow(tExport *ex, int header)
+{
+    MYSQL_ROW row = NULL;
+    unsigned long *lengths = NULL;
+    unsigned int i;
+
+    ex->rowLen = ex->rowPos = 0;
+
+    if (!header) {
+        if ((row = mysql_fetch_row(ex->res)) == NULL) {
+            /* A lost connection ends the stream as well */
+            if (mysql_errno(ex->conn) != 0) {
+                fprintf(stderr, "Error: Export failed: %s\n", mysql_error(ex->conn));
+                return -1;
+            }
+            return 0;
+        }
+        lengths = mysql_fetch_lengths(ex->res);
+    }
+
+    if (ex->format == EXPORT_JSONL)
+        exportAppend(ex, "{", 1);
+
+    for (i = 0; i < ex->numFields; i++) {
+        if (ex->format == EXPORT_CSV) {
+            if (i > 0)
+                exportAppend(ex, ",", 1);
+            if (header)
+                exportAppendCSV(ex, ex->fields[i].name, strlen(ex->fields[i].name));
+            else
+            if (row[i] != NULL)
+                exportAppendCSV(ex, row[i], lengths[i]);
+        }
+        else {
+            if (i > 0)
+                exportAppend(ex, ",", 1);
+            exportAppendJSON(ex, ex->fields[i].name, strlen(ex->fields[i].name));
+            exportAppend(ex, ":", 1);
+            if (row[i] == NULL)
+                exportAppend(ex, "null", 4);
+            else
+            if (exportIsNumeric(&ex->fields[i]))
+                exportAppend(ex, row[i], lengths[i]);
+            else
+                exportAppendJSON(ex, row[i], lengths[i]);
+        }
+    }
+
+    if (ex->format == EXPORT_JSONL)
+        exportAppend(ex, "}", 1);
+    exportAppend(ex, "\n", 1);
+
+    return 1;
+}
+
+/* Move as much of the encoded row as possible into the ring buffer */
+static void exportPush(tExport *ex)
+{
+    unsigned long tail, len;
+
+    while ((ex->rowPos < ex->rowLen) && (ex->count < EXPORT_RING_SIZE)) {
+        /* Contiguous free space after the tail */
+        tail = (ex->head + ex->count) % EXPORT_RING_SIZE;
+        len = (tail < ex->head) ? ex->head - tail : EXPORT_RING_SIZE - tail;
+        if (len > ex->rowLen - ex->rowPos)
+            len = ex->rowLen - ex->rowPos;
+
+        memcpy(ex->ring + tail, ex->row + ex->rowPos, len);
+        ex->rowPos += len;
+        ex->count += len;
+    }
+}
+
+/* Fill the ring buffer with at least size bytes unless at the end */
+static void exportFill(tExport *ex, unsigned long size)
+{
+    int ret;
+
+    if (size > EXPORT_RING_SIZE)
+        size = EXPORT_RING_SIZE;
+
+    while (ex->count < size) {
+        if (ex->rowPos >= ex->rowLen) {
+            if ((ex->eof) || ((ret = exportEncodeRow(ex, 0)) <= 0)) {
+                if ((!ex->eof) && (ret < 0))
+                    ex->err = -EIO;
+                ex->eof = 1;
+                break;
+            }
+        }
+        exportPush(ex);
+    }
+}
+
+/* Take up to size bytes from the ring buffer, buf may be NULL to skip */
+static unsigned long exportPop(tExport *ex, char *buf, unsigned long size)
+{
+    unsigned long len, done = 0;
+
+    while ((done < size) && (ex->count > 0)) {
+        len = EXPORT_RING_SIZE - ex->head;
+        if (len > ex->count)
+            len = ex->count;
+        if (len > size - done)
+            len = size - done;
+
+        if (buf != NULL)
+            memcpy(buf + done, ex->ring + ex->head, len);
+        ex->head = (ex->head + len) % EXPORT_RING_SIZE;
+        ex->count -= len;
+        ex->base += len;
+        done += len;
+    }
+
+    return done;
+}
+
+int exportGetattr(const char *path, struct stat *stbuf)
+{
+    char tabPath[1024], *tab;
+    int exists;
+
+    tab = exportTable(path);
+    snprintf(tabPath, sizeof(tabPath), "/%s/%s", getPathComponent(path, 0), tab);
+    exists = catalogExists(sql, getPathComponent(path, 0), tab);
+    free(tab);
+    if (exists <= 0)
+        return (exists == 0) ? -ENOENT : -EIO;
+
+    /* The size is not known in advance, the file is read using direct I/O */
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = 0;
+    stbuf->st_mtime = getMtime(sql, tabPath, NULL);
+    stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime;
+
+    return 0;
+}
+
+int exportOpen(const char *path, struct fuse_file_info *fi)
+{
+    char qry[1024] = { 0 };
+    tExport *ex;
+    char *tab;
+
+    if ((fi->flags & O_WRONLY) || (fi->flags & O_RDWR))
+        return -EACCES;
+
+    ex = (tExport *)malloc( sizeof(tExport) );
+    memset(ex, 0, sizeof(tExport));
+    ex->format = exportFormat(path);
+
+    if ((ex->conn = openConnection(getPathComponent(path, 0))) == NULL) {
+        free(ex);
+        return -EIO;
+    }
+
+    tab = exportTable(path);
+    snprintf(qry, sizeof(qry), "SELECT * FROM `%s`", tab);
+    free(tab);
+
+    DPRINTF("%s: Streaming %s using \"%s\"\n", __FUNCTION__, path, qry);
+    if ((mysql_select_db(ex->conn, getPathComponent(path, 0)) != 0)
+        || (mysql_real_query(ex->conn, qry, strlen(qry)) != 0)
+        || ((ex->res = mysql_use_result(ex->conn)) == NULL)) {
+        DPRINTF("%s: Query failed: %s\n", __FUNCTION__, mysql_error(ex->conn));
+        mysql_close(ex->conn);
+        free(ex);
+        return -ENOENT;
+    }
+
+    ex->numFields = mysql_num_fields(ex->res);
+    ex->fields = mysql_fetch_fields(ex->res);
+    ex->ring = (char *)malloc( EXPORT_RING_SIZE * sizeof(char) );
+    pthread_mutex_init(&ex->mutex, NULL);
+
+    /* The CSV file starts with the column names */
+    if (ex->format == EXPORT_CSV)
+        exportEncodeRow(ex, 1);
+
+    fi->fh = (uint64_t)(unsigned long)ex;
+    fi->direct_io = 1;
+
+    return 0;
+}
+
+/* Expects the mutex of the export to be held. A failed stream returns the
+   data encoded before the failure and then the error, never a short file */
+static int exportReadLocked(tExport *ex, char *buf, size_t size, off_t offset)
+{
+    unsigned long done;
+
+    /* Already consumed data cannot be produced again */
+    if (offset < ex->base)
+        return -ESPIPE;
+
+    while (offset > ex->base) {
+        exportFill(ex, offset - ex->base);
+        if (exportPop(ex, NULL, offset - ex->base) == 0)
+            return ex->err;
+    }
+
+    exportFill(ex, size);
+    if ((done = exportPop(ex, buf, size)) == 0)
+        return ex->err;
+
+    return done;
+}
+
+int exportRead(const char *path, char *buf, size_t size, off_t offset,
+               struct fuse_file_info *fi)
+{
+    tExport *ex = (tExport *)(unsigned long)fi->fh;
+    int ret;
+
+    if (ex == NULL)
+        return -EBADF;
+
+    pthread_mutex_lock(&ex->mutex);
+    ret = exportReadLocked(ex, buf, size, offset);
+    pthread_mutex_unlock(&ex->mutex);
+
+    return ret;
+}
+
+int exportRelease(const char *path, struct fuse_file_info *fi)
+{
+    tExport *ex = (tExport *)(unsigned long)fi->fh;
+
+    if (ex == NULL)
+        return 0;
+
+    /* Freeing an unfinished result would read all the remaining rows, the
+       connection is closed first so the rest is never transferred. The
+       result is detached from the closed connection, mysql_free_result()
+       then frees only the result itself */
+    if (!ex->eof) {
+        DPRINTF("%s: Closing unfinished export of %s\n", __FUNCTION__, path);
+        mysql_close(ex->conn);
+        ex->conn = NULL;
+        ex->res->handle = NULL;
+    }
+    mysql_free_result(ex->res);
+    if (ex->conn != NULL)
+        mysql_close(ex->conn);
+    pthread_mutex_destroy(&ex->mutex);
+    free(ex->ring);
+    free(ex->row);
+    free(ex);
+    fi->fh = 0;
+
+    return 0;
+}
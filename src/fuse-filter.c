@@ -0,0 +1,389 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Filter directories: /db/table/.where/<predicate>/ lists the primary keys
+  of the rows matching the predicate as symbolic links to the row
+  directories. The predicate is translated into a WHERE clause so the
+  server does the filtering using its indexes. A predicate is one or more
+  "<column><op><value>" terms joined using '&' where op is one of =, !=,
+  <, <=, >, >= and ~ (LIKE). The columns are checked against the catalog
+  and the values are escaped, "col=NULL" and "col!=NULL" test for NULL.
+
+  Browse directories: /db/table/.by/ lists the indexed columns of the
+  table, /db/table/.by/<column>/ the distinct values of the column read
+  using the index (encoded like the key values) and
+  /db/table/.by/<column>/<value>/ links to the rows having the value, so
+  lookups by an indexed column are index seeks.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_FILTER
+
+#ifdef DEBUG_FILTER
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "filter: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+
+#define WHERE_NAME              ".where"
+#define BY_NAME                 ".by"
+
+static int filterType(const char *path, const char *type)
+{
+    char *name;
+
+    if (getLevel(path) < 3)
+        return 0;
+
+    name = getPathComponent(path, 2);
+    return ((name != NULL) && (strcmp(name, type) == 0)) ? 1 : 0;
+}
+
+int filterIsPath(const char *path)
+{
+    return (filterType(path, WHERE_NAME) || filterType(path, BY_NAME));
+}
+
+static void whereAppend(char **str, unsigned long *len, const char *data, unsigned long dlen)
+{
+    *str = (char *)realloc(*str, (*len + dlen + 1) * sizeof(char));
+    memcpy(*str + *len, data, dlen);
+    *len += dlen;
+    (*str)[*len] = 0;
+}
+
+/* Translate the predicate into a WHERE clause, returns NULL if the
+   predicate is not valid for the table */
+static char *whereClause(char *db, char *tab, char *pred)
+{
+    char *clause = NULL, *terms, *term, *save, *op, *val, *type, *tmp;
+    unsigned long len = 0;
+    const char *sqlOp;
+    int opLen;
+
+    terms = strdup(pred);
+    for (term = strtok_r(terms, "&", &save); term != NULL; term = strtok_r(NULL, "&", &save)) {
+        if ((op = strpbrk(term, "=!<>~")) == NULL)
+            goto invalid;
+
+        opLen = 1;
+        if (strncmp(op, "!=", 2) == 0)
+            sqlOp = "!=";
+        else
+        if (strncmp(op, "<=", 2) == 0)
+            sqlOp = "<=";
+        else
+        if (strncmp(op, ">=", 2) == 0)
+            sqlOp = ">=";
+        else
+        if (*op == '=')
+            sqlOp = "=";
+        else
+        if (*op == '<')
+            sqlOp = "<";
+        else
+        if (*op == '>')
+            sqlOp = ">";
+        else
+        if (*op == '~')
+            sqlOp = "LIKE";
+        else
+            goto invalid;
+        if (strlen(sqlOp) == 2)
+            opLen = 2;
+
+        val = op + opLen;
+        *op = 0;
+
+        /* Only existing columns, this also keeps the name safe to quote */
+        if ((type = catalogColumnType(sql, db, tab, term)) == NULL)
+            goto invalid;
+        free(type);
+
+        if (len > 0)
+            whereAppend(&clause, &len, " AND ", 5);
+        whereAppend(&clause, &len, "`", 1);
+        whereAppend(&clause, &len, term, strlen(term));
+        whereAppend(&clause, &len, "` ", 2);
+
+        if ((strcmp(val, "NULL") == 0) && ((strcmp(sqlOp, "=") == 0) || (strcmp(sqlOp, "!=") == 0))) {
+            if (strcmp(sqlOp, "=") == 0)
+                whereAppend(&clause, &len, "IS NULL", 7);
+            else
+                whereAppend(&clause, &len, "IS NOT NULL", 11);
+            continue;
+        }
+
+        tmp = (char *)malloc( (2 * strlen(val) + 1) * sizeof(char) );
+        mysql_real_escape_string(&sql, tmp, val, strlen(val));
+        whereAppend(&clause, &len, sqlOp, strlen(sqlOp));
+        whereAppend(&clause, &len, " '", 2);
+        whereAppend(&clause, &len, tmp, strlen(tmp));
+        whereAppend(&clause, &len, "'", 1);
+        free(tmp);
+    }
+    free(terms);
+
+    return clause;
+
+invalid:
+    DPRINTF("%s: Invalid predicate '%s'\n", __FUNCTION__, pred);
+    free(terms);
+    free(clause);
+    return NULL;
+}
+
+/* Returns the number of rows matching the clause or -1 on error. With
+   pkVal set only the row is checked, with filler set the encoded primary
+   keys are passed to the filler */
+static int filterQuery(const char *path, char *clause, char *pkVal, void *buf,
+                       fuse_fill_dir_t filler)
+{
+    char *tab, *where, *qry;
+    int size, num;
+
+    tab = getPathComponent(path, 1);
+    if (pkVal == NULL)
+        return keyListing(sql, tab, clause, S_IFLNK | 0777, buf, filler);
+
+    /* Names that are no valid key of the table match nothing */
+    if ((where = keyWhere(sql, tab, pkVal)) == NULL)
+        return 0;
+
+    size = strlen(clause) + strlen(where) + 16;
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "(%s) AND %s", clause, where);
+    num = keyListing(sql, tab, qry, S_IFLNK | 0777, buf, filler);
+
+    free(qry);
+    free(where);
+    return num;
+}
+
+/* Builds "`col` = 'value'" for the .by/<col>/<value> directory, the value
+   is encoded by keyValueName(). Returns NULL if the column is not indexed
+   or the name is not valid */
+static char *byClause(char *db, char *tab, char *col, char *name)
+{
+    char *clause, *val, *tmp;
+    unsigned long len;
+    int size;
+
+    if (!catalogIsIndexed(sql, db, tab, col))
+        return NULL;
+    if ((val = keyNameValue(name, &len)) == NULL)
+        return NULL;
+
+    tmp = (char *)malloc( (2 * len + 1) * sizeof(char) );
+    mysql_real_escape_string(&sql, tmp, val, len);
+    size = strlen(col) + strlen(tmp) + 8;
+    clause = (char *)malloc( size * sizeof(char) );
+    snprintf(clause, size, "`%s` = '%s'", col, tmp);
+    free(tmp);
+    free(val);
+
+    return clause;
+}
+
+/* List the distinct values of an indexed column, the server reads them
+   from the index only */
+static int byValues(char *db, char *tab, char *col, void *buf, fuse_fill_dir_t filler)
+{
+    unsigned long *lengths;
+    struct stat st;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    char *qry, *name;
+    int size, ret = 0;
+
+    size = 2 * strlen(col) + strlen(tab) + 48;
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "SELECT DISTINCT `%s` FROM `%s` ORDER BY `%s`", col, tab, col);
+
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, strlen(qry)) != 0)
+        || ((res = mysql_use_result(&sql)) == NULL)) {
+        free(qry);
+        return -EIO;
+    }
+    free(qry);
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0555;
+    /* NULL and empty values can't be file names, '/' and a leading '.'
+       are encoded the way the key values are */
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        lengths = mysql_fetch_lengths(res);
+        if ((row[0] == NULL) || ((name = keyValueName(row[0], lengths[0])) == NULL))
+            continue;
+        filler(buf, name, &st, 0);
+        free(name);
+    }
+    if (mysql_errno(&sql) != 0) {
+        DPRINTF("%s: Reading the values failed: %s\n", __FUNCTION__, mysql_error(&sql));
+        ret = -EIO;
+    }
+    mysql_free_result(res);
+
+    return ret;
+}
+
+/* Clause of the filter directory of the path, NULL if it is not valid */
+static char *filterClause(const char *path)
+{
+    char *db, *tab;
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+    if (mysql_select_db(&sql, db) != 0)
+        return NULL;
+
+    if (filterType(path, WHERE_NAME))
+        return whereClause(db, tab, getPathComponent(path, 3));
+
+    return byClause(db, tab, getPathComponent(path, 3), getPathComponent(path, 4));
+}
+
+/* Returns 0 if the filter directory of the path is valid, the clause is
+   only checked by the server, no rows are read */
+static int filterValid(const char *path)
+{
+    char *clause, *qry, *tab;
+    int size, ret = 0;
+    MYSQL_RES *res;
+
+    if ((clause = filterClause(path)) == NULL)
+        return -1;
+
+    tab = getPathComponent(path, 1);
+    size = strlen(clause) + strlen(tab) + 48;
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "SELECT 1 FROM `%s` WHERE (%s) LIMIT 0", tab, clause);
+
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if (mysql_real_query(&sql, qry, strlen(qry)) != 0)
+        ret = -1;
+    else
+    if ((res = mysql_store_result(&sql)) != NULL)
+        mysql_free_result(res);
+
+    free(qry);
+    free(clause);
+    return ret;
+}
+
+/* Returns the number of the rows the path matches or -1 if the path is
+   not valid, with filler set the primary keys are listed */
+static int filterMatch(const char *path, int link, void *buf, fuse_fill_dir_t filler)
+{
+    char *clause;
+    int num, idx;
+
+    /* Index of the last component of the directory listing the links */
+    idx = filterType(path, WHERE_NAME) ? 3 : 4;
+    if ((clause = filterClause(path)) == NULL)
+        return -1;
+
+    num = filterQuery(path, clause, link ? getPathComponent(path, idx + 1) : NULL, buf, filler);
+    free(clause);
+
+    return num;
+}
+
+int filterGetattr(const char *path, struct stat *stbuf)
+{
+    int level, linkLevel;
+    char *db, *tab;
+
+    level = getLevel(path);
+    /* Level of the row links */
+    linkLevel = filterType(path, WHERE_NAME) ? 5 : 6;
+
+    if (level > linkLevel)
+        return -ENOENT;
+    if (level == linkLevel) {
+        if (filterMatch(path, 1, NULL, NULL) <= 0)
+            return -ENOENT;
+    }
+    else
+    if (level == linkLevel - 1) {
+        if (filterValid(path) != 0)
+            return -ENOENT;
+    }
+    else
+    if (level == 4) {
+        /* .by/<column> */
+        db = getPathComponent(path, 0);
+        tab = getPathComponent(path, 1);
+        if ((mysql_select_db(&sql, db) != 0)
+            || (!catalogIsIndexed(sql, db, tab, getPathComponent(path, 3))))
+            return -ENOENT;
+    }
+
+    if (level == linkLevel) {
+        stbuf->st_mode = S_IFLNK | 0777;
+        stbuf->st_size = strlen(getPathComponent(path, level - 1)) + 3 * (linkLevel - 3);
+    }
+    else {
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_size = 0;
+    }
+    stbuf->st_nlink = 1;
+    stbuf->st_mtime = stbuf->st_atime = stbuf->st_ctime = time(NULL);
+
+    return 0;
+}
+
+int filterReaddir(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+    int level, linkLevel;
+    char *db, *tab;
+
+    level = getLevel(path);
+    linkLevel = filterType(path, WHERE_NAME) ? 5 : 6;
+    if (level >= linkLevel)
+        return -ENOTDIR;
+
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+
+    db = getPathComponent(path, 0);
+    tab = getPathComponent(path, 1);
+
+    /* Predicates can't be listed, only looked up */
+    if ((level == 3) && (filterType(path, WHERE_NAME)))
+        return 0;
+
+    if (mysql_select_db(&sql, db) != 0)
+        return -ENOENT;
+    if (level == 3)
+        return catalogIndexes(sql, db, tab, buf, filler);
+    if ((level == 4) && (filterType(path, BY_NAME))) {
+        if (!catalogIsIndexed(sql, db, tab, getPathComponent(path, 3)))
+            return -ENOENT;
+        return byValues(db, tab, getPathComponent(path, 3), buf, filler);
+    }
+
+    return (filterMatch(path, 0, buf, filler) < 0) ? -ENOENT : 0;
+}
+
+/* The row links point to the row directory of the table */
+int filterReadlink(const char *path, char *buf, size_t size)
+{
+    int level;
+
+    level = getLevel(path);
+    if (level != (filterType(path, WHERE_NAME) ? 5 : 6))
+        return -EINVAL;
+
+    snprintf(buf, size, "%s%s", (level == 5) ? "../../" : "../../../",
+             getPathComponent(path, level - 1));
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Server health: a background thread pings every server (and replica)
+  each --keepalive seconds using its own connection. A server failing the
+  ping or a connection attempt is marked down, the operations routed to
+  it fail with EIO at once instead of waiting for the network (the
+  circuit is open) and only the health thread tries to reconnect, after 1,
+  2, 4, ... up to HEALTH_BACKOFF_MAX seconds. Once it is back (or found
+  restarted) its epoch is increased so the FUSE threads replace their
+  connections opened before. The thread connections idle for longer than
+  --keepalive are pinged before they are used.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_HEALTH
+
+#ifdef DEBUG_HEALTH
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "health: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define HEALTH_BACKOFF_MIN      1
+#define HEALTH_BACKOFF_MAX      32
+/* Read and write timeout of the health connections in seconds */
+#define HEALTH_TIMEOUT          2
+
+typedef struct tHealth {
+    volatile int up;
+    volatile unsigned int epoch;
+    int backoff;
+    /* Time of the next ping or reconnect attempt */
+    time_t next;
+    MYSQL *conn;
+} tHealth;
+
+static tHealth *hlServers = NULL;
+static int hlNum = 0;
+static pthread_mutex_t hlMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hlCond = PTHREAD_COND_INITIALIZER;
+static pthread_t hlThread;
+static volatile int hlRunning = 0;
+
+/* Returns 0 while the server is known to be down */
+int healthUp(int server)
+{
+    return ((hlServers == NULL) || (hlServers[server].up)) ? 1 : 0;
+}
+
+/* Connections opened in an older epoch of the server are not usable */
+unsigned int healthEpoch(int server)
+{
+    return (hlServers == NULL) ? 0 : hlServers[server].epoch;
+}
+
+/* Expects hlMutex to be held */
+static void healthDown(int server)
+{
+    tHealth *h = &hlServers[server];
+
+    if (!h->up)
+        return;
+
+    fprintf(stderr, "Warning: Server #%d is down, retrying in %d s\n", server, HEALTH_BACKOFF_MIN);
+    h->up = 0;
+    h->backoff = HEALTH_BACKOFF_MIN;
+    h->next = time(NULL) + h->backoff;
+}
+
+/* A connection to the server could not be opened */
+void healthFailed(int server)
+{
+    if (hlServers == NULL)
+        return;
+
+    pthread_mutex_lock(&hlMutex);
+    healthDown(server);
+    pthread_mutex_unlock(&hlMutex);
+}
+
+/* A connection lost the server, ping it now */
+void healthSuspect(int server)
+{
+    if (hlServers == NULL)
+        return;
+
+    pthread_mutex_lock(&hlMutex);
+    if (hlServers[server].up) {
+        hlServers[server].next = 0;
+        pthread_cond_signal(&hlCond);
+    }
+    pthread_mutex_unlock(&hlMutex);
+}
+
+static MYSQL *healthConnect(int server)
+{
+    unsigned int timeout = HEALTH_TIMEOUT;
+    MYSQL *conn;
+
+    if ((conn = mysql_init(NULL)) == NULL)
+        return NULL;
+
+    mysql_options(conn, MYSQL_OPT_READ_TIMEOUT, &timeout);
+    mysql_options(conn, MYSQL_OPT_WRITE_TIMEOUT, &timeout);
+    if (routeConnect(conn, server) != 0) {
+        mysql_close(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+/* Ping the server, reconnecting the health connection if needed. Returns
+   0 if the server answers, 1 if it answers on a new connection (it may
+   have restarted), -1 if it is down */
+static int healthCheck(tHealth *h, int server)
+{
+    int lost = 0;
+
+    if ((h->conn != NULL) && (mysql_ping(h->conn) == 0))
+        return 0;
+
+    if (h->conn != NULL) {
+        mysql_close(h->conn);
+        lost = 1;
+    }
+
+    if ((h->conn = healthConnect(server)) == NULL)
+        return -1;
+
+    return lost;
+}
+
+static void *healthThread(void *arg)
+{
+    struct timespec ts;
+    tHealth *h;
+    time_t now;
+    int i, ret;
+    (void) arg;
+
+    mysql_thread_init();
+    pthread_mutex_lock(&hlMutex);
+    while (hlRunning) {
+        now = time(NULL);
+        for (i = 0; i < hlNum; i++) {
+            h = &hlServers[i];
+            if (now < h->next)
+                continue;
+
+            /* The network is not waited for holding the lock */
+            pthread_mutex_unlock(&hlMutex);
+            ret = healthCheck(h, i);
+            pthread_mutex_lock(&hlMutex);
+            now = time(NULL);
+
+            if ((ret < 0) && (h->up))
+                healthDown(i);
+            else
+            if (ret < 0) {
+                h->backoff = (h->backoff * 2 > HEALTH_BACKOFF_MAX) ? HEALTH_BACKOFF_MAX : h->backoff * 2;
+                h->next = now + h->backoff;
+                DPRINTF("%s: Server #%d still down, retrying in %d s\n", __FUNCTION__, i, h->backoff);
+            }
+            else {
+                if ((!h->up) || (ret > 0)) {
+                    /* The connections of the threads are from before */
+                    h->epoch++;
+                    if (!h->up)
+                        fprintf(stderr, "Server #%d is back\n", i);
+                }
+                h->up = 1;
+                h->next = now + ((mKeepalive > 0) ? mKeepalive : HEALTH_BACKOFF_MAX);
+            }
+        }
+
+        ts.tv_sec = time(NULL) + 1;
+        ts.tv_nsec = 0;
+        pthread_cond_timedwait(&hlCond, &hlMutex, &ts);
+    }
+    pthread_mutex_unlock(&hlMutex);
+
+    for (i = 0; i < hlNum; i++)
+        if (hlServers[i].conn != NULL)
+            mysql_close(hlServers[i].conn);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int healthStart(void)
+{
+    tHealth *servers;
+    int i;
+
+    servers = (tHealth *)calloc(routeTotal(), sizeof(tHealth));
+    for (i = 0; i < routeTotal(); i++)
+        servers[i].up = 1;
+    hlNum = routeTotal();
+    hlServers = servers;
+
+    hlRunning = 1;
+    if (pthread_create(&hlThread, NULL, healthThread, NULL) != 0) {
+        fprintf(stderr, "Error: Cannot start the health thread\n");
+        hlRunning = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void healthStop(void)
+{
+    if (!hlRunning)
+        return;
+
+    pthread_mutex_lock(&hlMutex);
+    hlRunning = 0;
+    pthread_cond_signal(&hlCond);
+    pthread_mutex_unlock(&hlMutex);
+    pthread_join(hlThread, NULL);
+}
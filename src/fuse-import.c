@@ -0,0 +1,642 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Table import: CSV (with a header line naming the columns) or JSONL data
+  written to the /db/table/.import virtual file is parsed while written
+  and inserted into the table using multi-row INSERT queries of up to
+  mImportBatch rows on a dedicated connection. The transaction is
+  committed every mImportCommit batches and when the file is closed.
+  Writes block while the batch is being inserted which throttles the
+  writer to the server speed. Failures are reported by the next write
+  and by close(), the transactions committed before stay in the table.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_IMPORT
+
+#ifdef DEBUG_IMPORT
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "import: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+
+#define IMPORT_NAME             ".import"
+
+#define IMPORT_UNKNOWN          0
+#define IMPORT_CSV              1
+#define IMPORT_JSONL            2
+
+/* Batches are sent earlier when the query grows over this size */
+#define IMPORT_QUERY_SIZE       (4 * 1024 * 1024)
+
+typedef struct tImport {
+    MYSQL *conn;
+    char *db;
+    char *tab;
+    int format;
+    int err;
+    off_t pos;
+    /* Data of the incomplete record */
+    char *data;
+    unsigned long len;
+    unsigned long size;
+    /* Columns of the current batch */
+    int numCols;
+    char **cols;
+    /* Values of the record being parsed, NULL for SQL NULL */
+    int numVals;
+    char **vals;
+    unsigned long *valLens;
+    /* Query of the current batch */
+    char *qry;
+    unsigned long qryLen;
+    unsigned long qrySize;
+    int rows;
+    int batches;
+} tImport;
+
+int importIsPath(const char *path)
+{
+    char *name;
+
+    if (getLevel(path) != 3)
+        return 0;
+
+    name = getPathComponent(path, 2);
+    return ((name != NULL) && (strcmp(name, IMPORT_NAME) == 0)) ? 1 : 0;
+}
+
+static void importQueryAppend(tImport *im, const char *str, unsigned long len)
+{
+    if (im->qryLen + len + 1 > im->qrySize) {
+        im->qrySize = (im->qryLen + len + 1) * 2;
+        im->qry = (char *)realloc(im->qry, im->qrySize * sizeof(char));
+    }
+    memcpy(im->qry + im->qryLen, str, len);
+    im->qryLen += len;
+    im->qry[im->qryLen] = 0;
+}
+
+/* Append the column name quoted, the names come from the imported data */
+static void importQueryAppendName(tImport *im, const char *name)
+{
+    const char *p;
+
+    importQueryAppend(im, "`", 1);
+    for (p = name; *p != 0; p++) {
+        /* Embedded backticks are doubled */
+        if (*p == '`')
+            importQueryAppend(im, "`", 1);
+        importQueryAppend(im, p, 1);
+    }
+    importQueryAppend(im, "`", 1);
+}
+
+static void importClearValues(tImport *im)
+{
+    int i;
+
+    for (i = 0; i < im->numVals; i++)
+        free(im->vals[i]);
+    im->numVals = 0;
+}
+
+static void importClearColumns(tImport *im)
+{
+    int i;
+
+    for (i = 0; i < im->numCols; i++)
+        free(im->cols[i]);
+    free(im->cols);
+    im->cols = NULL;
+    im->numCols = 0;
+}
+
+static void importAddValue(tImport *im, const char *val, unsigned long len, int isNull)
+{
+    im->vals = (char **)realloc(im->vals, (im->numVals + 1) * sizeof(char *));
+    im->valLens = (unsigned long *)realloc(im->valLens, (im->numVals + 1) * sizeof(unsigned long));
+
+    if (isNull)
+        im->vals[im->numVals] = NULL;
+    else {
+        im->vals[im->numVals] = (char *)malloc( (len + 1) * sizeof(char) );
+        memcpy(im->vals[im->numVals], val, len);
+        im->vals[im->numVals][len] = 0;
+    }
+    im->valLens[im->numVals] = len;
+    im->numVals++;
+}
+
+/* Send the pending batch and commit every mImportCommit batches or if
+   commit is set */
+static int importBatch(tImport *im, int commit)
+{
+    if ((im->err == 0) && (im->rows > 0)) {
+        DPRINTF("%s: Inserting %d rows into %s/%s\n", __FUNCTION__, im->rows, im->db, im->tab);
+        if (mysql_real_query(im->conn, im->qry, im->qryLen) != 0) {
+            fprintf(stderr, "Error: Import into %s/%s failed: %s\n", im->db, im->tab,
+                    mysql_error(im->conn));
+            im->err = -EIO;
+        }
+        im->batches++;
+    }
+    im->rows = 0;
+    im->qryLen = 0;
+
+    if ((im->err == 0) && ((commit) || (im->batches >= mImportCommit)) && (im->batches > 0)) {
+        if (mysql_commit(im->conn) != 0)
+            im->err = -EIO;
+        im->batches = 0;
+        rowCacheInvalidate(im->db, im->tab, NULL);
+        routePin(im->db, im->tab);
+    }
+
+    return im->err;
+}
+
+/* Add the parsed values as a row, names are the JSONL keys (NULL for CSV
+   where the columns come from the header) */
+static void importAddRow(tImport *im, char **names)
+{
+    unsigned long len;
+    char *tmp;
+    int i, same;
+
+    if (im->err != 0)
+        return;
+
+    /* The column list of a batch is fixed, JSONL objects may differ */
+    if (names != NULL) {
+        same = (im->numCols == im->numVals);
+        for (i = 0; (i < im->numCols) && (same); i++)
+            same = (strcmp(im->cols[i], names[i]) == 0);
+
+        if (!same) {
+            importBatch(im, 0);
+            importClearColumns(im);
+            im->cols = (char **)malloc( im->numVals * sizeof(char *) );
+            for (i = 0; i < im->numVals; i++)
+                im->cols[i] = strdup(names[i]);
+            im->numCols = im->numVals;
+        }
+    }
+
+    if (im->numVals != im->numCols) {
+        fprintf(stderr, "Error: Import into %s/%s: record has %d values for %d columns\n",
+                im->db, im->tab, im->numVals, im->numCols);
+        im->err = -EINVAL;
+        return;
+    }
+
+    if (im->rows == 0) {
+        importQueryAppend(im, "INSERT INTO `", 13);
+        importQueryAppend(im, im->tab, strlen(im->tab));
+        importQueryAppend(im, "`(", 2);
+        for (i = 0; i < im->numCols; i++) {
+            if (i > 0)
+                importQueryAppend(im, ",", 1);
+            importQueryAppendName(im, im->cols[i]);
+        }
+        importQueryAppend(im, ") VALUES ", 9);
+    }
+    else
+        importQueryAppend(im, ",", 1);
+
+    importQueryAppend(im, "(", 1);
+    for (i = 0; i < im->numVals; i++) {
+        if (i > 0)
+            importQueryAppend(im, ",", 1);
+        if (im->vals[i] == NULL) {
+            importQueryAppend(im, "NULL", 4);
+            continue;
+        }
+        tmp = (char *)malloc( (2 * im->valLens[i] + 1) * sizeof(char) );
+        len = mysql_real_escape_string(im->conn, tmp, im->vals[i], im->valLens[i]);
+        importQueryAppend(im, "'", 1);
+        importQueryAppend(im, tmp, len);
+        importQueryAppend(im, "'", 1);
+        free(tmp);
+    }
+    importQueryAppend(im, ")", 1);
+    im->rows++;
+
+    if ((im->rows >= mImportBatch) || (im->qryLen >= IMPORT_QUERY_SIZE))
+        importBatch(im, 0);
+}
+
+/* Parse one CSV record starting at data. Returns the length of the record
+   including the line end or 0 if the record is not complete yet, the final
+   record with an unterminated quote fails the import */
+static unsigned long importParseCSV(tImport *im, char *data, unsigned long len, int final)
+{
+    unsigned long i = 0, vlen, unquoted;
+    char *val;
+    int quoted;
+
+    importClearValues(im);
+    val = (char *)malloc( (len + 1) * sizeof(char) );
+
+    while (1) {
+        vlen = 0;
+        quoted = 0;
+
+        if ((i < len) && (data[i] == '"')) {
+            quoted = 1;
+            i++;
+            while (1) {
+                if ((i >= len) && (final)) {
+                    fprintf(stderr, "Error: Import into %s/%s: unterminated quote\n",
+                            im->db, im->tab);
+                    im->err = -EINVAL;
+                    goto incomplete;
+                }
+                if (i >= len)
+                    goto incomplete;
+                if (data[i] == '"') {
+                    if ((i + 1 < len) && (data[i + 1] == '"')) {
+                        val[vlen++] = '"';
+                        i += 2;
+                        continue;
+                    }
+                    if ((i + 1 >= len) && (!final))
+                        goto incomplete;
+                    i++;
+                    break;
+                }
+                val[vlen++] = data[i++];
+            }
+        }
+
+        unquoted = vlen;
+        while ((i < len) && (data[i] != ',') && (data[i] != '\n'))
+            val[vlen++] = data[i++];
+
+        if ((i >= len) && (!final))
+            goto incomplete;
+
+        /* Strip CR of CRLF line ends, unquoted empty values are NULL */
+        if ((vlen > unquoted) && (val[vlen - 1] == '\r') && ((i >= len) || (data[i] == '\n')))
+            vlen--;
+        importAddValue(im, val, vlen, ((!quoted) && (vlen == 0)));
+
+        if ((i >= len) || (data[i] == '\n')) {
+            free(val);
+            return (i < len) ? i + 1 : i;
+        }
+        i++;
+    }
+
+incomplete:
+    free(val);
+    importClearValues(im);
+    return 0;
+}
+
+/* Parse a JSON string starting at data[*i] (the opening quote) */
+static int importParseJSONString(char *data, unsigned long len, unsigned long *i,
+                                 char *out, unsigned long *olen)
+{
+    unsigned int cp, lo;
+
+    *olen = 0;
+    (*i)++;
+    while (*i < len) {
+        if (data[*i] == '"') {
+            (*i)++;
+            return 0;
+        }
+        if ((data[*i] == '\\') && (*i + 1 < len)) {
+            (*i)++;
+            switch (data[*i]) {
+                case 'n': out[(*olen)++] = '\n'; break;
+                case 'r': out[(*olen)++] = '\r'; break;
+                case 't': out[(*olen)++] = '\t'; break;
+                case 'b': out[(*olen)++] = '\b'; break;
+                case 'f': out[(*olen)++] = '\f'; break;
+                case 'u':
+                    if ((*i + 4 >= len) || (sscanf(data + *i + 1, "%4x", &cp) != 1))
+                        return -1;
+                    *i += 4;
+                    /* A high surrogate must be followed by an escaped low
+                       one, the pair is one code point. Lone surrogates
+                       are no characters */
+                    if ((cp >= 0xdc00) && (cp <= 0xdfff))
+                        return -1;
+                    if ((cp >= 0xd800) && (cp <= 0xdbff)) {
+                        if ((*i + 6 >= len) || (data[*i + 1] != '\\') || (data[*i + 2] != 'u')
+                            || (sscanf(data + *i + 3, "%4x", &lo) != 1)
+                            || (lo < 0xdc00) || (lo > 0xdfff))
+                            return -1;
+                        *i += 6;
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    }
+                    /* Encode the code point as UTF-8 */
+                    if (cp < 0x80)
+                        out[(*olen)++] = cp;
+                    else
+                    if (cp < 0x800) {
+                        out[(*olen)++] = 0xc0 | (cp >> 6);
+                        out[(*olen)++] = 0x80 | (cp & 0x3f);
+                    }
+                    else
+                    if (cp < 0x10000) {
+                        out[(*olen)++] = 0xe0 | (cp >> 12);
+                        out[(*olen)++] = 0x80 | ((cp >> 6) & 0x3f);
+                        out[(*olen)++] = 0x80 | (cp & 0x3f);
+                    }
+                    else {
+                        out[(*olen)++] = 0xf0 | (cp >> 18);
+                        out[(*olen)++] = 0x80 | ((cp >> 12) & 0x3f);
+                        out[(*olen)++] = 0x80 | ((cp >> 6) & 0x3f);
+                        out[(*olen)++] = 0x80 | (cp & 0x3f);
+                    }
+                    break;
+                default:
+                    out[(*olen)++] = data[*i];
+            }
+            (*i)++;
+            continue;
+        }
+        out[(*olen)++] = data[(*i)++];
+    }
+
+    return -1;
+}
+
+/* Parse one JSONL line containing a flat object. Nested objects and
+   arrays are stored as their JSON text */
+static int importParseJSON(tImport *im, char *data, unsigned long len)
+{
+    unsigned long i = 0, vlen, start;
+    char *val, **names = NULL;
+    int numNames = 0, depth, inStr, ret = -1;
+
+    importClearValues(im);
+    val = (char *)malloc( (len + 1) * sizeof(char) );
+
+    while ((i < len) && (isspace(data[i])))
+        i++;
+    if ((i >= len) || (data[i] != '{'))
+        goto out;
+    i++;
+
+    while (i < len) {
+        while ((i < len) && ((isspace(data[i])) || (data[i] == ',')))
+            i++;
+        if ((i < len) && (data[i] == '}')) {
+            ret = 0;
+            break;
+        }
+
+        /* Key */
+        if ((i >= len) || (data[i] != '"')
+            || (importParseJSONString(data, len, &i, val, &vlen) != 0))
+            goto out;
+        val[vlen] = 0;
+        names = (char **)realloc(names, (numNames + 1) * sizeof(char *));
+        names[numNames++] = strdup(val);
+
+        while ((i < len) && ((isspace(data[i])) || (data[i] == ':')))
+            i++;
+        if (i >= len)
+            goto out;
+
+        /* Value */
+        if (data[i] == '"') {
+            if (importParseJSONString(data, len, &i, val, &vlen) != 0)
+                goto out;
+            importAddValue(im, val, vlen, 0);
+        }
+        else
+        if ((data[i] == '{') || (data[i] == '[')) {
+            start = i;
+            depth = inStr = 0;
+            for (; i < len; i++) {
+                if (inStr) {
+                    if (data[i] == '\\')
+                        i++;
+                    else
+                    if (data[i] == '"')
+                        inStr = 0;
+                }
+                else
+                if (data[i] == '"')
+                    inStr = 1;
+                else
+                if ((data[i] == '{') || (data[i] == '['))
+                    depth++;
+                else
+                if (((data[i] == '}') || (data[i] == ']')) && (--depth == 0)) {
+                    i++;
+                    break;
+                }
+            }
+            importAddValue(im, data + start, i - start, 0);
+        }
+        else {
+            start = i;
+            while ((i < len) && (data[i] != ',') && (data[i] != '}') && (!isspace(data[i])))
+                i++;
+            vlen = i - start;
+            if ((vlen == 4) && (strncmp(data + start, "null", 4) == 0))
+                importAddValue(im, NULL, 0, 1);
+            else
+            if ((vlen == 4) && (strncmp(data + start, "true", 4) == 0))
+                importAddValue(im, "1", 1, 0);
+            else
+            if ((vlen == 5) && (strncmp(data + start, "false", 5) == 0))
+                importAddValue(im, "0", 1, 0);
+            else
+                importAddValue(im, data + start, vlen, 0);
+        }
+    }
+
+out:
+    if ((ret == 0) && (numNames == im->numVals))
+        importAddRow(im, names);
+    else {
+        fprintf(stderr, "Error: Import into %s/%s: invalid JSON line\n", im->db, im->tab);
+        im->err = -EINVAL;
+    }
+
+    while (numNames > 0)
+        free(names[--numNames]);
+    free(names);
+    free(val);
+
+    return ret;
+}
+
+/* Process all the complete records in the buffer, final processes the
+   trailing record without the line end */
+static void importProcess(tImport *im, int final)
+{
+    unsigned long done = 0, n;
+    char *eol;
+    int i;
+
+    while ((done < im->len) && (im->err == 0)) {
+        if (im->format == IMPORT_UNKNOWN) {
+            while ((done < im->len) && (isspace(im->data[done])))
+                done++;
+            if (done >= im->len)
+                break;
+            im->format = (im->data[done] == '{') ? IMPORT_JSONL : IMPORT_CSV;
+        }
+
+        if (im->format == IMPORT_JSONL) {
+            eol = memchr(im->data + done, '\n', im->len - done);
+            if ((eol == NULL) && (!final))
+                break;
+            n = (eol != NULL) ? (eol - (im->data + done)) + 1 : im->len - done;
+            for (i = 0; (i < (int)n) && (isspace(im->data[done + i])); i++) ;
+            if (i < (int)n)
+                importParseJSON(im, im->data + done, n);
+            done += n;
+        }
+        else {
+            if ((n = importParseCSV(im, im->data + done, im->len - done, final)) == 0)
+                break;
+            done += n;
+
+            /* Skip empty lines */
+            if ((im->numVals == 1) && (im->vals[0] == NULL))
+                continue;
+
+            /* The first record names the columns */
+            if (im->cols == NULL) {
+                im->cols = im->vals;
+                im->numCols = im->numVals;
+                im->vals = NULL;
+                im->numVals = 0;
+                for (i = 0; i < im->numCols; i++)
+                    if (im->cols[i] == NULL)
+                        im->cols[i] = strdup("");
+            }
+            else
+                importAddRow(im, NULL);
+        }
+    }
+
+    memmove(im->data, im->data + done, im->len - done);
+    im->len -= done;
+}
+
+int importGetattr(const char *path, struct stat *stbuf)
+{
+    int exists;
+
+    exists = catalogExists(sql, getPathComponent(path, 0), getPathComponent(path, 1));
+    if (exists <= 0)
+        return (exists == 0) ? -ENOENT : -EIO;
+
+    stbuf->st_mode = S_IFREG | 0222;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = 0;
+    stbuf->st_mtime = stbuf->st_atime = stbuf->st_ctime = time(NULL);
+
+    return 0;
+}
+
+int importOpen(const char *path, struct fuse_file_info *fi)
+{
+    tImport *im;
+
+    if (flagIsSet(FLAG_READONLY))
+        return -EPERM;
+    if ((fi->flags & O_ACCMODE) == O_RDONLY)
+        return -EACCES;
+
+    im = (tImport *)malloc( sizeof(tImport) );
+    memset(im, 0, sizeof(tImport));
+    im->db = strdup(getPathComponent(path, 0));
+    im->tab = strdup(getPathComponent(path, 1));
+
+    if (((im->conn = openConnection(im->db)) == NULL)
+        || (mysql_select_db(im->conn, im->db) != 0)) {
+        if (im->conn != NULL)
+            mysql_close(im->conn);
+        free(im->db);
+        free(im->tab);
+        free(im);
+        return -ENOENT;
+    }
+    mysql_autocommit(im->conn, 0);
+
+    fi->fh = (uint64_t)(unsigned long)im;
+    fi->direct_io = 1;
+
+    return 0;
+}
+
+int importWrite(const char *path, const char *buf, size_t size, off_t offset,
+                struct fuse_file_info *fi)
+{
+    tImport *im = (tImport *)(unsigned long)fi->fh;
+
+    if (im == NULL)
+        return -EBADF;
+    if (im->err != 0)
+        return im->err;
+    if (offset != im->pos)
+        return -ESPIPE;
+
+    if (im->len + size + 1 > im->size) {
+        im->size = (im->len + size + 1) * 2;
+        im->data = (char *)realloc(im->data, im->size * sizeof(char));
+    }
+    memcpy(im->data + im->len, buf, size);
+    im->len += size;
+    im->pos += size;
+
+    importProcess(im, 0);
+
+    return (im->err != 0) ? im->err : (int)size;
+}
+
+/* Called on close(): insert and commit everything written so far */
+int importFlush(const char *path, struct fuse_file_info *fi)
+{
+    tImport *im = (tImport *)(unsigned long)fi->fh;
+
+    if (im == NULL)
+        return 0;
+
+    importProcess(im, 1);
+    return importBatch(im, 1);
+}
+
+int importRelease(const char *path, struct fuse_file_info *fi)
+{
+    tImport *im = (tImport *)(unsigned long)fi->fh;
+
+    if (im == NULL)
+        return 0;
+
+    /* Roll back the batches since the last commit after a failure, the
+       earlier ones are committed already */
+    if (im->err != 0)
+        mysql_rollback(im->conn);
+    mysql_close(im->conn);
+
+    importClearValues(im);
+    importClearColumns(im);
+    free(im->vals);
+    free(im->valLens);
+    free(im->data);
+    free(im->qry);
+    free(im->db);
+    free(im->tab);
+    free(im);
+    fi->fh = 0;
+
+    return 0;
+}
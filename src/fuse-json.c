@@ -0,0 +1,772 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  JSON views: a JSON column is also presented as the /db/table/pk/col.d
+  directory tree with objects and arrays as directories (array elements
+  are named by their index) and scalars as files, e.g. the file
+  /db/t/1/doc.d/items/0/price is $.items[0].price of doc. Only the
+  requested fragment is transferred: listings use JSON_KEYS/JSON_LENGTH,
+  reads JSON_EXTRACT and writes JSON_SET/JSON_REMOVE on the server. A
+  file opened for reading fetches its value once at open.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_JSON
+
+#ifdef DEBUG_JSON
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "json: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+
+#define JSON_SUFFIX             ".d"
+
+typedef struct tJsonPath {
+    char *db;
+    char *tab;
+    char *pkVal;
+    /* Condition selecting the row by its primary key */
+    char *where;
+    char *col;
+    /* JSON path escaped for use in a string literal */
+    char *jpath;
+} tJsonPath;
+
+/* Value of a scalar file opened for reading */
+typedef struct tJsonFile {
+    char *val;
+    unsigned long len;
+} tJsonFile;
+
+/* Returns the column name for the col.d component or NULL */
+static char *jsonColumn(const char *path)
+{
+    char *name, *col, *type;
+    int len;
+
+    if (getLevel(path) < 4)
+        return NULL;
+
+    name = getPathComponent(path, 3);
+    len = strlen(name);
+    if ((len <= 2) || (strcmp(name + len - 2, JSON_SUFFIX) != 0))
+        return NULL;
+
+    col = strdup(name);
+    col[len - 2] = 0;
+
+    if (mysql_select_db(&sql, getPathComponent(path, 0)) != 0) {
+        free(col);
+        return NULL;
+    }
+    type = catalogColumnType(sql, getPathComponent(path, 0), getPathComponent(path, 1), col);
+    if ((type == NULL) || (strncasecmp(type, "json", 4) != 0)) {
+        free(type);
+        free(col);
+        return NULL;
+    }
+    free(type);
+
+    return col;
+}
+
+int jsonIsPath(const char *path)
+{
+    char *col;
+
+    if ((col = jsonColumn(path)) == NULL)
+        return 0;
+
+    free(col);
+    return 1;
+}
+
+static void jsonFreePath(tJsonPath *jp)
+{
+    free(jp->where);
+    free(jp->col);
+    free(jp->jpath);
+}
+
+static int jsonSelect(tJsonPath *jp, char *expr, char **val, unsigned long *len);
+
+/* Build the JSON path of the first num components, isIndex tells which
+   are indexes of arrays, the others are quoted member names */
+static char *jsonBuildPath(char **comps, char *isIndex, int num, unsigned long *len)
+{
+    char *jpath;
+    int idx, i;
+
+    jpath = strdup("$");
+    *len = 1;
+    for (idx = 0; idx < num; idx++) {
+        jpath = (char *)realloc(jpath, (*len + 2 * strlen(comps[idx]) + 5) * sizeof(char));
+        if (isIndex[idx]) {
+            *len += sprintf(jpath + *len, "[%s]", comps[idx]);
+            continue;
+        }
+        /* Quotes and backslashes escaped */
+        jpath[(*len)++] = '.';
+        jpath[(*len)++] = '"';
+        for (i = 0; comps[idx][i] != 0; i++) {
+            if ((comps[idx][i] == '"') || (comps[idx][i] == '\\'))
+                jpath[(*len)++] = '\\';
+            jpath[(*len)++] = comps[idx][i];
+        }
+        jpath[(*len)++] = '"';
+        jpath[*len] = 0;
+    }
+
+    return jpath;
+}
+
+/* Append the JSON_TYPE of the path of the first num components, NONE if
+   it doesn't exist */
+static void jsonAppendType(tJsonPath *jp, char **expr, unsigned long *elen, char **comps,
+                           char *isIndex, int num)
+{
+    unsigned long len, size;
+    char *jpath, *tmp;
+
+    jpath = jsonBuildPath(comps, isIndex, num, &len);
+    tmp = (char *)malloc( (2 * len + 1) * sizeof(char) );
+    mysql_real_escape_string(&sql, tmp, jpath, len);
+    size = strlen(tmp) + strlen(jp->col) + 80;
+    *expr = (char *)realloc(*expr, (*elen + size) * sizeof(char));
+    *elen += snprintf(*expr + *elen, size, ", IFNULL(JSON_TYPE(JSON_EXTRACT(`%s`, '%s')), 'NONE')",
+                      jp->col, tmp);
+    free(tmp);
+    free(jpath);
+}
+
+/* Decide which components made of digits only are indexes of arrays and
+   which member names of objects. All of them are first taken as indexes
+   and the types of the containers are checked in one query, a container
+   that is no array makes the component a member name and the containers
+   after it are checked again. Paths into arrays take one query */
+static void jsonResolveIndexes(tJsonPath *jp, char **comps, char *isIndex, int num)
+{
+    char *expr, *val, *type, *save;
+    unsigned long elen, vlen;
+    int idx, changed;
+
+    do {
+        expr = strdup("CONCAT_WS(','");
+        elen = strlen(expr);
+        for (idx = 0; idx < num; idx++)
+            if (isIndex[idx])
+                jsonAppendType(jp, &expr, &elen, comps, isIndex, idx);
+        if (elen == strlen("CONCAT_WS(','")) {
+            free(expr);
+            return;
+        }
+        expr = (char *)realloc(expr, (elen + 2) * sizeof(char));
+        strcpy(expr + elen, ")");
+
+        changed = 0;
+        val = NULL;
+        if ((jsonSelect(jp, expr, &val, &vlen) > 0) && (val != NULL)) {
+            /* Missing containers stay indexes, the path doesn't exist
+               either way */
+            type = strtok_r(val, ",", &save);
+            for (idx = 0; (idx < num) && (!changed); idx++) {
+                if (!isIndex[idx])
+                    continue;
+                if ((type != NULL) && (strcmp(type, "ARRAY") != 0)
+                    && (strcmp(type, "NONE") != 0)) {
+                    isIndex[idx] = 0;
+                    changed = 1;
+                }
+                type = strtok_r(NULL, ",", &save);
+            }
+        }
+        free(val);
+        free(expr);
+    } while (changed);
+}
+
+/* Build the JSON path for the components after col.d, components made of
+   digits only are indexes of arrays and member names of objects */
+static int jsonParsePath(const char *path, tJsonPath *jp)
+{
+    char *jpath, *tmp, **comps, *isIndex;
+    unsigned long len, j;
+    int level, idx, num;
+
+    memset(jp, 0, sizeof(tJsonPath));
+    if ((jp->col = jsonColumn(path)) == NULL)
+        return -ENOENT;
+
+    jp->db = getPathComponent(path, 0);
+    jp->tab = getPathComponent(path, 1);
+    jp->pkVal = getPathComponent(path, 2);
+    if ((jp->where = keyWhere(sql, jp->tab, jp->pkVal)) == NULL) {
+        jsonFreePath(jp);
+        return -ENOENT;
+    }
+
+    level = getLevel(path);
+    num = (level > 4) ? level - 4 : 0;
+    comps = (char **)malloc( (num + 1) * sizeof(char *) );
+    isIndex = (char *)malloc( (num + 1) * sizeof(char) );
+    for (idx = 0; idx < num; idx++) {
+        comps[idx] = getPathComponent(path, idx + 4);
+        isIndex[idx] = (strspn(comps[idx], "0123456789") == strlen(comps[idx]));
+    }
+    jsonResolveIndexes(jp, comps, isIndex, num);
+    jpath = jsonBuildPath(comps, isIndex, num, &len);
+    free(comps);
+    free(isIndex);
+
+    tmp = (char *)malloc( (2 * len + 1) * sizeof(char) );
+    j = mysql_real_escape_string(&sql, tmp, jpath, len);
+    tmp[j] = 0;
+    free(jpath);
+    jp->jpath = tmp;
+
+    return 0;
+}
+
+/* Run SELECT <expr> for the row. Returns 1 with the value (NULL for SQL
+   NULL) or 0 if the row doesn't exist, -1 on error */
+static int jsonSelect(tJsonPath *jp, char *expr, char **val, unsigned long *len)
+{
+    char *qry;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    int size, ret = 0;
+
+    size = strlen(expr) + strlen(jp->tab) + strlen(jp->where) + 64;
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "SELECT %s FROM `%s` WHERE %s", expr, jp->tab, jp->where);
+
+    *val = NULL;
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, strlen(qry)) != 0)
+        || ((res = mysql_store_result(&sql)) == NULL)) {
+        DPRINTF("%s: Query failed: %s\n", __FUNCTION__, mysql_error(&sql));
+        free(qry);
+        return -1;
+    }
+    free(qry);
+
+    if ((row = mysql_fetch_row(res)) != NULL) {
+        ret = 1;
+        if (row[0] != NULL) {
+            *len = mysql_fetch_lengths(res)[0];
+            *val = (char *)malloc( (*len + 1) * sizeof(char) );
+            memcpy(*val, row[0], *len);
+            (*val)[*len] = 0;
+        }
+    }
+    mysql_free_result(res);
+
+    return ret;
+}
+
+/* Returns the allocated "<pre>`col`, '<path>'<post>" expression */
+static char *jsonExpr(tJsonPath *jp, const char *pre, const char *post)
+{
+    unsigned long size;
+    char *expr;
+
+    size = strlen(pre) + strlen(jp->col) + strlen(jp->jpath) + strlen(post) + 8;
+    expr = (char *)malloc( size * sizeof(char) );
+    snprintf(expr, size, "%s`%s`, '%s'%s", pre, jp->col, jp->jpath, post);
+
+    return expr;
+}
+
+/* Returns the JSON_TYPE of the path or NULL if it doesn't exist */
+static char *jsonType(tJsonPath *jp)
+{
+    unsigned long len;
+    char *expr, *val;
+    int ret;
+
+    expr = jsonExpr(jp, "JSON_TYPE(JSON_EXTRACT(", "))");
+    ret = jsonSelect(jp, expr, &val, &len);
+    free(expr);
+    if (ret <= 0)
+        return NULL;
+
+    return val;
+}
+
+static int jsonIsContainer(char *type)
+{
+    return ((strcmp(type, "OBJECT") == 0) || (strcmp(type, "ARRAY") == 0));
+}
+
+/* Returns the JSON_TYPE of the path and for scalars fn applied to the
+   unquoted value, both in one query. NULL if the path doesn't exist, val
+   is NULL for containers */
+static char *jsonFetch(tJsonPath *jp, const char *fn, char **val, unsigned long *len)
+{
+    char *expr, *res, *type, *sep;
+    unsigned long size, rlen;
+    int ret;
+
+    size = 3 * (strlen(jp->col) + strlen(jp->jpath)) + strlen(fn) + 200;
+    expr = (char *)malloc( size * sizeof(char) );
+    snprintf(expr, size, "CONCAT_WS(',', JSON_TYPE(JSON_EXTRACT(`%s`, '%s')), "
+             "IF(JSON_TYPE(JSON_EXTRACT(`%s`, '%s')) IN ('OBJECT', 'ARRAY'), NULL, "
+             "%s(JSON_UNQUOTE(JSON_EXTRACT(`%s`, '%s')))))",
+             jp->col, jp->jpath, jp->col, jp->jpath, fn, jp->col, jp->jpath);
+    ret = jsonSelect(jp, expr, &res, &rlen);
+    free(expr);
+
+    *val = NULL;
+    *len = 0;
+    if ((ret <= 0) || (res == NULL) || (rlen == 0)) {
+        free(res);
+        return NULL;
+    }
+
+    /* Types have no commas, the value follows the first one */
+    if ((sep = strchr(res, ',')) == NULL)
+        return res;
+    type = strndup(res, sep - res);
+    *len = rlen - (sep + 1 - res);
+    *val = (char *)malloc( (*len + 1) * sizeof(char) );
+    memcpy(*val, sep + 1, *len);
+    (*val)[*len] = 0;
+    free(res);
+
+    return type;
+}
+
+/* Scalars are presented unquoted, JSON null as an empty file. Returns the
+   type, NULL if the path doesn't exist */
+static char *jsonValue(tJsonPath *jp, char **val, unsigned long *len)
+{
+    char *type;
+
+    if ((type = jsonFetch(jp, "", val, len)) == NULL)
+        return NULL;
+    if (strcmp(type, "NULL") == 0)
+        *len = 0;
+
+    return type;
+}
+
+static int jsonUpdate(tJsonPath *jp, char *expr)
+{
+    char *qry;
+    int size, ret = 0;
+
+    if (writebackEnabled())
+        writebackSync(NULL);
+
+    size = strlen(expr) + strlen(jp->tab) + strlen(jp->col) + strlen(jp->where) + 64;
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "UPDATE `%s` SET `%s` = %s WHERE %s",
+             jp->tab, jp->col, expr, jp->where);
+
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
+        DPRINTF("%s: Query failed: %s\n", __FUNCTION__, mysql_error(&sql));
+        ret = -EIO;
+    }
+    free(qry);
+    rowCacheInvalidate(jp->db, jp->tab, jp->pkVal);
+
+    return ret;
+}
+
+/* Add col.d entries for the JSON columns of the row listing */
+void jsonFill(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+    char **cols, name[1024];
+    struct stat st;
+    int num, i;
+
+    if (mysql_select_db(&sql, getPathComponent(path, 0)) != 0)
+        return;
+    if ((cols = catalogColumnsOfType(sql, getPathComponent(path, 0),
+                                     getPathComponent(path, 1), "json", &num)) == NULL)
+        return;
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    for (i = 0; i < num; i++) {
+        snprintf(name, sizeof(name), "%s%s", cols[i], JSON_SUFFIX);
+        filler(buf, name, &st, 0);
+        free(cols[i]);
+    }
+    free(cols);
+}
+
+int jsonGetattr(const char *path, struct stat *stbuf)
+{
+    tJsonPath jp;
+    unsigned long len = 0;
+    char *type, *val;
+    int ret = 0;
+
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    /* The type and the size only, the value stays on the server */
+    if ((type = jsonFetch(&jp, "LENGTH", &val, &len)) == NULL)
+        ret = -ENOENT;
+    else
+    if (jsonIsContainer(type)) {
+        stbuf->st_mode = S_IFDIR | (flagIsSet(FLAG_READONLY) ? 0555 : 0755);
+        stbuf->st_nlink = 1;
+        stbuf->st_size = 0;
+    }
+    else {
+        stbuf->st_mode = S_IFREG | (flagIsSet(FLAG_READONLY) ? 0444 : 0666);
+        stbuf->st_nlink = 1;
+        stbuf->st_size = ((val != NULL) && (strcmp(type, "NULL") != 0)) ? atoll(val) : 0;
+    }
+    free(type);
+    free(val);
+
+    if (ret == 0) {
+        stbuf->st_mtime = getMtime(sql, (char *)path, NULL);
+        stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime;
+    }
+    jsonFreePath(&jp);
+
+    return ret;
+}
+
+/* Parse the JSON_KEYS array and pass the keys to the filler */
+static void jsonFillKeys(char *keys, unsigned long len, void *buf, fuse_fill_dir_t filler)
+{
+    char *name;
+    unsigned long i, n;
+
+    name = (char *)malloc( (len + 1) * sizeof(char) );
+    for (i = 0; i < len; i++) {
+        if (keys[i] != '"')
+            continue;
+
+        for (i++, n = 0; (i < len) && (keys[i] != '"'); i++) {
+            if ((keys[i] == '\\') && (i + 1 < len))
+                i++;
+            name[n++] = keys[i];
+        }
+        name[n] = 0;
+
+        /* Names with a slash can't be presented */
+        if ((n > 0) && (strchr(name, '/') == NULL))
+            filler(buf, name, NULL, 0);
+    }
+    free(name);
+}
+
+int jsonReaddir(const char *path, void *buf, fuse_fill_dir_t filler)
+{
+    char *expr, *type, *val = NULL, name[32];
+    unsigned long len;
+    tJsonPath jp;
+    int ret = 0, i, num;
+
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    if ((type = jsonType(&jp)) == NULL) {
+        jsonFreePath(&jp);
+        return -ENOENT;
+    }
+
+    if (jsonIsContainer(type)) {
+        filler(buf, ".", NULL, 0);
+        filler(buf, "..", NULL, 0);
+
+        if (strcmp(type, "OBJECT") == 0) {
+            expr = jsonExpr(&jp, "JSON_KEYS(", ")");
+            if ((jsonSelect(&jp, expr, &val, &len) > 0) && (val != NULL))
+                jsonFillKeys(val, len, buf, filler);
+            free(expr);
+        }
+        else {
+            expr = jsonExpr(&jp, "JSON_LENGTH(", ")");
+            if ((jsonSelect(&jp, expr, &val, &len) > 0) && (val != NULL)) {
+                num = atoi(val);
+                for (i = 0; i < num; i++) {
+                    snprintf(name, sizeof(name), "%d", i);
+                    filler(buf, name, NULL, 0);
+                }
+            }
+            free(expr);
+        }
+        free(val);
+    }
+    else
+        ret = -ENOTDIR;
+
+    free(type);
+    jsonFreePath(&jp);
+
+    return ret;
+}
+
+/* Files opened for reading get the value once, it is read from the handle
+   then. Files opened for writing read the value on every read so they see
+   their own writes */
+int jsonOpen(const char *path, struct fuse_file_info *fi)
+{
+    unsigned long len = 0;
+    tJsonFile *jf;
+    tJsonPath jp;
+    char *type, *val;
+    int ret, rw;
+
+    rw = ((fi->flags & O_WRONLY) || (fi->flags & O_RDWR));
+    if ((rw) && (flagIsSet(FLAG_READONLY)))
+        return -EPERM;
+
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    if ((type = jsonValue(&jp, &val, &len)) == NULL)
+        ret = -ENOENT;
+    else
+    if (jsonIsContainer(type))
+        ret = -EISDIR;
+    else
+    if (!rw) {
+        jf = (tJsonFile *)malloc( sizeof(tJsonFile) );
+        jf->val = val;
+        jf->len = len;
+        val = NULL;
+        fi->fh = (uint64_t)(unsigned long)jf;
+    }
+    free(type);
+    free(val);
+    jsonFreePath(&jp);
+
+    return ret;
+}
+
+int jsonRead(const char *path, char *buf, size_t size, off_t offset,
+             struct fuse_file_info *fi)
+{
+    tJsonFile *jf = (tJsonFile *)(unsigned long)fi->fh;
+    unsigned long len = 0;
+    char *type, *val;
+    tJsonPath jp;
+    int ret;
+
+    if (jf != NULL) {
+        val = jf->val;
+        len = jf->len;
+    }
+    else {
+        if ((ret = jsonParsePath(path, &jp)) != 0)
+            return ret;
+        type = jsonValue(&jp, &val, &len);
+        jsonFreePath(&jp);
+        if (type == NULL)
+            return -ENOENT;
+        free(type);
+    }
+
+    if (offset >= len)
+        size = 0;
+    else
+    if (offset + size > len)
+        size = len - offset;
+    if (size > 0)
+        memcpy(buf, val + offset, size);
+    if (jf == NULL)
+        free(val);
+
+    return size;
+}
+
+int jsonRelease(const char *path, struct fuse_file_info *fi)
+{
+    tJsonFile *jf = (tJsonFile *)(unsigned long)fi->fh;
+
+    if (jf == NULL)
+        return 0;
+
+    free(jf->val);
+    free(jf);
+    fi->fh = 0;
+
+    return 0;
+}
+
+/* Store the new value of the scalar, strings stay strings and other types
+   are parsed as JSON text. An empty value of another type (a truncate
+   before it is rewritten) is stored as JSON null */
+static int jsonStore(tJsonPath *jp, char *val, unsigned long len, int isString)
+{
+    char *tmp, *expr;
+    unsigned long size;
+    int ret;
+
+    tmp = (char *)malloc( (2 * len + 1) * sizeof(char) );
+    mysql_real_escape_string(&sql, tmp, val, len);
+
+    size = strlen(tmp) + strlen(jp->col) + strlen(jp->jpath) + 64;
+    expr = (char *)malloc( size * sizeof(char) );
+    if (isString)
+        snprintf(expr, size, "JSON_SET(`%s`, '%s', '%s')", jp->col, jp->jpath, tmp);
+    else
+    if (len == 0)
+        snprintf(expr, size, "JSON_SET(`%s`, '%s', CAST('null' AS JSON))", jp->col, jp->jpath);
+    else
+        snprintf(expr, size, "JSON_SET(`%s`, '%s', JSON_EXTRACT('%s', '$'))",
+                 jp->col, jp->jpath, tmp);
+
+    ret = jsonUpdate(jp, expr);
+    free(expr);
+    free(tmp);
+
+    return ret;
+}
+
+/* Replace the bytes of the scalar value like writes to column files do */
+static int jsonSplice(const char *path, const char *buf, size_t size, off_t offset,
+                      int truncate)
+{
+    unsigned long len = 0;
+    char *type, *val;
+    tJsonPath jp;
+    int ret;
+
+    if (flagIsSet(FLAG_READONLY))
+        return -EPERM;
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    if ((type = jsonValue(&jp, &val, &len)) == NULL) {
+        jsonFreePath(&jp);
+        return -ENOENT;
+    }
+    if (jsonIsContainer(type)) {
+        free(type);
+        jsonFreePath(&jp);
+        return -EISDIR;
+    }
+    if (val == NULL)
+        val = strdup("");
+
+    if (truncate) {
+        if (offset < len)
+            len = offset;
+    }
+    else {
+        if (offset + size > len) {
+            val = (char *)realloc(val, (offset + size + 1) * sizeof(char));
+            if (offset > len)
+                memset(val + len, ' ', offset - len);
+            len = offset + size;
+        }
+        memcpy(val + offset, buf, size);
+    }
+
+    ret = jsonStore(&jp, val, len, (strcmp(type, "STRING") == 0));
+    free(val);
+    free(type);
+    jsonFreePath(&jp);
+
+    return (ret == 0) ? (int)size : ret;
+}
+
+int jsonWrite(const char *path, const char *buf, size_t size, off_t offset)
+{
+    return jsonSplice(path, buf, size, offset, 0);
+}
+
+int jsonTruncate(const char *path, off_t size)
+{
+    int ret;
+
+    ret = jsonSplice(path, NULL, 0, size, 1);
+    return (ret < 0) ? ret : 0;
+}
+
+/* New members are created as empty strings or objects */
+static int jsonAdd(const char *path, char *initial)
+{
+    char *expr, *type, post[64];
+    tJsonPath jp;
+    int ret;
+
+    if (flagIsSet(FLAG_READONLY))
+        return -EPERM;
+    if (getLevel(path) < 5)
+        return -EEXIST;
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    if ((type = jsonType(&jp)) != NULL) {
+        free(type);
+        jsonFreePath(&jp);
+        return -EEXIST;
+    }
+
+    snprintf(post, sizeof(post), ", %s)", initial);
+    expr = jsonExpr(&jp, "JSON_SET(", post);
+    ret = jsonUpdate(&jp, expr);
+    free(expr);
+    jsonFreePath(&jp);
+
+    return ret;
+}
+
+int jsonCreate(const char *path)
+{
+    return jsonAdd(path, "''");
+}
+
+int jsonMkdir(const char *path)
+{
+    return jsonAdd(path, "JSON_OBJECT()");
+}
+
+int jsonRemove(const char *path, int dir)
+{
+    char *expr, *type, *val = NULL;
+    unsigned long len;
+    tJsonPath jp;
+    int ret;
+
+    if (flagIsSet(FLAG_READONLY))
+        return -EPERM;
+    if (getLevel(path) < 5)
+        return -EPERM;
+    if ((ret = jsonParsePath(path, &jp)) != 0)
+        return ret;
+
+    if ((type = jsonType(&jp)) == NULL) {
+        jsonFreePath(&jp);
+        return -ENOENT;
+    }
+    if (jsonIsContainer(type) != dir)
+        ret = dir ? -ENOTDIR : -EISDIR;
+    free(type);
+
+    /* Only empty objects and arrays can be removed using rmdir */
+    if ((ret == 0) && (dir)) {
+        expr = jsonExpr(&jp, "JSON_LENGTH(", ")");
+        if ((jsonSelect(&jp, expr, &val, &len) > 0) && (val != NULL) && (atoi(val) > 0))
+            ret = -ENOTEMPTY;
+        free(expr);
+        free(val);
+    }
+
+    if (ret == 0) {
+        expr = jsonExpr(&jp, "JSON_REMOVE(", ")");
+        ret = jsonUpdate(&jp, expr);
+        free(expr);
+    }
+    jsonFreePath(&jp);
+
+    return ret;
+}
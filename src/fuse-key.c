@@ -0,0 +1,529 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Key codec: maps primary key values to row directory names and back and
+  builds the key predicates of the queries. Literals follow the type of
+  the key column: numbers are unquoted, binary values are hex literals
+  and strings are escaped string literals, so the comparisons don't need
+  conversions and use the primary key index. In the directory names '%',
+  '/' and NUL (plus ',' and a leading '.') are written as %XX. The values
+  of composite keys are joined using ',' in the key order.
+
+  All functions use the database selected on the connection (sql.db).
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_KEY
+
+#ifdef DEBUG_KEY
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "key: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+
+#define KEY_STRING              0
+#define KEY_NUMERIC             1
+#define KEY_BINARY              2
+
+#define KEY_SEPARATOR           ','
+
+typedef struct tKey {
+    int num;
+    char **cols;
+    int *kinds;
+} tKey;
+
+static int keyKind(const char *type)
+{
+    const char *numeric[] = { "tinyint", "smallint", "mediumint", "int", "bigint",
+                              "decimal", "numeric", "float", "double", "real", NULL };
+    int i;
+
+    for (i = 0; numeric[i] != NULL; i++)
+        if (strncasecmp(type, numeric[i], strlen(numeric[i])) == 0)
+            return KEY_NUMERIC;
+
+    if ((strncasecmp(type, "binary", 6) == 0) || (strncasecmp(type, "varbinary", 9) == 0)
+        || (strcasestr(type, "blob") != NULL))
+        return KEY_BINARY;
+
+    return KEY_STRING;
+}
+
+static void keyFree(tKey *key)
+{
+    int i;
+
+    for (i = 0; i < key->num; i++)
+        free(key->cols[i]);
+    free(key->cols);
+    free(key->kinds);
+}
+
+static int keyLoad(MYSQL sql, char *tab, tKey *key)
+{
+    char **types;
+    int i;
+
+    memset(key, 0, sizeof(tKey));
+    key->num = catalogPrimaryKeys(sql, sql.db, tab, &key->cols, &types);
+    if (key->num <= 0) {
+        free(key->cols);
+        free(types);
+        key->num = 0;
+        return -1;
+    }
+
+    key->kinds = (int *)malloc( key->num * sizeof(int) );
+    for (i = 0; i < key->num; i++) {
+        key->kinds[i] = keyKind(types[i]);
+        free(types[i]);
+    }
+    free(types);
+
+    return 0;
+}
+
+static void keyAppend(char **str, unsigned long *len, const char *data, unsigned long dlen)
+{
+    *str = (char *)realloc(*str, (*len + dlen + 1) * sizeof(char));
+    memcpy(*str + *len, data, dlen);
+    *len += dlen;
+    (*str)[*len] = 0;
+}
+
+/* Encode the values into a directory name, NULL if the row can't have
+   one (an empty single column key) */
+static char *keyEncode(char **vals, unsigned long *lens, int num)
+{
+    unsigned long len = 0, i;
+    char *name = NULL, tmp[4];
+    unsigned char c;
+    int n;
+
+    if ((num == 1) && (lens[0] == 0))
+        return NULL;
+
+    keyAppend(&name, &len, "", 0);
+    for (n = 0; n < num; n++) {
+        if (n > 0)
+            keyAppend(&name, &len, ",", 1);
+        for (i = 0; i < lens[n]; i++) {
+            c = (unsigned char)vals[n][i];
+            if ((c == '%') || (c == '/') || (c == 0) || ((c == KEY_SEPARATOR) && (num > 1))
+                || ((c == '.') && (len == 0))) {
+                snprintf(tmp, sizeof(tmp), "%%%02X", c);
+                keyAppend(&name, &len, tmp, 3);
+            }
+            else
+                keyAppend(&name, &len, vals[n] + i, 1);
+        }
+    }
+
+    return name;
+}
+
+static int keyHex(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Split the directory name into num values, returns -1 if the name is not
+   a valid name of a key with num columns */
+static int keyDecode(const char *name, int num, char ***vals, unsigned long **lens)
+{
+    unsigned long i, len;
+    int n = 0, hi, lo;
+
+    len = strlen(name);
+    if ((num == 1) && (len == 0))
+        return -1;
+
+    *vals = (char **)malloc( num * sizeof(char *) );
+    *lens = (unsigned long *)malloc( num * sizeof(unsigned long) );
+    (*vals)[0] = (char *)malloc( (len + 1) * sizeof(char) );
+    (*lens)[0] = 0;
+
+    for (i = 0; i < len; i++) {
+        if ((name[i] == KEY_SEPARATOR) && (num > 1)) {
+            /* Too many values, n still indexes the last allocated one */
+            if (n + 1 >= num)
+                goto invalid;
+            n++;
+            (*vals)[n] = (char *)malloc( (len + 1) * sizeof(char) );
+            (*lens)[n] = 0;
+            continue;
+        }
+        if ((name[i] == '%') && (i + 2 < len) && ((hi = keyHex(name[i + 1])) >= 0)
+            && ((lo = keyHex(name[i + 2])) >= 0)) {
+            (*vals)[n][(*lens)[n]++] = (hi << 4) | lo;
+            i += 2;
+            continue;
+        }
+        (*vals)[n][(*lens)[n]++] = name[i];
+    }
+
+    if (n == num - 1) {
+        for (; n >= 0; n--)
+            (*vals)[n][(*lens)[n]] = 0;
+        return num;
+    }
+
+invalid:
+    for (; n >= 0; n--)
+        free((*vals)[n]);
+    free(*vals);
+    free(*lens);
+    return -1;
+}
+
+/* A single value as a file name, for the directories named by a value
+   other than the key. NULL for an empty value */
+char *keyValueName(char *val, unsigned long len)
+{
+    return keyEncode(&val, &len, 1);
+}
+
+/* The value of a name made by keyValueName(), NULL if it is not valid */
+char *keyNameValue(const char *name, unsigned long *len)
+{
+    unsigned long *lens;
+    char **vals, *val;
+
+    if (keyDecode(name, 1, &vals, &lens) < 0)
+        return NULL;
+    val = vals[0];
+    *len = lens[0];
+    free(vals);
+    free(lens);
+
+    return val;
+}
+
+/* Returns 1 if the value is a plain number: an optional sign, digits with
+   an optional fraction and an optional exponent */
+static int keyIsNumber(const char *val, unsigned long vlen)
+{
+    unsigned long i = 0, digits = 0;
+
+    if ((i < vlen) && ((val[i] == '+') || (val[i] == '-')))
+        i++;
+    for (; (i < vlen) && (isdigit((unsigned char)val[i])); i++)
+        digits++;
+    if ((i < vlen) && (val[i] == '.'))
+        for (i++; (i < vlen) && (isdigit((unsigned char)val[i])); i++)
+            digits++;
+    if (digits == 0)
+        return 0;
+
+    if ((i < vlen) && ((val[i] == 'e') || (val[i] == 'E'))) {
+        i++;
+        if ((i < vlen) && ((val[i] == '+') || (val[i] == '-')))
+            i++;
+        for (digits = 0; (i < vlen) && (isdigit((unsigned char)val[i])); i++)
+            digits++;
+        if (digits == 0)
+            return 0;
+    }
+
+    return (i == vlen) ? 1 : 0;
+}
+
+/* Append the literal of the value, returns -1 if the value is not valid
+   for the column type. Numbers are appended as they are, anything else
+   is quoted as a string which the server converts like it would */
+static int keyLiteral(MYSQL sql, char **str, unsigned long *len, char *val,
+                      unsigned long vlen, int kind)
+{
+    char *tmp, hex[3];
+    unsigned long i;
+
+    if ((kind == KEY_NUMERIC) && (vlen == 0))
+        return -1;
+
+    if ((kind == KEY_NUMERIC) && (keyIsNumber(val, vlen)))
+        keyAppend(str, len, val, vlen);
+    else
+    if (kind == KEY_BINARY) {
+        keyAppend(str, len, "X'", 2);
+        for (i = 0; i < vlen; i++) {
+            snprintf(hex, sizeof(hex), "%02X", (unsigned char)val[i]);
+            keyAppend(str, len, hex, 2);
+        }
+        keyAppend(str, len, "'", 1);
+    }
+    else {
+        tmp = (char *)malloc( (2 * vlen + 1) * sizeof(char) );
+        mysql_real_escape_string(&sql, tmp, val, vlen);
+        keyAppend(str, len, "'", 1);
+        keyAppend(str, len, tmp, strlen(tmp));
+        keyAppend(str, len, "'", 1);
+        free(tmp);
+    }
+
+    return 0;
+}
+
+static void keyColumn(char **str, unsigned long *len, char *col)
+{
+    keyAppend(str, len, "`", 1);
+    keyAppend(str, len, col, strlen(col));
+    keyAppend(str, len, "`", 1);
+}
+
+/* Build the key predicate or value list for the name. Returns NULL if the
+   name is not a valid key */
+static char *keyBuild(MYSQL sql, char *tab, const char *name, const char *op)
+{
+    char *str = NULL, **vals;
+    unsigned long len = 0, *lens;
+    int i, ret = 0;
+    tKey key;
+
+    if ((name == NULL) || (keyLoad(sql, tab, &key) != 0))
+        return NULL;
+    if (keyDecode(name, key.num, &vals, &lens) < 0) {
+        keyFree(&key);
+        return NULL;
+    }
+
+    keyAppend(&str, &len, "", 0);
+    if (op == NULL) {
+        /* Plain value list */
+        for (i = 0; (i < key.num) && (ret == 0); i++) {
+            if (i > 0)
+                keyAppend(&str, &len, ",", 1);
+            ret = keyLiteral(sql, &str, &len, vals[i], lens[i], key.kinds[i]);
+        }
+    }
+    else
+    if ((strcmp(op, "=") == 0) || (key.num == 1)) {
+        for (i = 0; (i < key.num) && (ret == 0); i++) {
+            if (i > 0)
+                keyAppend(&str, &len, " AND ", 5);
+            keyColumn(&str, &len, key.cols[i]);
+            keyAppend(&str, &len, " ", 1);
+            keyAppend(&str, &len, op, strlen(op));
+            keyAppend(&str, &len, " ", 1);
+            ret = keyLiteral(sql, &str, &len, vals[i], lens[i], key.kinds[i]);
+        }
+    }
+    else {
+        /* Row constructor comparison for ranges of composite keys */
+        keyAppend(&str, &len, "(", 1);
+        for (i = 0; i < key.num; i++) {
+            if (i > 0)
+                keyAppend(&str, &len, ",", 1);
+            keyColumn(&str, &len, key.cols[i]);
+        }
+        keyAppend(&str, &len, ") ", 2);
+        keyAppend(&str, &len, op, strlen(op));
+        keyAppend(&str, &len, " (", 2);
+        for (i = 0; (i < key.num) && (ret == 0); i++) {
+            if (i > 0)
+                keyAppend(&str, &len, ",", 1);
+            ret = keyLiteral(sql, &str, &len, vals[i], lens[i], key.kinds[i]);
+        }
+        keyAppend(&str, &len, ")", 1);
+    }
+
+    for (i = 0; i < key.num; i++)
+        free(vals[i]);
+    free(vals);
+    free(lens);
+    keyFree(&key);
+
+    if (ret != 0) {
+        DPRINTF("%s: '%s' is not a valid key of %s\n", __FUNCTION__, name, tab);
+        free(str);
+        return NULL;
+    }
+
+    return str;
+}
+
+/* "`a` = 1 AND `b` = 'x'" for the row named name */
+char *keyWhere(MYSQL sql, char *tab, const char *name)
+{
+    return keyBuild(sql, tab, name, "=");
+}
+
+/* "(`a`,`b`) >= (1,'x')", op is a comparison operator */
+char *keyCompare(MYSQL sql, char *tab, const char *name, const char *op)
+{
+    return keyBuild(sql, tab, name, op);
+}
+
+/* "1,'x'" for INSERT and HANDLER ... READ */
+char *keyValues(MYSQL sql, char *tab, const char *name)
+{
+    return keyBuild(sql, tab, name, NULL);
+}
+
+/* "`a`,`b`" for the select lists, ORDER BY and INSERT column lists */
+char *keyColumns(MYSQL sql, char *tab)
+{
+    unsigned long len = 0;
+    char *str = NULL;
+    tKey key;
+    int i;
+
+    if (keyLoad(sql, tab, &key) != 0)
+        return NULL;
+
+    keyAppend(&str, &len, "", 0);
+    for (i = 0; i < key.num; i++) {
+        if (i > 0)
+            keyAppend(&str, &len, ",", 1);
+        keyColumn(&str, &len, key.cols[i]);
+    }
+    keyFree(&key);
+
+    return str;
+}
+
+/* Returns 1 if the column is a part of the primary key */
+int keyIsColumn(MYSQL sql, char *tab, char *col)
+{
+    tKey key;
+    int i, ret = 0;
+
+    if (keyLoad(sql, tab, &key) != 0)
+        return 0;
+
+    for (i = 0; (i < key.num) && (!ret); i++)
+        ret = (strcmp(key.cols[i], col) == 0);
+    keyFree(&key);
+
+    return ret;
+}
+
+/* Returns the directory name of the row from a result set containing the
+   key columns cols, for the callers resolving the key before streaming a
+   result (no other query may run on the connection meanwhile) */
+char *keyRowNameOf(char **cols, int num, MYSQL_RES *res, MYSQL_ROW row)
+{
+    MYSQL_FIELD *fields;
+    unsigned long *lengths, *lens;
+    unsigned int numFields, j;
+    char **vals, *name = NULL;
+    int i;
+
+    fields = mysql_fetch_fields(res);
+    lengths = mysql_fetch_lengths(res);
+    numFields = mysql_num_fields(res);
+
+    vals = (char **)malloc( num * sizeof(char *) );
+    lens = (unsigned long *)malloc( num * sizeof(unsigned long) );
+    for (i = 0; i < num; i++) {
+        for (j = 0; j < numFields; j++)
+            if (strcmp(fields[j].name, cols[i]) == 0)
+                break;
+        if ((j >= numFields) || (row[j] == NULL))
+            break;
+        vals[i] = row[j];
+        lens[i] = lengths[j];
+    }
+
+    if (i == num)
+        name = keyEncode(vals, lens, num);
+
+    free(vals);
+    free(lens);
+
+    return name;
+}
+
+/* Returns the directory name of the row from a result set containing the
+   primary key columns */
+char *keyRowName(MYSQL sql, char *tab, MYSQL_RES *res, MYSQL_ROW row)
+{
+    char *name;
+    tKey key;
+
+    if (keyLoad(sql, tab, &key) != 0)
+        return NULL;
+
+    name = keyRowNameOf(key.cols, key.num, res, row);
+    keyFree(&key);
+
+    return name;
+}
+
+/* Pass the names of the rows of the table (matching where if set) to the
+   filler in key order, stat mode is mode. Returns the number of rows or
+   -1 on error */
+int keyListing(MYSQL sql, char *tab, char *where, mode_t mode, void *buf, fuse_fill_dir_t filler)
+{
+    unsigned long len = 0;
+    char *qry = NULL, *name;
+    struct stat st;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    int i, num = 0;
+    tKey key;
+
+    /* The key is loaded before the rows are streamed */
+    if (keyLoad(sql, tab, &key) != 0)
+        return -1;
+
+    keyAppend(&qry, &len, "SELECT ", 7);
+    for (i = 0; i < key.num; i++) {
+        if (i > 0)
+            keyAppend(&qry, &len, ",", 1);
+        keyColumn(&qry, &len, key.cols[i]);
+    }
+    keyAppend(&qry, &len, " FROM ", 6);
+    keyColumn(&qry, &len, tab);
+    if (where != NULL) {
+        keyAppend(&qry, &len, " WHERE ", 7);
+        keyAppend(&qry, &len, where, strlen(where));
+    }
+    keyAppend(&qry, &len, " ORDER BY ", 10);
+    for (i = 0; i < key.num; i++) {
+        if (i > 0)
+            keyAppend(&qry, &len, ",", 1);
+        keyColumn(&qry, &len, key.cols[i]);
+    }
+
+    DPRINTF("%s: Query is \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(&sql, qry, len) != 0)
+        || ((res = mysql_use_result(&sql)) == NULL)) {
+        DPRINTF("%s: Query failed: %s\n", __FUNCTION__, mysql_error(&sql));
+        free(qry);
+        keyFree(&key);
+        return -1;
+    }
+    free(qry);
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = mode;
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        if ((name = keyRowNameOf(key.cols, key.num, res, row)) == NULL)
+            continue;
+        if (filler != NULL)
+            filler(buf, name, &st, 0);
+        free(name);
+        num++;
+    }
+    /* A listing cut short by an error is not a shorter listing */
+    if (mysql_errno(&sql) != 0)
+        num = -1;
+    mysql_free_result(res);
+    keyFree(&key);
+
+    return num;
+}
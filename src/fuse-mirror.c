@@ -0,0 +1,1063 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Mirrors: the tables given by --mirror db.table are copied to local files
+  of --mirror-dir and their rows are read from the memory mapped copies
+  instead of the server. A file is a log of records appended by a thread
+  refreshing the copies every --mirror-interval seconds: the rows changed
+  since the last refresh are fetched using the modification time column
+  (or the new rows using the auto-increment key, rows updated by other
+  clients then show up only after a reload) as the watermark. A row count
+  differing from the copy (rows deleted elsewhere, checked every
+  MIRROR_COUNT refreshes) and every MIRROR_RELOAD refresh reload the whole
+  table, compacting the file. Writes go to the server, the rows written
+  are read from the server until a refresh returns them. The copies survive the mount and are served while the
+  server is down.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_MIRROR
+
+#ifdef DEBUG_MIRROR
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "mirror: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MIRROR_MAGIC            0x4d424446
+#define MIRROR_VERSION          1
+#define MIRROR_BUCKETS          16384
+/* Refreshes between the full reloads */
+#define MIRROR_RELOAD           60
+/* Refreshes between the row count checks */
+#define MIRROR_COUNT            10
+/* Rows changed this many seconds before the watermark are fetched again,
+   transactions committing later are caught by the reloads */
+#define MIRROR_SLACK            10
+/* Least time between two refreshes in seconds */
+#define MIRROR_MIN_INTERVAL     1
+/* Bytes of records buffered by a reload before they are written */
+#define MIRROR_FLUSH            (1024 * 1024)
+
+/* Records of the mirror file */
+#define MREC_COLUMNS            1
+#define MREC_ROW                2
+#define MREC_WATERMARK          3
+
+typedef struct tMirrorRow {
+    char *name;
+    /* Offset of the latest record of the row, 0 for none */
+    unsigned long long offset;
+    /* Generation of the write through the mount not in the copy yet */
+    unsigned int dirty;
+    struct tMirrorRow *hnext;
+} tMirrorRow;
+
+typedef struct tMirror {
+    char *db;
+    char *tab;
+    char *file;
+    int fd;
+    char *map;
+    unsigned long long mapSize;
+    unsigned long long used;
+    int numCols;
+    char **cols;
+    char *isKey;
+    /* Watermark column: modification time or auto-increment key */
+    char *mcol;
+    char *acol;
+    long long watermark;
+    int numRows;
+    int numDirty;
+    tMirrorRow **buckets;
+    /* The copy is complete and rows are read from it */
+    int serving;
+    /* The table has no watermark column */
+    int unusable;
+    int reload;
+    int refreshes;
+    unsigned int gen;
+    time_t synced;
+    pthread_rwlock_t lock;
+    struct tMirror *next;
+} tMirror;
+
+typedef struct tMirrorBuf {
+    char *data;
+    unsigned long len;
+    unsigned long alloc;
+} tMirrorBuf;
+
+static tMirror *mirrors = NULL;
+static pthread_mutex_t miMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t miCond = PTHREAD_COND_INITIALIZER;
+static pthread_t miThread;
+static volatile int miRunning = 0;
+static int miWakeup = 0;
+
+/* Add a --mirror "db.table" table */
+int mirrorParse(char *arg)
+{
+    tMirror *m;
+    char *dot;
+
+    if (((dot = strchr(arg, '.')) == NULL) || (dot == arg) || (dot[1] == 0)) {
+        fprintf(stderr, "Error: Invalid mirrored table %s\n", arg);
+        return -1;
+    }
+
+    m = (tMirror *)malloc( sizeof(tMirror) );
+    memset(m, 0, sizeof(tMirror));
+    m->db = strndup(arg, dot - arg);
+    m->tab = strdup(dot + 1);
+    m->fd = -1;
+    m->next = mirrors;
+    mirrors = m;
+
+    return 0;
+}
+
+void mirrorDump(void)
+{
+    tMirror *m;
+
+    for (m = mirrors; m != NULL; m = m->next)
+        printf("\tMirror: %s.%s\n", m->db, m->tab);
+    printf("\tMirror directory: %s, interval %d s\n", mMirrorDir, mMirrorInterval);
+}
+
+static tMirror *mirrorFind(const char *db, const char *tab)
+{
+    tMirror *m;
+
+    if ((db == NULL) || (tab == NULL))
+        return NULL;
+
+    for (m = mirrors; m != NULL; m = m->next)
+        if ((strcmp(m->db, db) == 0) && (strcmp(m->tab, tab) == 0))
+            return m;
+
+    return NULL;
+}
+
+static unsigned int mirrorHash(const char *name)
+{
+    unsigned int h = 5381;
+
+    while (*name)
+        h = (h * 33) ^ (unsigned char)*name++;
+
+    return h % MIRROR_BUCKETS;
+}
+
+/* Expects the mirror to be locked for writing if create is set */
+static tMirrorRow *mirrorRowFind(tMirror *m, const char *name, int create)
+{
+    tMirrorRow *r;
+    unsigned int h;
+
+    h = mirrorHash(name);
+    for (r = m->buckets[h]; r != NULL; r = r->hnext)
+        if (strcmp(r->name, name) == 0)
+            return r;
+
+    if (!create)
+        return NULL;
+
+    r = (tMirrorRow *)malloc( sizeof(tMirrorRow) );
+    memset(r, 0, sizeof(tMirrorRow));
+    r->name = strdup(name);
+    r->hnext = m->buckets[h];
+    m->buckets[h] = r;
+
+    return r;
+}
+
+/* Forget the rows and columns, expects the mirror to be locked for writing */
+static void mirrorClear(tMirror *m)
+{
+    tMirrorRow *r, *next;
+    int i;
+
+    for (i = 0; i < MIRROR_BUCKETS; i++) {
+        for (r = m->buckets[i]; r != NULL; r = next) {
+            next = r->hnext;
+            free(r->name);
+            free(r);
+        }
+        m->buckets[i] = NULL;
+    }
+    for (i = 0; i < m->numCols; i++)
+        free(m->cols[i]);
+    free(m->cols);
+    free(m->isKey);
+    free(m->mcol);
+    free(m->acol);
+    m->cols = NULL;
+    m->isKey = m->mcol = m->acol = NULL;
+    m->numCols = m->numRows = m->numDirty = 0;
+    m->watermark = 0;
+
+    if (m->map != NULL)
+        munmap(m->map, m->mapSize);
+    if (m->fd >= 0)
+        close(m->fd);
+    m->map = NULL;
+    m->mapSize = m->used = 0;
+    m->fd = -1;
+}
+
+static void mirrorBufPut(tMirrorBuf *b, const void *data, unsigned long len)
+{
+    if (b->len + len > b->alloc) {
+        b->alloc = (b->len + len) * 2;
+        b->data = (char *)realloc(b->data, b->alloc);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void mirrorBufString(tMirrorBuf *b, const char *str)
+{
+    mirrorBufPut(b, str ? str : "", strlen(str ? str : "") + 1);
+}
+
+/* Start a record, its length is set by mirrorBufEnd() */
+static unsigned long mirrorBufBegin(tMirrorBuf *b, unsigned char op)
+{
+    unsigned int len = 0;
+    unsigned long start = b->len;
+
+    mirrorBufPut(b, &len, sizeof(len));
+    mirrorBufPut(b, &op, 1);
+
+    return start;
+}
+
+static void mirrorBufEnd(tMirrorBuf *b, unsigned long start)
+{
+    unsigned int len = b->len - start - sizeof(unsigned int);
+
+    memcpy(b->data + start, &len, sizeof(len));
+}
+
+/* Map the file up to its used part, expects the mirror to be locked for
+   writing */
+static int mirrorMap(tMirror *m)
+{
+    unsigned long long size;
+
+    if ((m->map != NULL) && (m->used <= m->mapSize))
+        return 0;
+
+    if (m->map != NULL)
+        munmap(m->map, m->mapSize);
+    /* Room for the appended records, the pages past the end of the file
+       are never touched */
+    size = (m->used * 2 + 1048575) & ~1048575ULL;
+    if ((m->map = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, m->fd, 0)) == MAP_FAILED) {
+        m->map = NULL;
+        m->mapSize = 0;
+        return -1;
+    }
+    m->mapSize = size;
+
+    return 0;
+}
+
+static char *mirrorString(char *rec, unsigned int len, unsigned int *pos)
+{
+    char *str = rec + *pos;
+
+    if ((*pos >= len) || (memchr(str, 0, len - *pos) == NULL))
+        return NULL;
+    *pos += strlen(str) + 1;
+
+    return str;
+}
+
+/* Skip the values of a row record, returns -1 if it is damaged */
+static int mirrorSkipValues(tMirror *m, char *rec, unsigned int len, unsigned int *pos)
+{
+    int i, vlen;
+
+    for (i = 0; i < m->numCols; i++) {
+        if (*pos + sizeof(int) > len)
+            return -1;
+        memcpy(&vlen, rec + *pos, sizeof(int));
+        *pos += sizeof(int);
+        if (vlen > 0) {
+            if (*pos + vlen > len)
+                return -1;
+            *pos += vlen;
+        }
+    }
+
+    return 0;
+}
+
+/* Apply the records of the file from offset on, a damaged tail left by a
+   crash is cut off. Expects the mirror to be locked for writing */
+static void mirrorReplay(tMirror *m, unsigned long long offset)
+{
+    unsigned int len, pos, num, i;
+    tMirrorRow *r;
+    char *rec, *name;
+    long long val;
+
+    while (offset + sizeof(unsigned int) + 1 <= m->used) {
+        memcpy(&len, m->map + offset, sizeof(len));
+        if ((len < 1) || (offset + sizeof(len) + len > m->used))
+            break;
+        rec = m->map + offset + sizeof(len);
+        pos = 1;
+
+        if (rec[0] == MREC_COLUMNS) {
+            if ((m->cols != NULL) || (pos + sizeof(num) > len))
+                break;
+            memcpy(&num, rec + pos, sizeof(num));
+            pos += sizeof(num);
+            if (num > len)
+                break;
+            for (i = 0; i < num; i++)
+                if (mirrorString(rec, len, &pos) == NULL)
+                    break;
+            if ((i < num) || (pos + num > len))
+                break;
+
+            pos = 1 + sizeof(num);
+            m->cols = (char **)malloc( num * sizeof(char *) );
+            m->isKey = (char *)malloc( num );
+            m->numCols = num;
+            for (i = 0; i < num; i++)
+                m->cols[i] = strdup(mirrorString(rec, len, &pos));
+            memcpy(m->isKey, rec + pos, num);
+            pos += num;
+            if (((name = mirrorString(rec, len, &pos)) != NULL) && (*name != 0))
+                m->mcol = strdup(name);
+            if (((name = mirrorString(rec, len, &pos)) != NULL) && (*name != 0))
+                m->acol = strdup(name);
+        }
+        else
+        if (rec[0] == MREC_ROW) {
+            pos += sizeof(long long);
+            if ((m->cols == NULL) || (pos > len) || ((name = mirrorString(rec, len, &pos)) == NULL)
+                || (mirrorSkipValues(m, rec, len, &pos) != 0))
+                break;
+            if ((r = mirrorRowFind(m, name, 1))->offset == 0)
+                m->numRows++;
+            r->offset = offset;
+        }
+        else
+        if (rec[0] == MREC_WATERMARK) {
+            if (pos + sizeof(val) > len)
+                break;
+            memcpy(&val, rec + pos, sizeof(val));
+            m->watermark = val;
+        }
+        else
+            break;
+
+        offset += sizeof(len) + len;
+    }
+
+    if (offset < m->used) {
+        fprintf(stderr, "Warning: Mirror file %s is damaged at %llu, cutting it off\n", m->file, offset);
+        m->used = offset;
+        if (ftruncate(m->fd, offset) != 0)
+            m->reload = 1;
+    }
+}
+
+/* Open the file and load the rows it holds, expects the mirror to be
+   locked for writing */
+static int mirrorLoad(tMirror *m)
+{
+    unsigned int hdr[2] = { MIRROR_MAGIC, MIRROR_VERSION };
+    struct stat st;
+
+    mirrorClear(m);
+    if ((m->fd = open(m->file, O_RDWR | O_CREAT, 0600)) < 0) {
+        fprintf(stderr, "Error: Cannot open mirror file %s: %s\n", m->file, strerror(errno));
+        return -1;
+    }
+
+    if ((fstat(m->fd, &st) != 0) || (st.st_size < (off_t)sizeof(hdr))) {
+        if ((ftruncate(m->fd, 0) != 0) || (pwrite(m->fd, hdr, sizeof(hdr), 0) != sizeof(hdr)))
+            return -1;
+        m->used = sizeof(hdr);
+    }
+    else
+        m->used = st.st_size;
+
+    if (mirrorMap(m) != 0)
+        return -1;
+    if (memcmp(m->map, hdr, sizeof(hdr)) != 0) {
+        fprintf(stderr, "Warning: Mirror file %s is of another version, reloading\n", m->file);
+        m->used = sizeof(hdr);
+        if ((ftruncate(m->fd, 0) != 0) || (pwrite(m->fd, hdr, sizeof(hdr), 0) != sizeof(hdr)))
+            return -1;
+    }
+
+    mirrorReplay(m, sizeof(hdr));
+    DPRINTF("%s: Loaded %d rows of %s.%s\n", __FUNCTION__, m->numRows, m->db, m->tab);
+
+    return 0;
+}
+
+/* Append the records to the file and apply them, expects the mirror to be
+   locked for writing */
+static int mirrorAppend(tMirror *m, tMirrorBuf *b)
+{
+    unsigned long long offset = m->used;
+
+    if (b->len == 0)
+        return 0;
+    if (pwrite(m->fd, b->data, b->len, offset) != (ssize_t)b->len) {
+        fprintf(stderr, "Warning: Cannot append to mirror file %s: %s\n", m->file, strerror(errno));
+        return -1;
+    }
+    m->used += b->len;
+    if (mirrorMap(m) != 0)
+        return -1;
+    mirrorReplay(m, offset);
+
+    return 0;
+}
+
+/* Encode the row of the result as a record, the extra trailing field is
+   the modification time if the table has a modification time column */
+static void mirrorEncodeRow(tMirror *m, tMirrorBuf *b, MYSQL_RES *res, MYSQL_ROW row, char *name)
+{
+    unsigned long *lengths;
+    unsigned long start;
+    long long mtime = 0;
+    int i, vlen;
+
+    lengths = mysql_fetch_lengths(res);
+    if ((m->mcol != NULL) && (row[m->numCols] != NULL))
+        mtime = atoll(row[m->numCols]);
+
+    start = mirrorBufBegin(b, MREC_ROW);
+    mirrorBufPut(b, &mtime, sizeof(mtime));
+    mirrorBufString(b, name);
+    for (i = 0; i < m->numCols; i++) {
+        vlen = (row[i] != NULL) ? (int)lengths[i] : -1;
+        mirrorBufPut(b, &vlen, sizeof(vlen));
+        if (vlen > 0)
+            mirrorBufPut(b, row[i], vlen);
+    }
+    mirrorBufEnd(b, start);
+}
+
+/* Returns 1 if the latest record of the row equals the encoded one */
+static int mirrorUnchanged(tMirror *m, char *name, tMirrorBuf *b, unsigned long start)
+{
+    unsigned int len;
+    tMirrorRow *r;
+
+    if (((r = mirrorRowFind(m, name, 0)) == NULL) || (r->offset == 0))
+        return 0;
+
+    memcpy(&len, m->map + r->offset, sizeof(len));
+    return ((len + sizeof(len) == b->len - start)
+            && (memcmp(m->map + r->offset, b->data + start, b->len - start) == 0)) ? 1 : 0;
+}
+
+/* Returns 1 if the fields of the result are the mirrored columns */
+static int mirrorSameColumns(tMirror *m, MYSQL_RES *res)
+{
+    MYSQL_FIELD *fields;
+    int i;
+
+    if (mysql_num_fields(res) != (unsigned int)(m->numCols + (m->mcol ? 1 : 0)))
+        return 0;
+
+    fields = mysql_fetch_fields(res);
+    for (i = 0; i < m->numCols; i++)
+        if (strcmp(fields[i].name, m->cols[i]) != 0)
+            return 0;
+
+    return 1;
+}
+
+static long long mirrorWatermark(tMirror *m, MYSQL_ROW row, long long wm)
+{
+    long long val;
+    int i;
+
+    if (m->mcol != NULL)
+        val = (row[m->numCols] != NULL) ? atoll(row[m->numCols]) : 0;
+    else {
+        for (i = 0; (i < m->numCols) && (strcmp(m->cols[i], m->acol) != 0); i++)
+            ;
+        val = ((i < m->numCols) && (row[i] != NULL)) ? atoll(row[i]) : 0;
+    }
+
+    return (val > wm) ? val : wm;
+}
+
+/* Copy the whole table to a new file replacing the old one */
+/* Resolve the primary key of the table, the rows are named by it. Returns
+   the number of the key columns or -1 */
+static int mirrorKeys(tMirror *m, MYSQL *conn, char ***keys)
+{
+    char **types;
+    int num, i;
+
+    num = catalogPrimaryKeys(*conn, m->db, m->tab, keys, &types);
+    for (i = 0; i < num; i++)
+        free(types[i]);
+    free(types);
+    if (num <= 0) {
+        free(*keys);
+        *keys = NULL;
+        return -1;
+    }
+
+    return num;
+}
+
+static void mirrorFreeKeys(char **keys, int num)
+{
+    int i;
+
+    for (i = 0; i < num; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+/* Write the complete records of the buffer to the file and empty it */
+static int mirrorBufFlush(tMirrorBuf *b, int fd)
+{
+    if ((b->len > 0) && (write(fd, b->data, b->len) != (ssize_t)b->len))
+        return -1;
+    b->len = 0;
+
+    return 0;
+}
+
+static int mirrorReload(tMirror *m, MYSQL *conn)
+{
+    char qry[1024], tmp[1040], *mcol, *acol = NULL, *name, **keys;
+    unsigned int hdr[2] = { MIRROR_MAGIC, MIRROR_VERSION };
+    unsigned int num, i, gen;
+    MYSQL_FIELD *fields;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    tMirrorBuf b;
+    long long wm = 0;
+    unsigned long start;
+    tMirror t;
+    int fd, numKeys, ret = -1;
+
+    pthread_rwlock_rdlock(&m->lock);
+    gen = m->gen;
+    pthread_rwlock_unlock(&m->lock);
+
+    /* The rows are streamed, the table may be larger than the memory of
+       the server for the result. No query may run on the connection until
+       the stream ends, the key and the columns are resolved before */
+    if ((numKeys = mirrorKeys(m, conn, &keys)) < 0) {
+        DPRINTF("%s: No primary key of %s.%s\n", __FUNCTION__, m->db, m->tab);
+        return -1;
+    }
+    mcol = catalogMtimeColumn(*conn, m->db, m->tab);
+    snprintf(qry, sizeof(qry), "SELECT *%s%s%s FROM `%s`",
+             mcol ? ", UNIX_TIMESTAMP(`" : "", mcol ? mcol : "", mcol ? "`)" : "", m->tab);
+    DPRINTF("%s: Reloading using \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(conn, qry, strlen(qry)) != 0) || ((res = mysql_use_result(conn)) == NULL)) {
+        DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(conn));
+        mirrorFreeKeys(keys, numKeys);
+        free(mcol);
+        return -1;
+    }
+
+    num = mysql_num_fields(res) - (mcol ? 1 : 0);
+    fields = mysql_fetch_fields(res);
+    for (i = 0; (i < num) && (mcol == NULL); i++)
+        if ((fields[i].flags & AUTO_INCREMENT_FLAG) && (fields[i].flags & PRI_KEY_FLAG))
+            acol = fields[i].name;
+    if ((mcol == NULL) && (acol == NULL)) {
+        fprintf(stderr, "Warning: Table %s.%s has no modification time column nor auto-increment "
+                        "key, it is not mirrored\n", m->db, m->tab);
+        mysql_free_result(res);
+        mirrorFreeKeys(keys, numKeys);
+        m->unusable = 1;
+        return -1;
+    }
+
+    /* The old copy is served until the new one is complete */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", m->file);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+        fprintf(stderr, "Warning: Cannot write mirror file %s: %s\n", tmp, strerror(errno));
+        mysql_free_result(res);
+        mirrorFreeKeys(keys, numKeys);
+        free(mcol);
+        return -1;
+    }
+
+    /* The rows are encoded as the records of a copy of the mirror, written
+       out as the buffer fills */
+    memset(&t, 0, sizeof(t));
+    t.numCols = num;
+    t.mcol = mcol;
+    t.acol = acol;
+    memset(&b, 0, sizeof(b));
+    mirrorBufPut(&b, hdr, sizeof(hdr));
+    start = mirrorBufBegin(&b, MREC_COLUMNS);
+    mirrorBufPut(&b, &num, sizeof(num));
+    for (i = 0; i < num; i++)
+        mirrorBufString(&b, fields[i].name);
+    for (i = 0; i < num; i++)
+        mirrorBufPut(&b, (fields[i].flags & PRI_KEY_FLAG) ? "\1" : "\0", 1);
+    mirrorBufString(&b, mcol);
+    mirrorBufString(&b, acol);
+    mirrorBufEnd(&b, start);
+
+    t.cols = (char **)malloc( num * sizeof(char *) );
+    for (i = 0; i < num; i++)
+        t.cols[i] = fields[i].name;
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        /* A row missing from the copy would be served as deleted */
+        if ((name = keyRowNameOf(keys, numKeys, res, row)) == NULL) {
+            DPRINTF("%s: Row of %s.%s has no name\n", __FUNCTION__, m->db, m->tab);
+            break;
+        }
+        mirrorEncodeRow(&t, &b, res, row, name);
+        wm = mirrorWatermark(&t, row, wm);
+        free(name);
+        if ((b.len >= MIRROR_FLUSH) && (mirrorBufFlush(&b, fd) != 0))
+            break;
+    }
+    free(t.cols);
+    if ((row != NULL) || (mysql_errno(conn) != 0)) {
+        if (row == NULL)
+            DPRINTF("%s: Reading the rows failed: %s\n", __FUNCTION__, mysql_error(conn));
+        /* Rest of the stream is discarded by freeing the result */
+        mysql_free_result(res);
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    mysql_free_result(res);
+
+    start = mirrorBufBegin(&b, MREC_WATERMARK);
+    mirrorBufPut(&b, &wm, sizeof(wm));
+    mirrorBufEnd(&b, start);
+
+    if ((mirrorBufFlush(&b, fd) != 0) || (close(fd) != 0) || (rename(tmp, m->file) != 0)) {
+        fprintf(stderr, "Warning: Cannot write mirror file %s: %s\n", tmp, strerror(errno));
+        unlink(tmp);
+        goto out;
+    }
+
+    pthread_rwlock_wrlock(&m->lock);
+    if (mirrorLoad(m) == 0) {
+        /* Writes through the mount during the reload may be missing */
+        m->serving = (m->gen == gen) ? 1 : 0;
+        m->reload = !m->serving;
+        m->synced = time(NULL);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&m->lock);
+
+    DPRINTF("%s: Reloaded %d rows of %s.%s\n", __FUNCTION__, m->numRows, m->db, m->tab);
+
+out:
+    free(b.data);
+    mirrorFreeKeys(keys, numKeys);
+    free(mcol);
+    return ret;
+}
+
+/* Clear the rows written through the mount before the refresh started
+   and returned by it, expects the mirror to be locked for writing */
+static void mirrorClean(tMirror *m, unsigned int gen, char **names, int num)
+{
+    tMirrorRow *r;
+    int i;
+
+    for (i = 0; (i < num) && (m->numDirty > 0); i++)
+        if (((r = mirrorRowFind(m, names[i], 0)) != NULL) && (r->dirty) && (r->dirty <= gen)) {
+            r->dirty = 0;
+            m->numDirty--;
+        }
+}
+
+/* Fetch the rows past the watermark, returns -1 if the table has to be
+   reloaded */
+static int mirrorRefresh(tMirror *m, MYSQL *conn)
+{
+    char qry[1024], *name, *tmp, **names = NULL;
+    int count, i, num = 0, alloc = 0;
+    unsigned long start;
+    unsigned int gen;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    tMirrorBuf b;
+    long long wm;
+
+    pthread_rwlock_rdlock(&m->lock);
+    gen = m->gen;
+    wm = m->watermark;
+    if (m->mcol != NULL)
+        snprintf(qry, sizeof(qry), "SELECT *, UNIX_TIMESTAMP(`%s`) FROM `%s` WHERE `%s` >= FROM_UNIXTIME(%lld)",
+                 m->mcol, m->tab, m->mcol, (wm > MIRROR_SLACK) ? wm - MIRROR_SLACK : 0);
+    else
+        snprintf(qry, sizeof(qry), "SELECT * FROM `%s` WHERE `%s` > %lld", m->tab, m->acol, wm);
+    pthread_rwlock_unlock(&m->lock);
+
+    DPRINTF("%s: Refreshing using \"%s\"\n", __FUNCTION__, qry);
+    if ((mysql_real_query(conn, qry, strlen(qry)) != 0) || ((res = mysql_store_result(conn)) == NULL))
+        return -1;
+
+    /* Only this thread appends, the rows are compared holding the read
+       lock */
+    memset(&b, 0, sizeof(b));
+    pthread_rwlock_rdlock(&m->lock);
+    if (!mirrorSameColumns(m, res)) {
+        pthread_rwlock_unlock(&m->lock);
+        mysql_free_result(res);
+        return -1;
+    }
+    while ((row = mysql_fetch_row(res)) != NULL) {
+        if ((name = keyRowName(*conn, m->tab, res, row)) == NULL)
+            break;
+        start = b.len;
+        mirrorEncodeRow(m, &b, res, row, name);
+        /* Rows within the slack come again and again */
+        if (mirrorUnchanged(m, name, &b, start))
+            b.len = start;
+        wm = mirrorWatermark(m, row, wm);
+        if (num == alloc) {
+            alloc = (alloc > 0) ? alloc * 2 : 64;
+            names = (char **)realloc(names, alloc * sizeof(char *));
+        }
+        names[num++] = name;
+    }
+    mysql_free_result(res);
+    pthread_rwlock_unlock(&m->lock);
+    if (row != NULL) {
+        free(b.data);
+        for (i = 0; i < num; i++)
+            free(names[i]);
+        free(names);
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&m->lock);
+    if (wm != m->watermark) {
+        start = mirrorBufBegin(&b, MREC_WATERMARK);
+        mirrorBufPut(&b, &wm, sizeof(wm));
+        mirrorBufEnd(&b, start);
+    }
+    if (mirrorAppend(m, &b) != 0) {
+        pthread_rwlock_unlock(&m->lock);
+        free(b.data);
+        for (i = 0; i < num; i++)
+            free(names[i]);
+        free(names);
+        return -1;
+    }
+    /* The rows fetched have the changes made before the refresh, rows not
+       fetched are still read from the server (the modification time may
+       not be updated by the server) */
+    mirrorClean(m, gen, names, num);
+    m->synced = time(NULL);
+    count = m->numRows;
+    pthread_rwlock_unlock(&m->lock);
+    free(b.data);
+    for (i = 0; i < num; i++)
+        free(names[i]);
+    free(names);
+
+    /* Rows deleted elsewhere are not seen by the watermark, counting them
+       scans the table so it is done only every MIRROR_COUNT refreshes */
+    if (m->refreshes % MIRROR_COUNT != 0)
+        return 0;
+    snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM `%s`", m->tab);
+    if (((tmp = getValue(*conn, qry, "0", NULL)) == NULL) || (atoi(tmp) != count)) {
+        DPRINTF("%s: Row count of %s.%s changed\n", __FUNCTION__, m->db, m->tab);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mirrorSync(tMirror *m, MYSQL **conns)
+{
+    MYSQL *conn;
+    int reload;
+
+    if (m->unusable)
+        return;
+    if ((conn = routeConnection(conns, m->db)) == NULL)
+        return;
+    if (mysql_select_db(conn, m->db) != 0)
+        return;
+
+    pthread_rwlock_rdlock(&m->lock);
+    reload = (m->reload) || (!m->serving) || (m->cols == NULL) || (++m->refreshes % MIRROR_RELOAD == 0);
+    pthread_rwlock_unlock(&m->lock);
+
+    if ((reload) || (mirrorRefresh(m, conn) != 0))
+        mirrorReload(m, conn);
+}
+
+static void *mirrorThread(void *arg)
+{
+    struct timespec ts;
+    MYSQL **conns;
+    tMirror *m;
+    (void) arg;
+
+    mysql_thread_init();
+    conns = (MYSQL **)calloc(routeServers(), sizeof(MYSQL *));
+    while (miRunning) {
+        for (m = mirrors; (m != NULL) && (miRunning); m = m->next)
+            mirrorSync(m, conns);
+
+        /* Writes wake the thread, but not more often than once a second */
+        sleep(MIRROR_MIN_INTERVAL);
+        pthread_mutex_lock(&miMutex);
+        ts.tv_sec = time(NULL) + ((mMirrorInterval > MIRROR_MIN_INTERVAL) ? mMirrorInterval - MIRROR_MIN_INTERVAL : 0);
+        ts.tv_nsec = 0;
+        while ((miRunning) && (!miWakeup)
+               && (pthread_cond_timedwait(&miCond, &miMutex, &ts) != ETIMEDOUT))
+            ;
+        miWakeup = 0;
+        pthread_mutex_unlock(&miMutex);
+    }
+
+    routeCloseConnections(conns);
+    free(conns);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+/* Load the copies and start the refreshing thread */
+int mirrorStart(void)
+{
+    char *p;
+    tMirror *m;
+    int len, size;
+
+    if (mirrors == NULL)
+        return 0;
+    /* The copies are not of the snapshot */
+    if (snapshotEnabled()) {
+        fprintf(stderr, "Warning: Mirrors are disabled in snapshot mode\n");
+        return 0;
+    }
+
+    for (m = mirrors; m != NULL; m = m->next) {
+        size = strlen(mMirrorDir) + strlen(mUser) + strlen(mServer) + strlen(m->db) + strlen(m->tab) + 16;
+        m->file = (char *)malloc( size );
+        len = snprintf(m->file, size, "%s/", mMirrorDir);
+        snprintf(m->file + len, size - len, "%s@%s-%s.%s.mirror", mUser, mServer, m->db, m->tab);
+        for (p = m->file + len; *p; p++)
+            if (*p == '/')
+                *p = '_';
+
+        m->buckets = (tMirrorRow **)calloc(MIRROR_BUCKETS, sizeof(tMirrorRow *));
+        pthread_rwlock_init(&m->lock, NULL);
+        pthread_rwlock_wrlock(&m->lock);
+        /* The copy of the previous mount is served until refreshed */
+        if ((mirrorLoad(m) == 0) && (m->cols != NULL)) {
+            m->serving = 1;
+            m->synced = time(NULL);
+        }
+        pthread_rwlock_unlock(&m->lock);
+    }
+
+    miRunning = 1;
+    if (pthread_create(&miThread, NULL, mirrorThread, NULL) != 0) {
+        fprintf(stderr, "Error: Cannot start the mirror thread\n");
+        miRunning = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void mirrorStop(void)
+{
+    if (!miRunning)
+        return;
+
+    pthread_mutex_lock(&miMutex);
+    miRunning = 0;
+    pthread_cond_signal(&miCond);
+    pthread_mutex_unlock(&miMutex);
+    pthread_join(miThread, NULL);
+}
+
+/* Returns the mirror serving the table, locked for reading */
+static tMirror *mirrorAcquire(const char *db, const char *tab)
+{
+    tMirror *m;
+
+    if ((!miRunning) || ((m = mirrorFind(db, tab)) == NULL))
+        return NULL;
+
+    pthread_rwlock_rdlock(&m->lock);
+    if (!m->serving) {
+        pthread_rwlock_unlock(&m->lock);
+        return NULL;
+    }
+
+    return m;
+}
+
+/* Copy the row to the arrays allocated for the caller. Returns 1 if the
+   row is found, -1 if the server has to be asked (the table is not
+   mirrored, the row has been written or has no copy, the name may match
+   a row spelled differently) */
+int mirrorRow(const char *db, const char *tab, const char *name, int *numFields, char ***names,
+              char **isKey, char ***values, unsigned long **lengths, time_t *mtime)
+{
+    unsigned int len, pos;
+    long long rowMtime;
+    tMirrorRow *r;
+    tMirror *m;
+    char *rec;
+    int i, vlen;
+
+    if ((m = mirrorAcquire(db, tab)) == NULL)
+        return -1;
+
+    if (((r = mirrorRowFind(m, name, 0)) == NULL) || (r->dirty) || (r->offset == 0)) {
+        pthread_rwlock_unlock(&m->lock);
+        return -1;
+    }
+
+    memcpy(&len, m->map + r->offset, sizeof(len));
+    rec = m->map + r->offset + sizeof(len);
+    memcpy(&rowMtime, rec + 1, sizeof(rowMtime));
+    pos = 1 + sizeof(rowMtime);
+    mirrorString(rec, len, &pos);
+
+    *numFields = m->numCols;
+    *names = (char **)malloc( m->numCols * sizeof(char *) );
+    *values = (char **)malloc( m->numCols * sizeof(char *) );
+    *lengths = (unsigned long *)malloc( m->numCols * sizeof(unsigned long) );
+    *isKey = (char *)malloc( m->numCols * sizeof(char) );
+    for (i = 0; i < m->numCols; i++) {
+        (*names)[i] = strdup(m->cols[i]);
+        (*isKey)[i] = m->isKey[i];
+        memcpy(&vlen, rec + pos, sizeof(int));
+        pos += sizeof(int);
+        (*lengths)[i] = (vlen > 0) ? vlen : 0;
+        (*values)[i] = NULL;
+        if (vlen >= 0) {
+            (*values)[i] = (char *)malloc( vlen + 1 );
+            memcpy((*values)[i], rec + pos, vlen);
+            (*values)[i][vlen] = 0;
+            pos += vlen;
+        }
+    }
+    *mtime = (rowMtime > 0) ? rowMtime : m->synced;
+    pthread_rwlock_unlock(&m->lock);
+
+    return 1;
+}
+
+/* Pass the rows of the table to the filler, returns -1 if the server has
+   to be asked */
+int mirrorListing(const char *db, const char *tab, void *buf, fuse_fill_dir_t filler)
+{
+    struct stat st;
+    tMirrorRow *r;
+    tMirror *m;
+    int i;
+
+    if ((m = mirrorAcquire(db, tab)) == NULL)
+        return -1;
+    /* Rows written may have been deleted */
+    if (m->numDirty > 0) {
+        pthread_rwlock_unlock(&m->lock);
+        return -1;
+    }
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    for (i = 0; i < MIRROR_BUCKETS; i++)
+        for (r = m->buckets[i]; r != NULL; r = r->hnext)
+            if (r->offset != 0)
+                filler(buf, r->name, &st, 0);
+    pthread_rwlock_unlock(&m->lock);
+
+    return 0;
+}
+
+/* Returns the number of rows of the table or -1 */
+int mirrorRows(const char *db, const char *tab)
+{
+    tMirror *m;
+    int num;
+
+    if ((m = mirrorAcquire(db, tab)) == NULL)
+        return -1;
+    num = (m->numDirty > 0) ? -1 : m->numRows;
+    pthread_rwlock_unlock(&m->lock);
+
+    return num;
+}
+
+static void mirrorWrite(tMirror *m, const char *name)
+{
+    tMirrorRow *r;
+
+    pthread_rwlock_wrlock(&m->lock);
+    m->gen++;
+    /* Only the modification time tells the rows updated */
+    if ((name == NULL) || (m->mcol == NULL)) {
+        m->serving = 0;
+        m->reload = 1;
+    }
+    else {
+        r = mirrorRowFind(m, name, 1);
+        if (!r->dirty)
+            m->numDirty++;
+        r->dirty = m->gen;
+    }
+    pthread_rwlock_unlock(&m->lock);
+}
+
+/* The row (all rows if name is NULL) has been written through the mount,
+   it is read from the server until the copy has the change */
+void mirrorInvalidate(const char *db, const char *tab, const char *name)
+{
+    tMirror *m;
+    int found = 0;
+
+    if (!miRunning)
+        return;
+
+    for (m = mirrors; m != NULL; m = m->next)
+        if (((db == NULL) || (strcmp(m->db, db) == 0)) && ((tab == NULL) || (strcmp(m->tab, tab) == 0))) {
+            mirrorWrite(m, name);
+            found = 1;
+        }
+
+    if (found) {
+        pthread_mutex_lock(&miMutex);
+        miWakeup = 1;
+        pthread_cond_signal(&miCond);
+        pthread_mutex_unlock(&miMutex);
+    }
+}
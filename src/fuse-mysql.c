@@ -66,7 +66,11 @@ int getFieldNumber(MYSQL sql, char *qry, char *fieldName) {
     return ret;
 }
 
-char *getValue(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRows) {
+/* Like getValue() with the error number of the failed query stored to
+   error, which is left as it is if the query succeeds so the first error
+   of the queries of an operation is kept */
+char *getValueError(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRows,
+                    int *error) {
     MYSQL_RES *res;
     MYSQL_ROW row;
     char *val, *endptr;
@@ -108,10 +112,16 @@ char *getValue(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRow
     if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
         DPRINTF("%s: Query '%s' failed: %s", __FUNCTION__, qry,
                 mysql_error(&sql));
+        if (error != NULL)
+            *error = mysql_errno(&sql);
         return NULL;
     }
 
-    res = mysql_store_result(&sql);
+    if ((res = mysql_store_result(&sql)) == NULL) {
+        if (error != NULL)
+            *error = mysql_errno(&sql);
+        return NULL;
+    }
     rowCount = mysql_num_rows(res);
     if (numRows != NULL)
         *numRows = rowCount;
@@ -140,49 +150,34 @@ char *getValue(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRow
     return val;
 }
 
-char *getPrimaryKeyName(MYSQL sql, char *table, int *error) {
-    int size, field_key, field_name;
-    MYSQL_ROW row;
-    MYSQL_RES *res;
-    char *qry, *val = NULL;
-
-    if (error != NULL)
-        *error = 0;
-
-    size = (strlen(table) + 18);
-    qry = (char *)malloc( size * sizeof(char));
-    snprintf(qry, size, "SHOW FIELDS FROM %s", table);
-
-    DPRINTF("%s: Query is \"%s\"", __FUNCTION__, qry);
-    if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
-        DPRINTF("%s: Error #%d = \"%s\"", __FUNCTION__,
-                mysql_errno(&sql), mysql_error(&sql));
-        if (error != NULL)
-            *error = mysql_errno(&sql);
-        return NULL;
-    }
+char *getValue(MYSQL sql, char *qry, char *fieldName, unsigned long long *numRows) {
+    return getValueError(sql, qry, fieldName, numRows, NULL);
+}
 
-    res = mysql_store_result(&sql);
-    field_key = getFieldNumber(sql, qry, "Key");
-    field_name = getFieldNumber(sql, qry, "Field");
-    DPRINTF("%s: Name field idx = %d, key field idx = %d", __FUNCTION__,
-            field_name, field_key);
-    if ((field_key < 0) || (field_name < 0)) {
-        mysql_free_result(res);
-        return NULL;
-    }
+char *getPrimaryKeyName(MYSQL sql, char *table, int *error) {
+    char *val;
 
-    while ((row = mysql_fetch_row(res)))
-        if (strcmp(row[field_key], "PRI") == 0) {
-            val = row[field_name];
-            break;
-        }
+    /* The column list is cached by the catalog, sql.db is the database
+       selected by the caller */
+    val = catalogPrimaryKey(sql, sql.db, table, error);
 
     DPRINTF("%s: Primary key for \"%s\" is found in \"%s\" column", __FUNCTION__, table, val);
-    mysql_free_result(res);
     return val;
 }
 
+/* Returns 1 if the result of the operation can be trusted: the server is
+   not offline (the queries run on an unconnected handle), no query has
+   been killed and err, the error the queries of the operation reported,
+   is none or the table or database is missing */
+int queryVerified(int err)
+{
+    if ((routeOffline()) || (deadlineFired()))
+        return 0;
+
+    return ((err == 0) || (err == 1146) || (err == 1049)) ? 1 : 0;
+}
+
+
 int getSize(MYSQL sql, char *path, int *error) {
     char *db, *tab, *tmp, *pk, *pkVal;
     char qry[2048] = { 0 };
@@ -197,6 +192,7 @@ int getSize(MYSQL sql, char *path, int *error) {
         mysql_select_db(&sql, db);
         pk = getPrimaryKeyName(sql, tab, &err);
         DPRINTF("%s: Primary key for table \"%s\" is \"%s\"", __FUNCTION__, tab, pk);
+        free(pk);
     }
 
     if (error != NULL)
@@ -205,8 +201,11 @@ int getSize(MYSQL sql, char *path, int *error) {
     DPRINTF("%s: Path = %s, level = %d (err = %d)", __FUNCTION__, path, level, err);
 
     if (level == 0) { /* Get number of databases */
+      if (routeServers() > 1)
+          return routeListing(NULL, NULL);
+
       snprintf(qry, sizeof(qry), "SHOW DATABASES");
-      if (getValue(sql, qry, "0", &nr) == NULL)
+      if (getValueError(sql, qry, "0", &nr, error) == NULL)
           return 0;
 
       return nr;
@@ -214,15 +213,20 @@ int getSize(MYSQL sql, char *path, int *error) {
     else
     if (level == 1) { /* Get number of tables in the database */
         snprintf(qry, sizeof(qry), "SHOW TABLES");
-        if (getValue(sql, qry, "0", &nr) == NULL)
+        if (getValueError(sql, qry, "0", &nr, error) == NULL)
             return 0;
 
         return nr;
     }
     else
     if (level == 2) { /* Get number of entries in the table */
+        int rows;
+
+        if ((rows = mirrorRows(db, tab)) >= 0)
+            return rows;
+
         snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM %s", tab);
-        tmp = getValue(sql, qry, "0", NULL);
+        tmp = getValueError(sql, qry, "0", NULL, error);
         if (tmp == NULL)
             return 0;
 
@@ -231,20 +235,42 @@ int getSize(MYSQL sql, char *path, int *error) {
     else
     if (level == 3) { /* Get number of fields in the table */
         snprintf(qry, sizeof(qry), "SHOW FIELDS FROM %s", tab);
-        if (getValue(sql, qry, "0", &nr) == NULL)
+        if (getValueError(sql, qry, "0", &nr, error) == NULL)
             return 0;
 
         return nr;
     }
     else
     if (level == 4) { /* Get size of the "data" */
+        char *where;
         int ret;
 
-        snprintf(qry, sizeof(qry), "SELECT `%s` FROM %s WHERE `%s` = '%s'",
-                 getPathComponent(path, 3), tab, pk, pkVal);
+        if ((where = keyWhere(sql, tab, pkVal)) == NULL)
+            return 0;
+
+        /* The header of a compressed value holds the size */
+        if (compressPath(path)) {
+            long size;
+
+            snprintf(qry, sizeof(qry), "SELECT LEFT(`%s`, 32), LENGTH(`%s`) FROM `%s` WHERE %s",
+                     getPathComponent(path, 3), getPathComponent(path, 3), tab, where);
+            free(where);
+            DPRINTF("%s: Querying compressed size \"%s\"", __FUNCTION__, qry);
+
+            if ((tmp = getValueError(sql, qry, "0l1", &nr, error)) == NULL)
+                return 0;
+            size = compressLength(tmp, nr);
+            free(tmp);
+
+            return (size >= 0) ? size + 1 : nr + 1;
+        }
+
+        snprintf(qry, sizeof(qry), "SELECT `%s` FROM `%s` WHERE %s",
+                 getPathComponent(path, 3), tab, where);
+        free(where);
         DPRINTF("%s: Querying size \"%s\"", __FUNCTION__, qry);
 
-        if ((tmp = getValue(sql, qry, "0", NULL)) != NULL) {
+        if ((tmp = getValueError(sql, qry, "0", NULL, error)) != NULL) {
             DPRINTF("%s: Size query returned \"%s\"", __FUNCTION__, tmp);
             ret = strlen(tmp) + 1;
          }
@@ -301,7 +327,10 @@ int getMySQLResults(MYSQL sql, char *qry, char *field, fuse_fill_dir_t filler, v
         return -1;
     }
 
-    res = mysql_store_result(&sql);
+    if ((res = mysql_store_result(&sql)) == NULL) {
+        free(fField);
+        return -1;
+    }
     num = mysql_num_rows(res);
 
     if ((filler != NULL) && (fField != NULL)) {
@@ -332,12 +361,12 @@ int getMySQLResults(MYSQL sql, char *qry, char *field, fuse_fill_dir_t filler, v
 
 int isReadOnly(MYSQL sql, const char *path, char *tab)
 {
-    char *pk, *fn;
+    char *fn;
 
+    /* Primary key columns name the row directory */
     fn = getPathComponent( (char *)path, 3);
-    pk = getPrimaryKeyName(sql, tab, NULL);
 
-    return (strcmp(fn, pk) == 0) ? 1 : 0;
+    return keyIsColumn(sql, tab, fn);
 }
 
 int getType(char *path, int *error) {
@@ -357,6 +386,14 @@ int getType(char *path, int *error) {
                 *error = mysql_errno(&sql);
             return TYPE_NOENT;
         }
+    if (level >= 3) {
+        int type;
+
+        if (bulkCheck(path))
+            return TYPE_DIR;
+        if ((type = rowCacheGetType(sql, path)) != TYPE_UNCACHED)
+            return type;
+    }
     if (level <= 2) {
         if (level == 2)
             if (getPrimaryKeyName(sql, getPathComponent(path, 1), NULL) == NULL) {
@@ -369,13 +406,15 @@ int getType(char *path, int *error) {
     else
     if (level == 3) {
         char qry[2048] = { 0 };
-        char *tmp, *tab;
+        char *tmp, *tab, *where;
 
         tab = getPathComponent(path, 1);
-        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM %s WHERE %s = '%s'",
-                 tab, getPrimaryKeyName(sql, tab, NULL), getPathComponent(path, 2));
+        if ((where = keyWhere(sql, tab, getPathComponent(path, 2))) == NULL)
+            return TYPE_NOENT;
+        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM `%s` WHERE %s", tab, where);
+        free(where);
 
-        tmp = getValue(sql, qry, "0", NULL);
+        tmp = getValueError(sql, qry, "0", NULL, error);
         if (tmp == NULL) {
             DPRINTF("%s: Cannot get result for '%s'", __FUNCTION__, qry);
             return TYPE_NOENT;
@@ -391,12 +430,14 @@ int getType(char *path, int *error) {
     else 
     if (level == 4) {
         char qry[2048] = { 0 };
-        char *tab;
+        char *tab, *where;
 
         tab = getPathComponent(path, 1);
-        snprintf(qry, sizeof(qry), "SELECT `%s` FROM %s WHERE %s = '%s'",
-                 getPathComponent(path, 3), tab, getPrimaryKeyName(sql, tab, NULL),
-                 getPathComponent(path, 2));
+        if ((where = keyWhere(sql, tab, getPathComponent(path, 2))) == NULL)
+            return TYPE_NOENT;
+        snprintf(qry, sizeof(qry), "SELECT `%s` FROM `%s` WHERE %s",
+                 getPathComponent(path, 3), tab, where);
+        free(where);
         if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
             DPRINTF("%s: Error: %s", __FUNCTION__, mysql_error(&sql));
 
@@ -415,24 +456,184 @@ int getType(char *path, int *error) {
     return TYPE_NOENT;
 }
 
-int fmysql_getattr(const char *path, struct stat *stbuf)
+char *getMtimeColumnName(MYSQL sql, char *table) {
+    char *val;
+
+    val = catalogMtimeColumn(sql, sql.db, table);
+
+    DPRINTF("%s: Modification time column for \"%s\" is \"%s\"", __FUNCTION__,
+            table, val);
+    return val;
+}
+
+/* Modification time query of the database (tab is NULL) or the table */
+static void getMtimeQuery(char *qry, size_t size, char *db, char *tab)
+{
+    if (tab == NULL)
+        snprintf(qry, size, "SELECT UNIX_TIMESTAMP(MAX(COALESCE(UPDATE_TIME, CREATE_TIME))) "
+                 "FROM information_schema.TABLES WHERE TABLE_SCHEMA = '%s'", db);
+    else
+        snprintf(qry, size, "SELECT UNIX_TIMESTAMP(COALESCE(UPDATE_TIME, CREATE_TIME)) "
+                 "FROM information_schema.TABLES WHERE TABLE_SCHEMA = '%s' AND TABLE_NAME = '%s'",
+                 db, tab);
+}
+
+/* Modification time of the path, the error of a failed query is stored
+   to error like getValueError() does */
+time_t getMtime(MYSQL sql, char *path, int *error) {
+    char qry[2048] = { 0 };
+    char *db, *tab, *col, *tmp, *where;
+    time_t ret = 0;
+    int level;
+
+    level = getLevel(path);
+    if (level == 0)
+        return time(NULL);
+
+    db = getPathComponent(path, 0);
+    if (level == 1)
+        getMtimeQuery(qry, sizeof(qry), db, NULL);
+    else {
+        tab = getPathComponent(path, 1);
+        mysql_select_db(&sql, db);
+
+        /* Rows and columns use the row timestamp column if there is one */
+        if ((level > 2) && ((col = getMtimeColumnName(sql, tab)) != NULL)
+            && ((where = keyWhere(sql, tab, getPathComponent(path, 2))) != NULL)) {
+            snprintf(qry, sizeof(qry), "SELECT UNIX_TIMESTAMP(`%s`) FROM `%s` WHERE %s",
+                     col, tab, where);
+            free(where);
+            free(col);
+
+            if ((tmp = getValueError(sql, qry, "0", NULL, error)) != NULL) {
+                ret = strtoll(tmp, NULL, 10);
+                free(tmp);
+            }
+
+            if (ret > 0)
+                return ret;
+        }
+
+        /* Otherwise fall back to the last modification of the whole table */
+        getMtimeQuery(qry, sizeof(qry), db, tab);
+    }
+
+    DPRINTF("%s: Querying modification time \"%s\"", __FUNCTION__, qry);
+    if ((tmp = getValueError(sql, qry, "0", NULL, error)) != NULL) {
+        ret = strtoll(tmp, NULL, 10);
+        free(tmp);
+    }
+
+    DPRINTF("%s: Modification time of %s is %ld", __FUNCTION__, path, (long)ret);
+    return (ret > 0) ? ret : time(NULL);
+}
+
+/* Database and table directories: the size and the modification time
+   queries are sent together, their error is stored to error */
+static int getattrDir(const char *path, int type, struct stat *stbuf, int *error)
+{
+    char qry[2048] = { 0 };
+    char *db, *tab = NULL;
+    tAsync *size, *mtime;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    int err, mtimeErr;
+
+    db = getPathComponent(path, 0);
+    if (getLevel(path) == 2) {
+        tab = getPathComponent(path, 1);
+        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM `%s`.`%s`", db, tab);
+    }
+    else
+        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM information_schema.TABLES "
+                 "WHERE TABLE_SCHEMA = '%s'", db);
+    size = asyncSubmit(qry);
+    getMtimeQuery(qry, sizeof(qry), db, tab);
+    mtime = asyncSubmit(qry);
+
+    stbuf->st_mode = S_IFDIR | ((type == TYPE_DIR) ? 0755 : 0444);
+    stbuf->st_nlink = 1;
+    stbuf->st_size = 0;
+    if ((res = asyncWait(size, &err)) != NULL) {
+        if (((row = mysql_fetch_row(res)) != NULL) && (row[0] != NULL))
+            stbuf->st_size = atoll(row[0]);
+        mysql_free_result(res);
+    }
+
+    stbuf->st_mtime = 0;
+    if ((res = asyncWait(mtime, &mtimeErr)) != NULL) {
+        if (((row = mysql_fetch_row(res)) != NULL) && (row[0] != NULL))
+            stbuf->st_mtime = strtoll(row[0], NULL, 10);
+        mysql_free_result(res);
+    }
+    if (stbuf->st_mtime <= 0)
+        stbuf->st_mtime = time(NULL);
+    stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime;
+
+    *error = (err != 0) ? err : mtimeErr;
+    if (err == 1146)
+        return -ENOENT;
+    if (err > 0) {
+        DPRINTF("Directory %s size returned error %d", (char *)path, err);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/* The first error of the queries is stored to error, the result is not
+   to be kept if it is not verified */
+static int getattrPath(const char *path, struct stat *stbuf, int *error)
 {
     int type, err;
 
+    *error = 0;
     stbuf->st_uid = getuid();
     stbuf->st_gid = getgid();
-    stbuf->st_atime = stbuf->st_mtime = time(NULL);
 
+    if (exportFormat(path))
+        return exportGetattr(path, stbuf);
+    if (importIsPath(path))
+        return importGetattr(path, stbuf);
+    if (filterIsPath(path))
+        return filterGetattr(path, stbuf);
+    if (jsonIsPath(path))
+        return jsonGetattr(path, stbuf);
+
+    if (getLevel(path) >= 3) {
+        /* Row created but not inserted yet */
+        if (bulkCheck(path)) {
+            stbuf->st_mode = S_IFDIR | 0755;
+            stbuf->st_nlink = 1;
+            stbuf->st_size = 0;
+            stbuf->st_mtime = stbuf->st_atime = stbuf->st_ctime = time(NULL);
+            return 0;
+        }
+        if ((type = rowCacheStat(sql, (char *)path, stbuf)) == 1) {
+            if (writebackEnabled())
+                writebackStat(path, stbuf);
+            return 0;
+        }
+        if (type == 0)
+            return -ENOENT;
+    }
     type = getType( (char *)path, &err );
     DPRINTF("%s: Path %s, type = %d (error %d)", __FUNCTION__, path, type, err);
+    if (*error == 0)
+        *error = err;
     if ((type == TYPE_DIR) || (type == TYPE_DIR_NOPK)) {
         if (getPathComponent(path, 0) != NULL)
             if (mysql_select_db(&sql, getPathComponent(path, 0)) != 0)
                 return getErrorCode( err, 1044, -EPERM, -ENOENT);
 
+        if (asyncEnabled() && ((getLevel(path) == 1) || (getLevel(path) == 2)))
+            return getattrDir(path, type, stbuf, error);
+
         stbuf->st_mode = S_IFDIR | ((type == TYPE_DIR) ? 0755 : 0444);
         stbuf->st_nlink = 1;
         stbuf->st_size = getSize(sql, (char *)path, &err );
+        if (*error == 0)
+            *error = err;
         if (err == 1146)
             return -ENOENT;
         else
@@ -454,6 +655,10 @@ int fmysql_getattr(const char *path, struct stat *stbuf)
         stbuf->st_mode = S_IFREG | (isReadOnly(sql, path, tab) ? 0444 : 0666);
         stbuf->st_nlink = 1;
         stbuf->st_size = getSize(sql, (char *)path, &err );
+        if (*error == 0)
+            *error = err;
+        if (writebackEnabled())
+            writebackStat(path, stbuf);
         DPRINTF("Setting up file information %s, size is %ld bytes", (char *)path, stbuf->st_size);
         if (err > 0)
             DPRINTF("File %s size returned error %d", (char *)path, err);
@@ -461,30 +666,130 @@ int fmysql_getattr(const char *path, struct stat *stbuf)
     else
         return getErrorCode(err, 1044, -EPERM, -ENOENT);
 
+    stbuf->st_mtime = getMtime(sql, (char *)path, error);
+    stbuf->st_atime = stbuf->st_ctime = stbuf->st_mtime;
+
     return 0;
 }
 
+/* Attributes shared with the other mounts, the files of the exports,
+   imports and filters and the rows not inserted yet are of this mount */
+static int getattrShareable(const char *path)
+{
+    if ((!shmEnabled()) || (exportFormat(path)) || (importIsPath(path)) || (filterIsPath(path))
+        || (jsonIsPath(path)))
+        return 0;
+    if ((getLevel(path) >= 3) && ((writebackEnabled()) || (bulkCheck(path))))
+        return 0;
+
+    return 1;
+}
+
+typedef struct tSharedStat {
+    int ret;
+    struct stat st;
+} tSharedStat;
+
+static int getattrShared(const char *path, struct stat *stbuf, int *ret, tShmTag *tag)
+{
+    tSharedStat ss;
+    time_t stored;
+    int level;
+
+    level = getLevel(path);
+    if (shmGet(SHM_ATTR, (level > 0) ? getPathComponent(path, 0) : NULL,
+               (level > 1) ? getPathComponent(path, 1) : NULL, path, &ss, sizeof(ss),
+               &stored, tag) != sizeof(ss))
+        return 0;
+    if ((!routeOffline()) && (time(NULL) - stored >= mRowCacheTTL))
+        return 0;
+
+    memcpy(stbuf, &ss.st, sizeof(struct stat));
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    *ret = ss.ret;
+
+    return 1;
+}
+
+int fmysql_getattr(const char *path, struct stat *stbuf)
+{
+    unsigned long gen;
+    tSharedStat ss;
+    tShmTag tag;
+    int ret, shared, err;
+
+    if (routePath(path, 0) != 0)
+        return -EIO;
+    /* The row of the path failed to be inserted in the background */
+    if ((ret = bulkError(path)) != 0)
+        return ret;
+    gen = pathCacheGeneration();
+    if (pathCacheGetattr(path, stbuf, &ret)) {
+        /* Queued values are newer than the cached size */
+        if ((ret == 0) && (writebackEnabled()) && (getLevel(path) == 4))
+            writebackStat(path, stbuf);
+        return ret;
+    }
+
+    if (((shared = getattrShareable(path)) != 0) && (getattrShared(path, stbuf, &ret, &tag))) {
+        pathCacheSetattr(path, stbuf, ret, 0, gen);
+        return ret;
+    }
+
+    ret = getattrPath(path, stbuf, &err);
+    pathCacheSetattr(path, stbuf, ret, err, gen);
+
+    /* Published to the other mounts only if the path exists or the server
+       said it doesn't, not after a failed or killed query */
+    if ((shared) && ((ret == 0) || (ret == -ENOENT)) && (queryVerified(err))) {
+        memset(&ss, 0, sizeof(ss));
+        ss.ret = ret;
+        memcpy(&ss.st, stbuf, sizeof(struct stat));
+        shmPut(SHM_ATTR, path, &ss, sizeof(ss), &tag);
+    }
+
+    return ret;
+}
+
 char *mysql_read(MYSQL sql, char *path, unsigned int *len)
 {
     char *val = NULL;
     unsigned int sz;
-    char *db, *tab, *col, *pk, *pkVal;
+    char *db, *tab, *col, *where, *pkVal;
     char qry[2048] = { 0 };
     MYSQL_RES *res;
     MYSQL_ROW row;
 
+    /* Values queued for write-behind are newer than the database */
+    if (writebackEnabled()) {
+        unsigned long wblen;
+
+        if ((val = writebackRead(path, &wblen)) != NULL) {
+            if (len != NULL)
+                *len = (wblen > 0) ? wblen + 1 : 0;
+            val = (char *)realloc(val, (wblen + 2) * sizeof(char));
+            val[wblen] = '\n';
+            val[wblen + 1] = 0;
+            return val;
+        }
+    }
+
+    if ((val = rowCacheRead(sql, path, len)) != NULL)
+        return val;
+
     db = getPathComponent(path, 0);
     tab = getPathComponent(path, 1);
     pkVal = getPathComponent(path, 2);
     col = getPathComponent(path, 3);
-    pk  = getPrimaryKeyName(sql, tab, NULL);
 
-    if ((col == NULL) || (pk == NULL))
+    mysql_select_db(&sql, db);
+    if ((col == NULL) || ((where = keyWhere(sql, tab, pkVal)) == NULL))
         return NULL;
 
-    mysql_select_db(&sql, db);
-    snprintf(qry, sizeof(qry), "SELECT `%s`, LENGTH(`%s`) FROM %s WHERE %s = '%s'",
-             col, col, tab, pk, pkVal);
+    snprintf(qry, sizeof(qry), "SELECT `%s`, LENGTH(`%s`) FROM `%s` WHERE %s",
+             col, col, tab, where);
+    free(where);
     DPRINTF("%s: mysql_read query: %s", __FUNCTION__, qry);
 
     if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
@@ -505,6 +810,17 @@ char *mysql_read(MYSQL sql, char *path, unsigned int *len)
     }
     mysql_free_result(res);
 
+    if ((sz > 0) && (compressPath(path))) {
+        unsigned long dlen;
+        char *dec;
+
+        if ((dec = compressDecode(val, sz, &dlen)) != NULL) {
+            free(val);
+            val = dec;
+            sz = dlen;
+        }
+    }
+
     if (sz == 0) {
         if (len != NULL)
             *len = 0;
@@ -526,6 +842,14 @@ int fmysql_read(const char *path, char *buf, size_t size, off_t offset,
     unsigned int len;
     char *buf1;
 
+    if (routePath(path, 0) != 0)
+        return -EIO;
+
+    if (exportFormat(path))
+        return exportRead(path, buf, size, offset, fi);
+    if (jsonIsPath(path))
+        return jsonRead(path, buf, size, offset, fi);
+
     t = getType( (char *)path, NULL );
     DPRINTF("%s: Path = %s, type = %d", __FUNCTION__, (char *)path, t);
 
@@ -548,27 +872,33 @@ int fmysql_read(const char *path, char *buf, size_t size, off_t offset,
     return size;
 }
 
-int fmysql_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                          off_t offset, struct fuse_file_info *fi)
+static int readdirPath(const char *path, void *buf, fuse_fill_dir_t filler)
 {
     int level;
-    (void) offset;
-    (void) fi;
 
     level = getLevel(path);
     DPRINTF("%s: Path %s (level = %d)", __FUNCTION__, path, level );
 
+    if (filterIsPath(path))
+        return filterReaddir(path, buf, filler);
+    if (jsonIsPath(path))
+        return jsonReaddir(path, buf, filler);
+
     if (level == 0) { /* Database */
         filler(buf, ".", NULL, 0);
         filler(buf, "..", NULL, 0);
 
+        /* Databases of all the servers */
+        if (routeListing(buf, filler) >= 0)
+            return 0;
+
         if (getMySQLResults(sql, "SHOW DATABASES", "Database", filler, buf) < 0)
             return -EIO;
     }
     else
     if (level == 1) { /* Table */
         char *db, *tmp;
-        int size;
+        int size, num;
 
         filler(buf, ".", NULL, 0);
         filler(buf, "..", NULL, 0);
@@ -580,13 +910,14 @@ int fmysql_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         snprintf(tmp, size, "Tables_in_%s", db);
         DPRINTF("Column name: '%s'", tmp);
         mysql_select_db(&sql, db);
-        getMySQLResults(sql, "SHOW TABLES", tmp, filler, buf);
+        num = getMySQLResults(sql, "SHOW TABLES", tmp, filler, buf);
         free(tmp);
+        if (num < 0)
+            return -EIO;
     }
     else
     if (level == 2) { /* Directory entries sorted by primary key */
         char *db, *tab, *pk;
-        char qry[2048] = { 0 };
         int err;
 
         filler(buf, ".", NULL, 0);
@@ -594,39 +925,54 @@ int fmysql_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
         db = getPathComponent(path, 0);
         tab = getPathComponent(path, 1);
+        bulkSync(path);
         mysql_select_db(&sql, db);
         pk = getPrimaryKeyName(sql, tab, &err);
 
         if ((db == NULL) || (tab == NULL) || (pk == NULL))
             return -ENOENT;
+        free(pk);
 
-        snprintf(qry, sizeof(qry), "SELECT `%s` FROM %s ORDER BY %s", pk, tab, pk);
-        DPRINTF("%s: Query \"%s\" returned error code %d", __FUNCTION__, qry, err);
-
-        getMySQLResults(sql, qry, pk, filler, buf);
+        /* Rows are named by their encoded primary key values */
+        if ((mirrorListing(db, tab, buf, filler) < 0)
+            && (readaheadListing(sql, (char *)path, filler, buf) < 0))
+            return -EIO;
     }
     else
     if (level == 3) { /* File entries are DB columns */
-        char *db, *tab, *pk, *pkVal, *tmp;
+        char *db, *tab, *where, *pkVal, *tmp;
         char qry[2048] = { 0 };
-        int num;
+        int num, err;
 
         filler(buf, ".", NULL, 0);
         filler(buf, "..", NULL, 0);
 
+        if (bulkCheck(path))
+            bulkSync(path);
+
+        num = rowCacheFill(sql, (char *)path, buf, filler);
+        if (num == 1) {
+            jsonFill(path, buf, filler);
+            return 0;
+        }
+        if (num == 0)
+            return -ENOENT;
+
         db = getPathComponent(path, 0);
         tab = getPathComponent(path, 1);
         pkVal = getPathComponent(path, 2);
         mysql_select_db(&sql, db);
-        pk = getPrimaryKeyName(sql, tab, NULL);
+        if ((where = keyWhere(sql, tab, pkVal)) == NULL)
+            return -ENOENT;
 
-        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM %s WHERE %s = '%s'",
-                 tab, pk, pkVal);
+        snprintf(qry, sizeof(qry), "SELECT COUNT(*) FROM `%s` WHERE %s", tab, where);
+        free(where);
 
         DPRINTF("%s: Setting up query: %s", __FUNCTION__, qry);
-        tmp = getValue(sql, qry, "0", NULL);
+        err = 0;
+        tmp = getValueError(sql, qry, "0", NULL, &err);
         if (tmp == NULL)
-            return -ENOENT;
+            return (err != 0) ? -EIO : -ENOENT;
         num = atoi(tmp);
         DPRINTF("Result at index 0 is %d", num);
 
@@ -636,16 +982,43 @@ int fmysql_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         snprintf(qry, sizeof(qry), "SHOW FIELDS FROM %s", tab);
         DPRINTF("%s: Query is '%s'", __FUNCTION__, qry);
 
-        getMySQLResults(sql, qry, "Field", filler, buf);
+        if (getMySQLResults(sql, qry, "Field", filler, buf) < 0)
+            return -EIO;
+        jsonFill(path, buf, filler);
     }
 
     return 0;
 }
 
+int fmysql_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info *fi)
+{
+    (void) offset;
+    (void) fi;
+
+    if (routePath(path, 0) != 0)
+        return -EIO;
+    if (pathCacheReaddir(path, buf, filler))
+        return 0;
+
+    return pathCacheListing(path, buf, filler, readdirPath);
+}
+
 int fmysql_open(const char *path, struct fuse_file_info *fi)
 {
     int type, ret;
 
+    if (routePath(path, (fi->flags & O_WRONLY) || (fi->flags & O_RDWR)) != 0)
+        return -EIO;
+    if (exportFormat(path))
+        return exportOpen(path, fi);
+    if (importIsPath(path))
+        return importOpen(path, fi);
+    if (filterIsPath(path))
+        return -EISDIR;
+    if (jsonIsPath(path))
+        return jsonOpen(path, fi);
+
     ret = 0;
     type = getType( (char *)path, NULL );
 
@@ -681,6 +1054,16 @@ int fmysql_mkdir(const char *path, mode_t mode)
     char qry[1024] = { 0 };
     (void)mode;
 
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonMkdir(path);
+
     if (flagIsSet(FLAG_READONLY))
         return -EPERM;
 
@@ -688,6 +1071,13 @@ int fmysql_mkdir(const char *path, mode_t mode)
     level = getLevel(path);
     DPRINTF("%s: Path %s, mode=%o, level = %d", __FUNCTION__, path, mode, level);
 
+    /* Rows are inserted later in batches */
+    if ((level == 3) && (bulkEnabled())) {
+        ret = bulkCreate(path);
+        rowCacheInvalidatePath(path);
+        return ret;
+    }
+
     if (level == 1)
         snprintf(qry, sizeof(qry), "CREATE DATABASE %s", getPathComponent(path, 0));
     else
@@ -695,9 +1085,22 @@ int fmysql_mkdir(const char *path, mode_t mode)
         snprintf(qry, sizeof(qry), "CREATE TABLE %s(id varchar(255), PRIMARY KEY(id))",
                  getPathComponent(path, 1));
     else
-    if (level == 3)
-        snprintf(qry, sizeof(qry), "INSERT INTO %s(%s) VALUES('%s')", getPathComponent(path, 1),
-                 getPrimaryKeyName(sql, getPathComponent(path, 1), NULL), getPathComponent(path, 2));
+    if (level == 3) {
+        char *cols, *vals;
+
+        mysql_select_db(&sql, getPathComponent(path, 0));
+        cols = keyColumns(sql, getPathComponent(path, 1));
+        vals = keyValues(sql, getPathComponent(path, 1), getPathComponent(path, 2));
+        if ((cols == NULL) || (vals == NULL)) {
+            free(cols);
+            free(vals);
+            return -EINVAL;
+        }
+        snprintf(qry, sizeof(qry), "INSERT INTO `%s`(%s) VALUES(%s)", getPathComponent(path, 1),
+                 cols, vals);
+        free(cols);
+        free(vals);
+    }
     else
         return -EPERM;
 
@@ -709,6 +1112,10 @@ int fmysql_mkdir(const char *path, mode_t mode)
                 mysql_error(&sql));
         ret = -EIO;
     }
+    else
+    if (level == 1)
+        routeCreated(getPathComponent(path, 0));
+    rowCacheInvalidatePath(path);
 
     DPRINTF("%s: Query '%s' returned %d", __FUNCTION__, qry, ret);
     return ret;
@@ -719,6 +1126,16 @@ int fmysql_rmdir(const char *path)
     int level, ret;
     char qry[1024] = { 0 };
 
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonRemove(path, 1);
+
     if (flagIsSet(FLAG_READONLY))
         return -EPERM;
 
@@ -726,15 +1143,29 @@ int fmysql_rmdir(const char *path)
     level = getLevel(path);
     DPRINTF("%s: Path %s, level = %d", __FUNCTION__, path, level);
 
+    /* Don't let queued updates recreate data of the removed entry */
+    if (writebackEnabled())
+        writebackSync(NULL);
+
+    if ((level == 3) && (bulkEnabled()) && (bulkCancel(path)))
+        return 0;
+    bulkSync(path);
+
     if (level == 1)
         snprintf(qry, sizeof(qry), "DROP DATABASE %s", getPathComponent(path, 0));
     else
     if (level == 2)
         snprintf(qry, sizeof(qry), "DROP TABLE %s", getPathComponent(path, 1));
     else
-    if (level == 3)
-        snprintf(qry, sizeof(qry), "DELETE FROM %s WHERE %s = '%s'", getPathComponent(path, 1),
-                 getPrimaryKeyName(sql, getPathComponent(path, 1), NULL), getPathComponent(path, 2));
+    if (level == 3) {
+        char *where;
+
+        mysql_select_db(&sql, getPathComponent(path, 0));
+        if ((where = keyWhere(sql, getPathComponent(path, 1), getPathComponent(path, 2))) == NULL)
+            return -ENOENT;
+        snprintf(qry, sizeof(qry), "DELETE FROM `%s` WHERE %s", getPathComponent(path, 1), where);
+        free(where);
+    }
     else
         return -EPERM;
 
@@ -746,6 +1177,12 @@ int fmysql_rmdir(const char *path)
                 mysql_error(&sql));
         ret = -EIO;
     }
+    else
+    if (level == 1)
+        routeDropped(getPathComponent(path, 0));
+    rowCacheInvalidatePath(path);
+    if (level < 3)
+        catalogInvalidate(getPathComponent(path, 0), (level == 2) ? getPathComponent(path, 1) : NULL);
 
     DPRINTF("%s for query '%s' returned %d", __FUNCTION__, qry, ret);
     return ret;
@@ -755,7 +1192,17 @@ int fmysql_rm(const char *path)
 {
     int level, ret;
     char qry[1024] = { 0 };
-    char *tab;
+    char *tab, *where;
+
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonRemove(path, 0);
 
     ret = 0;
     level = getLevel(path);
@@ -765,21 +1212,27 @@ int fmysql_rm(const char *path)
     tab = getPathComponent( (char *)path, 1);
 
     DPRINTF("%s: Path %s, level = %d, tab = %s", __FUNCTION__, path, level, tab);
+    bulkCheck(path);
 
     mysql_select_db(&sql, getPathComponent(path, 0));
     if (isReadOnly(sql, path, tab))
         return -EPERM;
 
-    snprintf(qry, sizeof(qry), "UPDATE `%s` SET `%s` = NULL WHERE `%s` = '%s';",
-             getPathComponent(path, 1), getPathComponent(path, 3),
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+    if (writebackEnabled())
+        writebackSync(path);
+
+    if ((where = keyWhere(sql, tab, getPathComponent(path, 2))) == NULL)
+        return -ENOENT;
+    snprintf(qry, sizeof(qry), "UPDATE `%s` SET `%s` = NULL WHERE %s",
+             getPathComponent(path, 1), getPathComponent(path, 3), where);
+    free(where);
 
     if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
         DPRINTF("%s: Query '%s' failed: %s", __FUNCTION__, qry,
                 mysql_error(&sql));
         ret = -EIO;
     }
+    rowCacheInvalidatePath(path);
 
     DPRINTF("%s for query '%s' returned %d", __FUNCTION__, qry, ret);
     return ret;
@@ -792,6 +1245,19 @@ int fmysql_create(const char *path, mode_t mode, struct fuse_file_info *fi)
     char *tmp;
     char qry[1024] = { 0 };
 
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonCreate(path);
+
+    if (importIsPath(path))
+        return importOpen(path, fi);
+
     ret = 0;
     level = getLevel(path);
     if ((level < 4) || (flagIsSet(FLAG_READONLY)))
@@ -803,6 +1269,7 @@ int fmysql_create(const char *path, mode_t mode, struct fuse_file_info *fi)
         return -EPERM;
 
     DPRINTF("%s: Path %s, level = %d", __FUNCTION__, path, level);
+    bulkCheck(path);
 
     snprintf(qry, sizeof(qry), "ALTER TABLE `%s` ADD `%s` text",
              getPathComponent(path, 1), getPathComponent(path, 3));
@@ -814,6 +1281,8 @@ int fmysql_create(const char *path, mode_t mode, struct fuse_file_info *fi)
                 mysql_error(&sql));
         ret = -EIO;
     }
+    rowCacheInvalidate(getPathComponent(path, 0), getPathComponent(path, 1), NULL);
+    catalogInvalidate(getPathComponent(path, 0), getPathComponent(path, 1));
 
     DPRINTF("%s for query '%s' returned %d", __FUNCTION__, qry, ret);
     return ret;
@@ -822,45 +1291,83 @@ int fmysql_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 int fmysql_truncate(const char *path, off_t size)
 {
     int ret, level;
-    char *tmp;
+    char *tmp, *where;
     char *qry = NULL;
     unsigned long long len;
 
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonTruncate(path, size);
+
+    /* O_TRUNC open of the import file, nothing to truncate */
+    if (importIsPath(path))
+        return flagIsSet(FLAG_READONLY) ? -EPERM : 0;
+
     ret = 0;
     level = getLevel(path);
     if ((level < 4) || (flagIsSet(FLAG_READONLY)))
         return -EPERM;
 
     DPRINTF("%s: Path %s, level = %d, size = %lld", __FUNCTION__, path, level, size);
+    bulkCheck(path);
+
+    if (writebackEnabled())
+        return writebackTruncate(path, size);
 
     mysql_select_db(&sql, getPathComponent(path, 0));
+    if ((where = keyWhere(sql, getPathComponent(path, 1), getPathComponent(path, 2))) == NULL)
+        return -ENOENT;
 
-    qry = malloc( 1024 * sizeof(char) );
-    snprintf(qry, 1024, "SELECT `%s`, LENGTH(`%s`) FROM %s WHERE `%s` = '%s'",
+    qry = malloc( (1024 + strlen(where)) * sizeof(char) );
+    snprintf(qry, 1024 + strlen(where), "SELECT `%s`, LENGTH(`%s`) FROM `%s` WHERE %s",
              getPathComponent(path, 3), getPathComponent(path, 3), getPathComponent(path, 1),
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+             where);
 
     DPRINTF("%s: Select query is \"%s\"", __FUNCTION__, qry);
     tmp = getValue(sql, qry, "0l1", &len);
-    if (tmp == NULL)
+    if (tmp == NULL) {
+        free(where);
+        free(qry);
         return 0;
+    }
 
+    if (compressPath(path)) {
+        unsigned long clen;
+        char *dec, *enc;
 
-    tmp[size] = 0;
+        if ((dec = compressDecode(tmp, len, NULL)) != NULL) {
+            free(tmp);
+            tmp = dec;
+        }
+        tmp[size] = 0;
+        len = strlen(tmp);
+        if ((enc = compressEncode(tmp, len, &clen)) != NULL) {
+            free(tmp);
+            tmp = enc;
+            len = clen;
+        }
+    }
+    else
+        tmp[size] = 0;
 
-    qry = (char *)realloc(qry, (256 + len) * sizeof(char) );
-    memset(qry, 0, (256 + len) * sizeof(char) );
-    snprintf(qry, 256 + len, "UPDATE `%s` SET %s = '%s' WHERE `%s` = '%s'",
-             getPathComponent(path, 1), getPathComponent(path, 3), tmp,
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+    qry = (char *)realloc(qry, (256 + len + strlen(where)) * sizeof(char) );
+    memset(qry, 0, (256 + len + strlen(where)) * sizeof(char) );
+    snprintf(qry, 256 + len + strlen(where), "UPDATE `%s` SET %s = '%s' WHERE %s",
+             getPathComponent(path, 1), getPathComponent(path, 3), tmp, where);
+    free(where);
 
     if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
         DPRINTF("%s: Query '%s' failed: %s", __FUNCTION__, qry,
                 mysql_error(&sql));
         ret = -EIO;
     }
+    rowCacheInvalidatePath(path);
 
     DPRINTF("%s for query '%s' returned %d", __FUNCTION__, qry, ret);
     free(qry);
@@ -872,7 +1379,20 @@ int fmysql_write(const char *path, const char *buf, size_t size,
 {
     unsigned long long len;
     int level, ret;
-    char *tmp = NULL, *qry = NULL;
+    char *tmp = NULL, *qry = NULL, *where;
+
+    if (routePath(path, 1) != 0)
+        return -EIO;
+
+    /* Filter directories are read-only */
+    if (filterIsPath(path))
+        return -EPERM;
+
+    if (jsonIsPath(path))
+        return jsonWrite(path, buf, size, offset);
+
+    if (importIsPath(path))
+        return importWrite(path, buf, size, offset, fi);
 
     ret = 0;
 
@@ -881,19 +1401,35 @@ int fmysql_write(const char *path, const char *buf, size_t size,
         return -EPERM;
 
     DPRINTF("%s: Requested write of %d bytes (%s)", __FUNCTION__, size, buf);
+    bulkCheck(path);
+
+    /* Writable open() has already refused the primary key column */
+    if (writebackEnabled())
+        return writebackWrite(path, buf, size, offset);
 
     mysql_select_db(&sql, getPathComponent(path, 0));
     if (isReadOnly(sql, path, getPathComponent(path, 1)))
         return -EPERM;
+    if ((where = keyWhere(sql, getPathComponent(path, 1), getPathComponent(path, 2))) == NULL)
+        return -ENOENT;
 
-    qry = malloc( 1024 * sizeof(char) );
-    snprintf(qry, 1024, "SELECT `%s`, LENGTH(`%s`) FROM %s WHERE `%s` = '%s'",
+    qry = malloc( (1024 + strlen(where)) * sizeof(char) );
+    snprintf(qry, 1024 + strlen(where), "SELECT `%s`, LENGTH(`%s`) FROM `%s` WHERE %s",
              getPathComponent(path, 3), getPathComponent(path, 3), getPathComponent(path, 1),
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+             where);
 
     DPRINTF("%s: Select query is \"%s\"", __FUNCTION__, qry);
     tmp = getValue(sql, qry, "0l1", &len);
+    if ((tmp != NULL) && (compressPath(path))) {
+        unsigned long dlen;
+        char *dec;
+
+        if ((dec = compressDecode(tmp, len, &dlen)) != NULL) {
+            free(tmp);
+            tmp = dec;
+            len = dlen;
+        }
+    }
     if (tmp != NULL) {
         if ( offset + size > len ) {
             len = offset + size;
@@ -912,28 +1448,38 @@ int fmysql_write(const char *path, const char *buf, size_t size,
 
     DPRINTF("%s: New length = %lld, string = \"%s\"", __FUNCTION__, len, tmp);
 
-    qry = (char *)realloc(qry, (512 + len) * sizeof(char) );
-    DPRINTF("Reallocation to %d is done to\n", 512 + len);
+    if ((tmp != NULL) && (compressPath(path))) {
+        unsigned long clen;
+        char *enc;
+
+        if ((enc = compressEncode(tmp, len, &clen)) != NULL) {
+            free(tmp);
+            tmp = enc;
+            len = clen;
+            DPRINTF("%s: Compressed to %lld bytes", __FUNCTION__, len);
+        }
+    }
+
+    qry = (char *)realloc(qry, (512 + len + strlen(where)) * sizeof(char) );
+    DPRINTF("Reallocation to %d is done to\n", 512 + len + strlen(where));
 
-    memset(qry, 0, (512 + len) * sizeof(char) );
-    snprintf(qry, 512 + len, "UPDATE `%s` SET %s = '%s' WHERE `%s` = '%s'",
-             getPathComponent(path, 1), getPathComponent(path, 3), tmp,
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+    memset(qry, 0, (512 + len + strlen(where)) * sizeof(char) );
+    snprintf(qry, 512 + len + strlen(where), "UPDATE `%s` SET %s = '%s' WHERE %s",
+             getPathComponent(path, 1), getPathComponent(path, 3), tmp, where);
+    free(where);
 
     DPRINTF("%s: Setting up query '%s'...", __FUNCTION__, qry);
 
 /*
-    snprintf(qry, sizeof(qry), "UPDATE `%s` SET %s = '%s' WHERE `%s` = '%s'",
-             getPathComponent(path, 1), getPathComponent(path, 3), buf,
-             getPrimaryKeyName(sql, getPathComponent(path, 1), NULL),
-             getPathComponent(path, 2));
+    snprintf(qry, sizeof(qry), "UPDATE `%s` SET %s = '%s' WHERE %s",
+             getPathComponent(path, 1), getPathComponent(path, 3), buf, where);
 */
     if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
         DPRINTF("%s: Query '%s' failed: %s", __FUNCTION__, qry,
                 mysql_error(&sql));
         ret = -EIO;
     }
+    rowCacheInvalidatePath(path);
     free(tmp);
 
     DPRINTF("%s for query '%s' returned %d", __FUNCTION__, qry, ret);
@@ -941,20 +1487,113 @@ int fmysql_write(const char *path, const char *buf, size_t size,
     return (ret == 0) ? size : ret;
 }
 
+int fmysql_readlink(const char *path, char *buf, size_t size)
+{
+    if (routePath(path, 0) != 0)
+        return -EIO;
+    if (filterIsPath(path))
+        return filterReadlink(path, buf, size);
+
+    return -EINVAL;
+}
+
+int fmysql_release(const char *path, struct fuse_file_info *fi)
+{
+    if (exportFormat(path))
+        return exportRelease(path, fi);
+    if (importIsPath(path))
+        return importRelease(path, fi);
+    if (jsonIsPath(path))
+        return jsonRelease(path, fi);
+
+    return 0;
+}
+
+int fmysql_flush(const char *path, struct fuse_file_info *fi)
+{
+    if (importIsPath(path))
+        return importFlush(path, fi);
+
+    if (!writebackEnabled())
+        return 0;
+
+    DPRINTF("%s: Waiting for queued writes of %s", __FUNCTION__, path);
+    return writebackSync(path);
+}
+
+int fmysql_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void) datasync;
+
+    return fmysql_flush(path, fi);
+}
+
+int fmysql_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void) datasync;
+
+    /* Syncing the row directory writes all of its dirty columns at once */
+    if ((!writebackEnabled()) || (getLevel(path) < 3))
+        return 0;
+
+    return writebackSync(path);
+}
+
+void *fmysql_init(struct fuse_conn_info *conn)
+{
+    (void) conn;
+
+    /* Threads must be started after fuse_main() daemonizes */
+    healthStart();
+    writebackStart();
+    bulkStart();
+    snapshotStart();
+    routeReplicaStart();
+    deadlineStart();
+    binlogStart();
+    mirrorStart();
+    asyncStart();
+
+    return NULL;
+}
+
+void fmysql_destroy(void *data)
+{
+    (void) data;
+
+    asyncStop();
+    mirrorStop();
+    deadlineStop();
+    routeReplicaStop();
+    binlogStop();
+    bulkStop();
+    writebackStop();
+    healthStop();
+    catalogSave();
+}
+
 struct fuse_operations fmysql_oper = {
     /* Directories/files listing */
-    .getattr    = fmysql_getattr,
-    .readdir    = fmysql_readdir,
+    .getattr    = schedGetattr,
+    .readdir    = schedReaddir,
+    .readlink   = schedReadlink,
     /* Read functions */
-    .read       = fmysql_read,
-    .open       = fmysql_open,
+    .read       = schedRead,
+    .open       = schedOpen,
     /* Directory operations */
-    .mkdir      = fmysql_mkdir,
-    .rmdir      = fmysql_rmdir,
+    .mkdir      = schedMkdir,
+    .rmdir      = schedRmdir,
     /* Write operations */
-    .create     = fmysql_create,
-    .write      = fmysql_write,
+    .create     = schedCreate,
+    .write      = schedWrite,
+    .flush      = fmysql_flush,
+    .release    = fmysql_release,
+    .fsync      = fmysql_fsync,
+    .fsyncdir   = fmysql_fsyncdir,
     /* File operations */
-    .unlink     = fmysql_rm,
-    .truncate   = fmysql_truncate,
+    .unlink     = schedRm,
+    .truncate   = schedTruncate,
+    /* Initialization and cleanup */
+    .init       = fmysql_init,
+    .destroy    = fmysql_destroy,
 };
@@ -0,0 +1,870 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Routing: the mount may aggregate several servers given as a comma
+  separated --server list. Every database belongs to one server, the
+  owners are discovered using SHOW DATABASES on all the servers (the
+  first server having the database wins) or set using --route. The root
+  directory lists the databases of all the servers.
+
+  Every FUSE thread has its own connection to each server it has used,
+  opened on first use. The connection of the server owning the database
+  of the path is swapped into the thread's sql before the operation, so
+  operations on different databases and servers run in parallel. The
+  connections are only ever used at the address of the thread's sql, the
+  others are stored as plain copies.
+
+  Read replicas: with --replica the reads (getattr, readdir, read) of the
+  databases of the first server are spread over its replicas. A monitor
+  thread measures the lag of every replica each second, a replica lagging
+  more than --replica-max-lag seconds or not replicating is skipped. Every
+  write records the time the table (and its database) was last written,
+  reads of the table stay on the primary until a replica's lag is
+  shorter than the time since the write, so a client always reads its own
+  writes.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_ROUTE
+
+#ifdef DEBUG_ROUTE
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "route: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define ROUTE_BUCKETS           1024
+/* Unknown databases trigger the discovery at most once per interval */
+#define ROUTE_REDISCOVER        1
+/* The merged root listing is rebuilt after the interval */
+#define ROUTE_TTL               30
+#define ROUTE_PIN_BUCKETS       256
+#define ROUTE_OFFLINE           -1
+/* Client errors of a connection that lost its server */
+#define CR_SERVER_GONE_ERROR    2006
+#define CR_SERVER_LOST          2013
+/* Replica lag measurement interval */
+#define REPLICA_INTERVAL        1
+
+typedef struct tServer {
+    char *host;
+    unsigned int port;
+} tServer;
+
+typedef struct tRoute {
+    char *db;
+    int server;
+    /* Set by --route, kept by the discovery */
+    int fixed;
+    /* Found by the running discovery */
+    int seen;
+    struct tRoute *next;
+} tRoute;
+
+typedef struct tPin {
+    char *key;
+    time_t written;
+    struct tPin *next;
+} tPin;
+
+typedef struct tThreadConns {
+    /* Server whose connection is in sql, -1 for none */
+    int cur;
+    /* 1 for the connected ones, ROUTE_OFFLINE for an unconnected handle */
+    int *open;
+    unsigned int *gen;
+    unsigned int *epoch;
+    time_t *used;
+    MYSQL *saved;
+} tThreadConns;
+
+/* The servers followed by the replicas of the first server */
+static tServer *rtServers = NULL;
+static int rtNum = 0;
+static int rtTotal = 0;
+static tRoute *rtBuckets[ROUTE_BUCKETS] = { NULL };
+static time_t rtDiscovered = 0;
+static pthread_mutex_t rtMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Serializes the discoveries, taken before rtMutex */
+static pthread_mutex_t rtDiscoverMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t rtKey;
+/* Set while the operation of the thread is served without its server */
+static __thread int rtOffline = 0;
+/* Path of the running write of the thread, pinned again when it ends */
+static __thread char rtWritePath[1024];
+
+static int rpNum = 0;
+/* Measured lag in seconds, -1 for the replicas not to be read from */
+static volatile int *rpLag = NULL;
+static volatile time_t *rpMeasured = NULL;
+static unsigned int rpNext = 0;
+static tPin *rpPins[ROUTE_PIN_BUCKETS] = { NULL };
+static pthread_mutex_t rpMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t rpThread;
+static volatile int rpRunning = 0;
+
+static unsigned int routeHash(const char *db)
+{
+    unsigned int h = 5381;
+
+    while (*db)
+        h = (h * 33) ^ (unsigned char)*db++;
+
+    return h % ROUTE_BUCKETS;
+}
+
+/* Expects rtMutex to be held */
+static tRoute *routeFind(const char *db)
+{
+    tRoute *r;
+
+    for (r = rtBuckets[routeHash(db)]; r != NULL; r = r->next)
+        if (strcmp(r->db, db) == 0)
+            return r;
+
+    return NULL;
+}
+
+/* Expects rtMutex to be held */
+static void routeSet(const char *db, int server, int fixed)
+{
+    tRoute *r;
+    unsigned int h;
+
+    if ((r = routeFind(db)) != NULL) {
+        if ((!r->fixed) || (fixed)) {
+            r->server = server;
+            r->fixed = fixed;
+        }
+        r->seen = 1;
+        return;
+    }
+
+    h = routeHash(db);
+    r = (tRoute *)malloc( sizeof(tRoute) );
+    r->db = strdup(db);
+    r->server = server;
+    r->fixed = fixed;
+    r->seen = 1;
+    r->next = rtBuckets[h];
+    rtBuckets[h] = r;
+}
+
+/* Expects rtMutex to be held */
+static void routeRemove(const char *db)
+{
+    tRoute *r, **pr;
+
+    for (pr = &rtBuckets[routeHash(db)]; (r = *pr) != NULL; pr = &r->next)
+        if (strcmp(r->db, db) == 0) {
+            *pr = r->next;
+            free(r->db);
+            free(r);
+            return;
+        }
+}
+
+/* Append the "host[:port],..." list to the servers, returns their number */
+static int routeParseList(char *list)
+{
+    char *tmp, *str, *save, *token, *port;
+    int num = 0;
+
+    tmp = strdup(list);
+    for (str = tmp; ; str = NULL) {
+        if ((token = strtok_r(str, ",", &save)) == NULL)
+            break;
+        rtServers = (tServer *)realloc(rtServers, (rtTotal + 1) * sizeof(tServer));
+        rtServers[rtTotal].port = 0;
+        if ((port = strrchr(token, ':')) != NULL) {
+            *port++ = 0;
+            rtServers[rtTotal].port = atoi(port);
+        }
+        rtServers[rtTotal++].host = strdup(token);
+        num++;
+    }
+    free(tmp);
+
+    return num;
+}
+
+/* Parse the --server list, has to precede the replicas */
+int routeParseServers(char *list)
+{
+    rtNum = routeParseList(list);
+
+    return (rtNum > 0) ? 0 : -1;
+}
+
+/* Parse the --replica list of the replicas of the first server */
+int routeParseReplicas(char *list)
+{
+    int i;
+
+    rpNum = routeParseList(list);
+    rpLag = (volatile int *)malloc( rpNum * sizeof(int) );
+    rpMeasured = (volatile time_t *)calloc(rpNum, sizeof(time_t));
+    for (i = 0; i < rpNum; i++)
+        rpLag[i] = -1;
+
+    return (rpNum > 0) ? 0 : -1;
+}
+
+int routeReplicas(void)
+{
+    return rpNum;
+}
+
+/* Number of the servers including the replicas */
+int routeTotal(void)
+{
+    return rtTotal;
+}
+
+int routeServers(void)
+{
+    return rtNum;
+}
+
+/* Parse a --route "db=host" mapping, host has to be one of the servers */
+int routeAdd(char *mapping)
+{
+    char *db, *host;
+    int i;
+
+    db = strdup(mapping);
+    if ((host = strchr(db, '=')) == NULL) {
+        free(db);
+        return -1;
+    }
+    *host++ = 0;
+
+    for (i = 0; i < rtNum; i++)
+        if (strcmp(rtServers[i].host, host) == 0)
+            break;
+
+    if (i == rtNum) {
+        fprintf(stderr, "Error: Server %s of database %s is not in the server list\n", host, db);
+        free(db);
+        return -1;
+    }
+
+    pthread_mutex_lock(&rtMutex);
+    routeSet(db, i, 1);
+    pthread_mutex_unlock(&rtMutex);
+    free(db);
+
+    return 0;
+}
+
+/* Returns 1 if the last call on the connection lost the server */
+static int routeLost(MYSQL *conn)
+{
+    return ((mysql_errno(conn) == CR_SERVER_GONE_ERROR) || (mysql_errno(conn) == CR_SERVER_LOST)) ? 1 : 0;
+}
+
+/* Connect to the server, the connection has to be initialized */
+int routeConnect(MYSQL *conn, int server)
+{
+    if ((server < 0) || (server >= rtTotal))
+        server = 0;
+
+    return connectServer(conn, rtServers[server].host, rtServers[server].port);
+}
+
+/* Learn the databases of all the servers, the earlier server wins. The
+   routes found before on a server which answered and not found now are
+   dropped, the ones of the servers not answering are kept. Expects
+   rtDiscoverMutex to be held */
+static int routeDiscoverLocked(void)
+{
+    MYSQL *conn;
+    MYSQL_RES **res;
+    MYSQL_ROW row;
+    tRoute *r, **pr;
+    int i, ret = 0;
+
+    res = (MYSQL_RES **)calloc(rtNum, sizeof(MYSQL_RES *));
+    for (i = rtNum - 1; i >= 0; i--) {
+        /* Servers known to be down are skipped until they are back */
+        if (!healthUp(i))
+            continue;
+        if ((conn = mysql_init(NULL)) == NULL) {
+            ret = -1;
+            break;
+        }
+        if (routeConnect(conn, i) != 0) {
+            mysql_close(conn);
+            if (i == 0)
+                ret = -1;
+            continue;
+        }
+
+        if (mysql_query(conn, "SHOW DATABASES") == 0)
+            res[i] = mysql_store_result(conn);
+        mysql_close(conn);
+    }
+
+    pthread_mutex_lock(&rtMutex);
+    for (i = 0; i < ROUTE_BUCKETS; i++)
+        for (r = rtBuckets[i]; r != NULL; r = r->next)
+            r->seen = 0;
+    for (i = rtNum - 1; i >= 0; i--)
+        if (res[i] != NULL)
+            while ((row = mysql_fetch_row(res[i])) != NULL)
+                if (row[0] != NULL)
+                    routeSet(row[0], i, 0);
+    for (i = 0; i < ROUTE_BUCKETS; i++) {
+        pr = &rtBuckets[i];
+        while ((r = *pr) != NULL) {
+            if ((!r->fixed) && (!r->seen) && (r->server < rtNum) && (res[r->server] != NULL)) {
+                DPRINTF("%s: Database %s is gone\n", __FUNCTION__, r->db);
+                *pr = r->next;
+                free(r->db);
+                free(r);
+            }
+            else
+                pr = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&rtMutex);
+
+    for (i = 0; i < rtNum; i++)
+        if (res[i] != NULL)
+            mysql_free_result(res[i]);
+    free(res);
+    rtDiscovered = time(NULL);
+
+    DPRINTF("%s: Discovered the databases of %d server(s)\n", __FUNCTION__, rtNum);
+    return ret;
+}
+
+int routeDiscover(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&rtDiscoverMutex);
+    ret = routeDiscoverLocked();
+    pthread_mutex_unlock(&rtDiscoverMutex);
+
+    return ret;
+}
+
+/* Discover again unless a discovery (possibly of another thread) ran
+   within the interval */
+static void routeRediscover(int interval)
+{
+    pthread_mutex_lock(&rtDiscoverMutex);
+    if (time(NULL) - rtDiscovered >= interval)
+        routeDiscoverLocked();
+    pthread_mutex_unlock(&rtDiscoverMutex);
+}
+
+/* Returns the index of the server owning the database, the first server
+   for the unknown ones (e.g. to be created) */
+int routeServer(const char *db)
+{
+    tRoute *r;
+    int server = -1;
+
+    if ((rtNum <= 1) || (db == NULL))
+        return 0;
+
+    pthread_mutex_lock(&rtMutex);
+    if ((r = routeFind(db)) != NULL)
+        server = r->server;
+    pthread_mutex_unlock(&rtMutex);
+
+    if ((server < 0) && (time(NULL) - rtDiscovered >= ROUTE_REDISCOVER)) {
+        routeRediscover(ROUTE_REDISCOVER);
+        pthread_mutex_lock(&rtMutex);
+        if ((r = routeFind(db)) != NULL)
+            server = r->server;
+        pthread_mutex_unlock(&rtMutex);
+    }
+
+    return (server < 0) ? 0 : server;
+}
+
+/* Database created or dropped through the mount */
+void routeCreated(const char *db)
+{
+    if (rtNum <= 1)
+        return;
+
+    pthread_mutex_lock(&rtMutex);
+    if (routeFind(db) == NULL)
+        routeSet(db, 0, 0);
+    pthread_mutex_unlock(&rtMutex);
+}
+
+void routeDropped(const char *db)
+{
+    tRoute *r;
+
+    if (rtNum <= 1)
+        return;
+
+    pthread_mutex_lock(&rtMutex);
+    if (((r = routeFind(db)) != NULL) && (!r->fixed))
+        routeRemove(db);
+    pthread_mutex_unlock(&rtMutex);
+}
+
+/* Pass the databases of all the servers to the filler, returns their
+   number. Single server mounts return -1 to list the server directly */
+int routeListing(void *buf, fuse_fill_dir_t filler)
+{
+    struct stat st;
+    tRoute *r;
+    int i, num = 0;
+
+    if (rtNum <= 1)
+        return -1;
+
+    if (time(NULL) - rtDiscovered >= ROUTE_TTL)
+        routeRediscover(ROUTE_TTL);
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    pthread_mutex_lock(&rtMutex);
+    for (i = 0; i < ROUTE_BUCKETS; i++)
+        for (r = rtBuckets[i]; r != NULL; r = r->next) {
+            if (filler != NULL)
+                filler(buf, r->db, &st, 0);
+            num++;
+        }
+    pthread_mutex_unlock(&rtMutex);
+
+    return num;
+}
+
+/* Connections of the background threads: conns has routeServers()
+   entries, the connection to the owner of db is opened on first use */
+MYSQL *routeConnection(MYSQL **conns, const char *db)
+{
+    int server;
+
+    server = routeServer(db);
+    if (!healthUp(server))
+        return NULL;
+
+    /* Reconnect if the last query lost the server */
+    if ((conns[server] != NULL) && (routeLost(conns[server]))) {
+        healthSuspect(server);
+        mysql_close(conns[server]);
+        conns[server] = NULL;
+    }
+
+    if ((conns[server] == NULL) && ((conns[server] = openConnection(db)) == NULL))
+        healthFailed(server);
+
+    return conns[server];
+}
+
+void routeCloseConnections(MYSQL **conns)
+{
+    int i;
+
+    for (i = 0; i < rtNum; i++)
+        if (conns[i] != NULL) {
+            mysql_close(conns[i]);
+            conns[i] = NULL;
+        }
+}
+
+static void routeThreadEnd(void *arg)
+{
+    tThreadConns *tc = (tThreadConns *)arg;
+    int i;
+
+    /* Every connection is closed at the address it was opened at */
+    for (i = 0; i < rtTotal; i++) {
+        if (!tc->open[i])
+            continue;
+        if (i != tc->cur)
+            memcpy(&sql, &tc->saved[i], sizeof(MYSQL));
+        mysql_close(&sql);
+    }
+    free(tc->open);
+    free(tc->gen);
+    free(tc->epoch);
+    free(tc->used);
+    free(tc->saved);
+    free(tc);
+    mysql_thread_end();
+}
+
+int routeStart(void)
+{
+    return pthread_key_create(&rtKey, routeThreadEnd);
+}
+
+/* Make the thread's sql the connection to the server */
+static int routeUse(int server)
+{
+    tThreadConns *tc;
+    time_t now;
+
+    if ((tc = (tThreadConns *)pthread_getspecific(rtKey)) == NULL) {
+        tc = (tThreadConns *)malloc( sizeof(tThreadConns) );
+        tc->cur = -1;
+        tc->open = (int *)calloc(rtTotal, sizeof(int));
+        tc->gen = (unsigned int *)calloc(rtTotal, sizeof(unsigned int));
+        tc->epoch = (unsigned int *)calloc(rtTotal, sizeof(unsigned int));
+        tc->used = (time_t *)calloc(rtTotal, sizeof(time_t));
+        tc->saved = (MYSQL *)calloc(rtTotal, sizeof(MYSQL));
+        pthread_setspecific(rtKey, tc);
+    }
+
+    if (tc->cur != server) {
+        if (tc->cur >= 0)
+            memcpy(&tc->saved[tc->cur], &sql, sizeof(MYSQL));
+        if (tc->open[server])
+            memcpy(&sql, &tc->saved[server], sizeof(MYSQL));
+        tc->cur = server;
+    }
+
+    /* Fail fast while the server is down, queries on the unconnected
+       handle fail without waiting for the network */
+    if (!healthUp(server)) {
+        if (tc->open[server] != ROUTE_OFFLINE) {
+            if (tc->open[server])
+                mysql_close(&sql);
+            mysql_init(&sql);
+            tc->open[server] = ROUTE_OFFLINE;
+        }
+        return -EIO;
+    }
+
+    /* Drop the connection if the server restarted since it was opened,
+       its last query lost the server or it failed the keepalive ping */
+    now = time(NULL);
+    if ((tc->open[server] == ROUTE_OFFLINE)
+        || ((tc->open[server]) && ((tc->epoch[server] != healthEpoch(server))
+            || (routeLost(&sql))
+            || ((mKeepalive > 0) && (now - tc->used[server] >= mKeepalive) && (mysql_ping(&sql) != 0))))) {
+        DPRINTF("%s: Dropping connection to server #%d\n", __FUNCTION__, server);
+        mysql_close(&sql);
+        tc->open[server] = 0;
+    }
+
+    if (!tc->open[server]) {
+        DPRINTF("%s: Opening connection to server #%d\n", __FUNCTION__, server);
+        if (mysql_init(&sql) == NULL)
+            return -EIO;
+        if ((routeConnect(&sql, server) != 0) || (snapshotBegin(&sql) != 0)) {
+            mysql_close(&sql);
+            mysql_init(&sql);
+            tc->open[server] = ROUTE_OFFLINE;
+            healthFailed(server);
+            return -EIO;
+        }
+        tc->open[server] = 1;
+        tc->gen[server] = snapshotGeneration();
+        tc->epoch[server] = healthEpoch(server);
+    }
+    tc->used[server] = now;
+
+    /* The snapshot has been replaced since the connection was used */
+    if (tc->gen[server] != snapshotGeneration()) {
+        mysql_query(&sql, "COMMIT");
+        if (snapshotBegin(&sql) != 0)
+            return -EIO;
+        tc->gen[server] = snapshotGeneration();
+    }
+    deadlineConnection(server, mysql_thread_id(&sql));
+
+    return 0;
+}
+
+/* Key of the first num path components, "" for the root */
+static void routeKey(const char *path, int num, char *key, size_t size)
+{
+    size_t len = 0;
+
+    while (*path == '/')
+        path++;
+
+    if (num > 0)
+        for (; (path[len] != 0) && (len < size - 1); len++)
+            if ((path[len] == '/') && (--num == 0))
+                break;
+
+    memcpy(key, path, len);
+    key[len] = 0;
+}
+
+/* Returns the time the key was last written, 0 if too long ago to matter */
+static time_t routePinned(const char *key)
+{
+    tPin *p;
+    time_t written = 0;
+
+    pthread_mutex_lock(&rpMutex);
+    for (p = rpPins[routeHash(key) % ROUTE_PIN_BUCKETS]; p != NULL; p = p->next)
+        if (strcmp(p->key, key) == 0) {
+            written = p->written;
+            break;
+        }
+    pthread_mutex_unlock(&rpMutex);
+
+    return written;
+}
+
+static void routePinKey(const char *key)
+{
+    tPin *p, **pp;
+    unsigned int h;
+    time_t now;
+
+    now = time(NULL);
+    h = routeHash(key) % ROUTE_PIN_BUCKETS;
+
+    pthread_mutex_lock(&rpMutex);
+    for (pp = &rpPins[h]; (p = *pp) != NULL; ) {
+        if (strcmp(p->key, key) == 0) {
+            p->written = now;
+            pthread_mutex_unlock(&rpMutex);
+            return;
+        }
+        /* No replica lagging this much is read from */
+        if (now - p->written > mReplicaMaxLag + REPLICA_INTERVAL + 1) {
+            *pp = p->next;
+            free(p->key);
+            free(p);
+            continue;
+        }
+        pp = &p->next;
+    }
+
+    p = (tPin *)malloc( sizeof(tPin) );
+    p->key = strdup(key);
+    p->written = now;
+    p->next = rpPins[h];
+    rpPins[h] = p;
+    pthread_mutex_unlock(&rpMutex);
+}
+
+/* The table (and its database) has been written on the primary */
+void routePin(const char *db, const char *tab)
+{
+    char key[1024];
+
+    if ((rpNum == 0) || (routeServer(db) != 0))
+        return;
+
+    routePinKey(db);
+    if (tab != NULL) {
+        snprintf(key, sizeof(key), "%s/%s", db, tab);
+        routePinKey(key);
+    }
+}
+
+/* Pick the replica to read the key from, 0 for the primary. Replicas are
+   taken in turn, in the snapshot mode the first usable one is kept */
+static int routeReplica(const char *key)
+{
+    time_t now, written;
+    unsigned int start;
+    int i, n, lag;
+
+    now = time(NULL);
+    written = routePinned(key);
+    start = snapshotEnabled() ? 0 : __sync_fetch_and_add(&rpNext, 1);
+
+    for (n = 0; n < rpNum; n++) {
+        i = (start + n) % rpNum;
+        if (((lag = rpLag[i]) < 0) || (!healthUp(rtNum + i)))
+            continue;
+        /* Worst case lag since the measurement */
+        lag += (now - rpMeasured[i]) + 1;
+        if (lag > mReplicaMaxLag)
+            continue;
+        if ((written > 0) && (now - written <= lag))
+            continue;
+        return rtNum + i;
+    }
+
+    return 0;
+}
+
+/* Pin the table and database of the path to the primary */
+static void routePinPath(const char *path)
+{
+    char key[1024];
+    int level;
+
+    level = getLevel(path);
+    routeKey(path, (level > 2) ? 2 : level, key, sizeof(key));
+    routePinKey(key);
+    if (level > 0) {
+        routeKey(path, ((level > 2) ? 2 : level) - 1, key, sizeof(key));
+        routePinKey(key);
+    }
+}
+
+/* Called at the start of the operations to route the path, the writes go
+   to the primary and pin the path to it from their start to their end */
+int routePath(const char *path, int write)
+{
+    char key[1024];
+    int level, server, ret;
+
+    snapshotCheck();
+
+    level = getLevel(path);
+    routeKey(path, 1, key, sizeof(key));
+    server = (level > 0) ? routeServer(key) : 0;
+
+    if ((rpNum > 0) && (server == 0)) {
+        if (write) {
+            routePinPath(path);
+            snprintf(rtWritePath, sizeof(rtWritePath), "%s", path);
+        }
+        else {
+            routeKey(path, (level > 2) ? 2 : level, key, sizeof(key));
+            server = routeReplica(key);
+        }
+    }
+
+    /* Reads may be answered from the caches while the server is down */
+    ret = routeUse(server);
+    rtOffline = (ret != 0) && (!write) && (flagIsSet(FLAG_STALE) || snapshotEnabled());
+
+    return rtOffline ? 0 : ret;
+}
+
+/* Returns 1 if the operation is served from the caches only */
+int routeOffline(void)
+{
+    return rtOffline;
+}
+
+/* Called at the end of the operations with their result */
+int routeEnd(int ret)
+{
+    tThreadConns *tc;
+
+    /* A write running longer than the lag of a replica would let the next
+       read go there before the replica has it */
+    if (rtWritePath[0] != 0) {
+        routePinPath(rtWritePath);
+        rtWritePath[0] = 0;
+    }
+
+    if (rtOffline) {
+        rtOffline = 0;
+        /* Anything not cached needed the server */
+        return (ret < 0) ? -EIO : ret;
+    }
+
+    /* The next operation reconnects, the server is checked at once */
+    if ((routeLost(&sql)) && ((tc = (tThreadConns *)pthread_getspecific(rtKey)) != NULL)
+        && (tc->cur >= 0))
+        healthSuspect(tc->cur);
+
+    return ret;
+}
+
+/* Returns the lag of the replica, -1 if it doesn't replicate */
+static int routeMeasureLag(MYSQL *conn)
+{
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    MYSQL_FIELD *fields;
+    unsigned int i, num;
+    int lag = -1;
+
+    /* The statement was renamed in MySQL 8.0.22 */
+    if ((mysql_query(conn, "SHOW REPLICA STATUS") != 0)
+        && (mysql_query(conn, "SHOW SLAVE STATUS") != 0))
+        return -1;
+    if ((res = mysql_store_result(conn)) == NULL)
+        return -1;
+
+    if ((row = mysql_fetch_row(res)) != NULL) {
+        num = mysql_num_fields(res);
+        fields = mysql_fetch_fields(res);
+        for (i = 0; i < num; i++)
+            if (((strcmp(fields[i].name, "Seconds_Behind_Source") == 0)
+                || (strcmp(fields[i].name, "Seconds_Behind_Master") == 0))
+                && (row[i] != NULL))
+                lag = atoi(row[i]);
+    }
+    mysql_free_result(res);
+
+    return lag;
+}
+
+static void *routeMonitor(void *arg)
+{
+    MYSQL **conns;
+    int i;
+    (void) arg;
+
+    mysql_thread_init();
+    conns = (MYSQL **)calloc(rpNum, sizeof(MYSQL *));
+    while (rpRunning) {
+        for (i = 0; i < rpNum; i++) {
+            if (conns[i] == NULL) {
+                if ((conns[i] = mysql_init(NULL)) == NULL)
+                    continue;
+                if (routeConnect(conns[i], rtNum + i) != 0) {
+                    mysql_close(conns[i]);
+                    conns[i] = NULL;
+                    rpLag[i] = -1;
+                    continue;
+                }
+            }
+
+            if ((rpLag[i] = routeMeasureLag(conns[i])) < 0) {
+                mysql_close(conns[i]);
+                conns[i] = NULL;
+            }
+            rpMeasured[i] = time(NULL);
+            DPRINTF("%s: Replica %s lags %d s\n", __FUNCTION__, rtServers[rtNum + i].host, rpLag[i]);
+        }
+        sleep(REPLICA_INTERVAL);
+    }
+
+    for (i = 0; i < rpNum; i++)
+        if (conns[i] != NULL)
+            mysql_close(conns[i]);
+    free(conns);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int routeReplicaStart(void)
+{
+    if (rpNum == 0)
+        return 0;
+
+    rpRunning = 1;
+    if (pthread_create(&rpThread, NULL, routeMonitor, NULL) != 0) {
+        fprintf(stderr, "Error: Cannot start the replica monitor thread\n");
+        rpRunning = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void routeReplicaStop(void)
+{
+    if (!rpRunning)
+        return;
+
+    rpRunning = 0;
+    pthread_join(rpThread, NULL);
+}
@@ -0,0 +1,412 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Scheduler: the operations of the FUSE threads enter through the sched*
+  functions. With --sched-slots at most the given number of operations
+  run at once, each class (metadata, reads, writes) up to its cap. The
+  other operations wait and are admitted by weighted fair queueing of the
+  flows of every uid and class: an operation gets a virtual finish time
+  of its flow's previous one (or the current virtual time) plus a cost
+  inversely proportional to the weights of its uid and class, the waiting
+  operation with the lowest finish time is admitted first. A metadata
+  request of an interactive user thus overtakes the reads queued by a
+  recursive grep of another user. The waiting operations block FUSE
+  worker threads, of which libfuse 2 runs at most 10: reads and writes
+  wait only while two workers remain for metadata requests, those wait
+  while one remains, and at most --sched-queue operations wait. Other
+  operations fail with EBUSY. flush, fsync and release are not scheduled:
+  release can't fail, the others end a write already admitted and only
+  wait for the write-behind threads or the last import batch.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_SCHED
+
+#ifdef DEBUG_SCHED
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "sched: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define SCHED_META              0
+#define SCHED_READ              1
+#define SCHED_WRITE             2
+#define SCHED_CLASSES           3
+
+/* Worker threads of fuse_loop_mt() in libfuse 2 */
+#define SCHED_WORKERS           10
+/* Workers left for metadata requests by waiting reads and writes */
+#define SCHED_META_RESERVE      2
+
+/* Virtual cost of an operation of weight 1 */
+#define SCHED_COST              1000000ULL
+
+typedef struct tSchedFlow {
+    uid_t uid;
+    int cls;
+    unsigned long long finish;
+    struct tSchedFlow *next;
+} tSchedFlow;
+
+typedef struct tSchedWaiter {
+    int cls;
+    unsigned long long start;
+    unsigned long long finish;
+    int granted;
+    pthread_cond_t cond;
+    struct tSchedWaiter *next;
+} tSchedWaiter;
+
+typedef struct tSchedWeight {
+    uid_t uid;
+    int weight;
+    struct tSchedWeight *next;
+} tSchedWeight;
+
+static const char *scClasses[SCHED_CLASSES] = { "meta", "read", "write" };
+/* Metadata requests are interactive, reads are the bulk */
+static const int scClassWeights[SCHED_CLASSES] = { 8, 1, 2 };
+/* Caps of the classes, 0 for the default share of the slots */
+static int scCaps[SCHED_CLASSES] = { 0 };
+
+static tSchedWeight *scWeights = NULL;
+static tSchedFlow *scFlows = NULL;
+static tSchedWaiter *scWaiters = NULL;
+static int scRunning[SCHED_CLASSES] = { 0 };
+static int scTotal = 0;
+static int scQueued = 0;
+static unsigned long long scVirtual = 0;
+static pthread_mutex_t scMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int scClass = -1;
+
+/* Parse a --sched-cap "class=n" setting */
+int schedParseCap(char *arg)
+{
+    char *val;
+    int i;
+
+    if ((val = strchr(arg, '=')) != NULL)
+        for (i = 0; i < SCHED_CLASSES; i++)
+            if ((strncmp(arg, scClasses[i], val - arg) == 0) && (strlen(scClasses[i]) == val - arg)) {
+                scCaps[i] = atoi(val + 1);
+                return 0;
+            }
+
+    fprintf(stderr, "Error: Invalid scheduler cap %s\n", arg);
+    return -1;
+}
+
+/* Parse a --sched-weight "uid=weight" setting */
+int schedParseWeight(char *arg)
+{
+    tSchedWeight *w;
+    char *val;
+
+    if (((val = strchr(arg, '=')) == NULL) || (atoi(val + 1) <= 0)) {
+        fprintf(stderr, "Error: Invalid scheduler weight %s\n", arg);
+        return -1;
+    }
+
+    w = (tSchedWeight *)malloc( sizeof(tSchedWeight) );
+    w->uid = atoi(arg);
+    w->weight = atoi(val + 1);
+    w->next = scWeights;
+    scWeights = w;
+
+    return 0;
+}
+
+/* Fill in the default caps: reads get up to 3/4 and writes up to 1/2 of
+   the slots so metadata requests always find one */
+void schedInit(void)
+{
+    int i;
+
+    if (mSchedSlots <= 0)
+        return;
+
+    if (scCaps[SCHED_META] <= 0)
+        scCaps[SCHED_META] = mSchedSlots;
+    if (scCaps[SCHED_READ] <= 0)
+        scCaps[SCHED_READ] = (mSchedSlots * 3 / 4 > 0) ? mSchedSlots * 3 / 4 : 1;
+    if (scCaps[SCHED_WRITE] <= 0)
+        scCaps[SCHED_WRITE] = (mSchedSlots / 2 > 0) ? mSchedSlots / 2 : 1;
+
+    for (i = 0; i < SCHED_CLASSES; i++)
+        DPRINTF("%s: Class %s capped at %d of %d slots\n", __FUNCTION__, scClasses[i],
+                scCaps[i], mSchedSlots);
+}
+
+void schedDump(void)
+{
+    int i;
+
+    printf("\tScheduler: %d slots, %d queued requests\n", mSchedSlots, mSchedQueue);
+    for (i = 0; i < SCHED_CLASSES; i++)
+        printf("\tScheduler cap of %s: %d\n", scClasses[i], scCaps[i]);
+}
+
+static int schedWeight(uid_t uid)
+{
+    tSchedWeight *w;
+
+    for (w = scWeights; w != NULL; w = w->next)
+        if (w->uid == uid)
+            return w->weight;
+
+    return 1;
+}
+
+/* Expects scMutex to be held */
+static tSchedFlow *schedFlow(uid_t uid, int cls)
+{
+    tSchedFlow *f;
+
+    for (f = scFlows; f != NULL; f = f->next)
+        if ((f->uid == uid) && (f->cls == cls))
+            return f;
+
+    f = (tSchedFlow *)malloc( sizeof(tSchedFlow) );
+    f->uid = uid;
+    f->cls = cls;
+    f->finish = 0;
+    f->next = scFlows;
+    scFlows = f;
+
+    return f;
+}
+
+/* Expects scMutex to be held */
+static int schedCanRun(int cls)
+{
+    return ((scTotal < mSchedSlots) && (scRunning[cls] < scCaps[cls])) ? 1 : 0;
+}
+
+/* Returns 1 if the operation may wait for a slot without taking the
+   last workers of the FUSE loop, expects scMutex to be held */
+static int schedCanWait(int cls)
+{
+    int reserve;
+
+    if ((mSchedQueue > 0) && (scQueued >= mSchedQueue))
+        return 0;
+
+    /* The running and waiting operations all hold a worker */
+    reserve = (cls == SCHED_META) ? 1 : SCHED_META_RESERVE;
+    return (scTotal + scQueued < SCHED_WORKERS - reserve) ? 1 : 0;
+}
+
+/* Admit the waiting operations in the order of their finish times while
+   there are free slots, expects scMutex to be held */
+static void schedDispatch(void)
+{
+    tSchedWaiter *w, **pw, **best;
+
+    while (1) {
+        best = NULL;
+        for (pw = &scWaiters; (w = *pw) != NULL; pw = &w->next)
+            if ((schedCanRun(w->cls)) && ((best == NULL) || (w->finish < (*best)->finish)))
+                best = pw;
+        if (best == NULL)
+            break;
+
+        w = *best;
+        *best = w->next;
+        scQueued--;
+        scRunning[w->cls]++;
+        scTotal++;
+        if (w->start > scVirtual)
+            scVirtual = w->start;
+        w->granted = 1;
+        pthread_cond_signal(&w->cond);
+    }
+}
+
+/* Wait for the turn of the operation, fails if too many are waiting */
+static int schedBegin(int cls)
+{
+    struct fuse_context *ctx;
+    tSchedWaiter w;
+    tSchedFlow *f;
+    uid_t uid;
+
+    if (mSchedSlots <= 0)
+        return 0;
+
+    ctx = fuse_get_context();
+    uid = (ctx != NULL) ? ctx->uid : 0;
+
+    pthread_mutex_lock(&scMutex);
+    if (((scWaiters != NULL) || (!schedCanRun(cls))) && (!schedCanWait(cls))) {
+        pthread_mutex_unlock(&scMutex);
+        DPRINTF("%s: Rejecting %s request of uid %d\n", __FUNCTION__, scClasses[cls], (int)uid);
+        return -EBUSY;
+    }
+
+    f = schedFlow(uid, cls);
+    w.cls = cls;
+    w.start = (f->finish > scVirtual) ? f->finish : scVirtual;
+    w.finish = w.start + SCHED_COST / (schedWeight(uid) * scClassWeights[cls]);
+    f->finish = w.finish;
+    scClass = cls;
+
+    /* Nothing waits for the slot */
+    if ((scWaiters == NULL) && (schedCanRun(cls))) {
+        scRunning[cls]++;
+        scTotal++;
+        if (w.start > scVirtual)
+            scVirtual = w.start;
+        pthread_mutex_unlock(&scMutex);
+        return 0;
+    }
+
+    w.granted = 0;
+    pthread_cond_init(&w.cond, NULL);
+    w.next = scWaiters;
+    scWaiters = &w;
+    scQueued++;
+    schedDispatch();
+    while (!w.granted)
+        pthread_cond_wait(&w.cond, &scMutex);
+    pthread_mutex_unlock(&scMutex);
+    pthread_cond_destroy(&w.cond);
+
+    return 0;
+}
+
+static int schedEnd(int ret)
+{
+    if (scClass < 0)
+        return ret;
+
+    pthread_mutex_lock(&scMutex);
+    scRunning[scClass]--;
+    scTotal--;
+    schedDispatch();
+    pthread_mutex_unlock(&scMutex);
+    scClass = -1;
+
+    return ret;
+}
+
+/* Operations run scheduled and under the deadline of their class */
+int schedGetattr(const char *path, struct stat *stbuf)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_META)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_STAT);
+    return schedEnd(deadlineEnd(fmysql_getattr(path, stbuf)));
+}
+
+int schedReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
+                 off_t offset, struct fuse_file_info *fi)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_META)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_LIST);
+    return schedEnd(deadlineEnd(fmysql_readdir(path, buf, filler, offset, fi)));
+}
+
+int schedReadlink(const char *path, char *buf, size_t size)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_META)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_STAT);
+    return schedEnd(deadlineEnd(fmysql_readlink(path, buf, size)));
+}
+
+int schedRead(const char *path, char *buf, size_t size, off_t offset,
+              struct fuse_file_info *fi)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_READ)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_READ);
+    return schedEnd(deadlineEnd(fmysql_read(path, buf, size, offset, fi)));
+}
+
+int schedOpen(const char *path, struct fuse_file_info *fi)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_META)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_STAT);
+    return schedEnd(deadlineEnd(fmysql_open(path, fi)));
+}
+
+int schedMkdir(const char *path, mode_t mode)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_mkdir(path, mode)));
+}
+
+int schedRmdir(const char *path)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_rmdir(path)));
+}
+
+int schedRm(const char *path)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_rm(path)));
+}
+
+int schedCreate(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_create(path, mode, fi)));
+}
+
+int schedTruncate(const char *path, off_t size)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_truncate(path, size)));
+}
+
+int schedWrite(const char *path, const char *buf, size_t size, off_t offset,
+               struct fuse_file_info *fi)
+{
+    int ret;
+
+    if ((ret = schedBegin(SCHED_WRITE)) != 0)
+        return ret;
+    deadlineBegin(DEADLINE_WRITE);
+    return schedEnd(deadlineEnd(fmysql_write(path, buf, size, offset, fi)));
+}
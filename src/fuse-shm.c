@@ -0,0 +1,372 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Shared cache: with --shared-cache the table catalogs and the getattr
+  results are also kept in a POSIX shared memory segment named after the
+  option, so the mounts of the host using the same name, user and servers
+  share their warm state instead of each querying the server. The
+  attributes are shared only by the mounts which also agree on the options
+  changing them (read-only, mtime column and compression). The segment
+  holds fixed size slots of open addressing hash tables (one per kind of
+  entry) read without locks: every slot has a sequence number that is odd
+  while the slot is written, a reader that sees the number change while
+  copying the slot takes it as a miss. Invalidation increments
+  the generation counters of the table, database or whole kind in the
+  segment header, an entry stored under older generations is not used.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_SHM
+
+#ifdef DEBUG_SHM
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "shm: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC               0x66736462
+#define SHM_VERSION             1
+/* Generation counters per kind, tables and databases share them by hash */
+#define SHM_GENS                1024
+/* Slots tried for a key before the oldest one is replaced */
+#define SHM_PROBES              8
+/* Time to wait for another process initializing the segment in ms */
+#define SHM_INIT_WAIT           1000
+
+/* Generation sets of the SHM_GENS counters */
+#define GEN_DB                  0
+#define GEN_DIR                 1
+#define GEN_TAB                 2
+
+typedef struct tShmKind {
+    unsigned long long offset;
+    unsigned int slotSize;
+    unsigned int slots;
+    unsigned long long global;
+    unsigned long long root;
+    unsigned long long gens[3][SHM_GENS];
+} tShmKind;
+
+typedef struct tShmHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long size;
+    tShmKind kinds[SHM_KINDS];
+} tShmHeader;
+
+typedef struct tShmSlot {
+    /* Odd while the slot is written */
+    unsigned int seq;
+    unsigned int hash;
+    unsigned short keyLen;
+    unsigned short kind;
+    unsigned int valLen;
+    /* Namespace of the user and servers the entry comes from */
+    unsigned long long ns;
+    unsigned long long gens[3];
+    long long stored;
+    /* The key followed by the value */
+    char data[];
+} tShmSlot;
+
+/* Slot sizes and shares of the segment in 1/8 of the kinds: the getattr
+   results are small and many, the catalogs hold whole column lists */
+static const unsigned int shSlotSizes[SHM_KINDS] = { 512, 4096 };
+static const unsigned int shShares[SHM_KINDS] = { 7, 1 };
+
+static tShmHeader *shHeader = NULL;
+/* Namespaces of the entries of the kinds */
+static unsigned long long shNs[SHM_KINDS];
+
+static unsigned long long shmHash(unsigned long long h, const char *str)
+{
+    /* FNV-1a */
+    if (str != NULL)
+        while (*str)
+            h = (h ^ (unsigned char)*str++) * 0x100000001b3ULL;
+
+    return (h ^ 0xff) * 0x100000001b3ULL;
+}
+
+int shmEnabled(void)
+{
+    return (shHeader != NULL) ? 1 : 0;
+}
+
+void shmDump(void)
+{
+    printf("\tShared cache: %s, %ld bytes\n", mSharedCache ? mSharedCache : "None", mSharedCacheSize);
+}
+
+/* Lay out the slots of a new segment, the magic is stored last */
+static void shmInit(tShmHeader *h, unsigned long long size)
+{
+    unsigned long long offset, avail;
+    int i;
+
+    offset = (sizeof(tShmHeader) + 4095) & ~4095ULL;
+    avail = size - offset;
+    h->version = SHM_VERSION;
+    h->size = size;
+    for (i = 0; i < SHM_KINDS; i++) {
+        h->kinds[i].offset = offset;
+        h->kinds[i].slotSize = shSlotSizes[i];
+        h->kinds[i].slots = avail / 8 * shShares[i] / shSlotSizes[i];
+        offset += (unsigned long long)h->kinds[i].slots * shSlotSizes[i];
+    }
+    __atomic_store_n(&h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+/* Open or create the segment, the mounts sharing it have to use the same
+   size and version */
+int shmStart(void)
+{
+    char name[256];
+    struct stat st;
+    tShmHeader *h;
+    char *opts;
+    int fd, i, created = 1;
+
+    /* The snapshots of the mounts differ */
+    if ((mSharedCache == NULL) || (flagIsSet(FLAG_SNAPSHOT)))
+        return 0;
+
+    if ((mSharedCacheSize < (long)(sizeof(tShmHeader) + 65536)) || (strchr(mSharedCache, '/') != NULL)) {
+        fprintf(stderr, "Error: Invalid shared cache %s of %ld bytes\n", mSharedCache, mSharedCacheSize);
+        return -1;
+    }
+
+    snprintf(name, sizeof(name), "/fuse-db-%s", mSharedCache);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        created = 0;
+        if ((errno != EEXIST) || ((fd = shm_open(name, O_RDWR, 0600)) < 0)) {
+            fprintf(stderr, "Error: Cannot open shared cache %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+    }
+
+    if ((created) && (ftruncate(fd, mSharedCacheSize) != 0)) {
+        fprintf(stderr, "Error: Cannot size shared cache %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    /* The creator may not have sized it yet */
+    for (i = 0; i < SHM_INIT_WAIT / 10; i++) {
+        if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+            break;
+        usleep(10000);
+    }
+    if ((i == SHM_INIT_WAIT / 10) || (st.st_size < (off_t)sizeof(tShmHeader))) {
+        fprintf(stderr, "Error: Shared cache %s is not initialized, remove /dev/shm%s\n", name, name);
+        close(fd);
+        return -1;
+    }
+
+    h = (tShmHeader *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map shared cache %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    if (created)
+        shmInit(h, st.st_size);
+    for (i = 0; (i < SHM_INIT_WAIT / 10) && (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC); i++)
+        usleep(10000);
+
+    if ((h->magic != SHM_MAGIC) || (h->version != SHM_VERSION) || (h->size != (unsigned long long)st.st_size)) {
+        fprintf(stderr, "Error: Shared cache %s is not compatible, remove /dev/shm%s\n", name, name);
+        munmap(h, st.st_size);
+        return -1;
+    }
+    if (h->size != (unsigned long long)mSharedCacheSize)
+        fprintf(stderr, "Warning: Using the existing shared cache %s of %llu bytes\n", name, h->size);
+
+    shNs[SHM_CATALOG] = shmHash(shmHash(0xcbf29ce484222325ULL, mUser), mServer);
+    opts = compressList();
+    shNs[SHM_ATTR] = shmHash(shmHash(shmHash(shNs[SHM_CATALOG],
+                                             flagIsSet(FLAG_READONLY) ? "ro" : "rw"),
+                                     mMtimeColumn), opts);
+    free(opts);
+    shHeader = h;
+
+    DPRINTF("%s: %s shared cache %s of %llu bytes\n", __FUNCTION__, created ? "Created" : "Attached",
+            name, h->size);
+    return 0;
+}
+
+static unsigned long long *shmCounter(tShmKind *k, int set, const char *db, const char *tab)
+{
+    unsigned long long h;
+
+    h = shmHash(0xcbf29ce484222325ULL, db);
+    if (tab != NULL)
+        h = shmHash(h, tab);
+
+    return &k->gens[set][h % SHM_GENS];
+}
+
+/* Current generations of the entries of db/tab, the whole kind if db is
+   NULL and the database directory if tab is NULL */
+static void shmGenerations(tShmKind *k, const char *db, const char *tab, unsigned long long *gens)
+{
+    gens[0] = __atomic_load_n(&k->global, __ATOMIC_ACQUIRE);
+    if (db == NULL) {
+        gens[1] = __atomic_load_n(&k->root, __ATOMIC_ACQUIRE);
+        gens[2] = 0;
+        return;
+    }
+
+    gens[1] = __atomic_load_n(shmCounter(k, GEN_DB, db, NULL), __ATOMIC_ACQUIRE);
+    if (tab == NULL)
+        gens[2] = __atomic_load_n(shmCounter(k, GEN_DIR, db, NULL), __ATOMIC_ACQUIRE);
+    else
+        gens[2] = __atomic_load_n(shmCounter(k, GEN_TAB, db, tab), __ATOMIC_ACQUIRE);
+}
+
+static tShmSlot *shmSlot(tShmKind *k, unsigned int idx)
+{
+    return (tShmSlot *)((char *)shHeader + k->offset + (unsigned long long)(idx % k->slots) * k->slotSize);
+}
+
+/* Copy the value of the key to val, returns its length or -1 if there is
+   no valid entry. The tag gets the generations to store a fetched value
+   with, they are taken before the value is fetched so an invalidation
+   in the meantime is not lost */
+int shmGet(int kind, const char *db, const char *tab, const char *key, void *val, int size,
+           time_t *stored, tShmTag *tag)
+{
+    unsigned long long gens[3];
+    unsigned int seq, hash;
+    char buf[4096];
+    tShmKind *k;
+    tShmSlot *s;
+    int i, keyLen, len;
+
+    if (!shmEnabled())
+        return -1;
+
+    k = &shHeader->kinds[kind];
+    shmGenerations(k, db, tab, tag->gens);
+    keyLen = strlen(key);
+    hash = (unsigned int)shmHash(shNs[kind], key);
+
+    for (i = 0; i < SHM_PROBES; i++) {
+        s = shmSlot(k, hash + i);
+        if (((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) || (s->hash != hash)
+            || (s->kind != kind) || (s->keyLen != keyLen) || (s->ns != shNs[kind]))
+            continue;
+
+        len = s->valLen;
+        if ((keyLen + len > (int)(k->slotSize - sizeof(tShmSlot))) || (len > size))
+            continue;
+        memcpy(buf, s->data, keyLen + len);
+        memcpy(gens, s->gens, sizeof(gens));
+        *stored = s->stored;
+        /* The slot changed while copied */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq)
+            continue;
+
+        if ((memcmp(buf, key, keyLen) != 0) || (memcmp(gens, tag->gens, sizeof(gens)) != 0))
+            continue;
+
+        memcpy(val, buf + keyLen, len);
+        DPRINTF("%s: Hit %s in slot %u\n", __FUNCTION__, key, (hash + i) % k->slots);
+        return len;
+    }
+
+    return -1;
+}
+
+/* Store the value of the key fetched under the generations of the tag,
+   the entry is dropped if another process writes the slot */
+void shmPut(int kind, const char *key, const void *val, int len, tShmTag *tag)
+{
+    tShmSlot *s, *target = NULL;
+    unsigned int seq, hash;
+    long long oldest = 0;
+    tShmKind *k;
+    int i, keyLen;
+
+    if (!shmEnabled())
+        return;
+
+    k = &shHeader->kinds[kind];
+    keyLen = strlen(key);
+    if ((keyLen + len > (int)(k->slotSize - sizeof(tShmSlot))) || (keyLen > 65535))
+        return;
+    hash = (unsigned int)shmHash(shNs[kind], key);
+
+    /* The slot of the key, otherwise an empty or the oldest one */
+    for (i = 0; i < SHM_PROBES; i++) {
+        s = shmSlot(k, hash + i);
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) & 1)
+            continue;
+        if ((s->hash == hash) && (s->kind == kind) && (s->keyLen == keyLen) && (s->ns == shNs[kind])
+            && (memcmp(s->data, key, keyLen) == 0)) {
+            target = s;
+            break;
+        }
+        if ((target == NULL) || (s->stored < oldest)) {
+            target = s;
+            oldest = s->stored;
+        }
+    }
+    if (target == NULL)
+        return;
+
+    seq = __atomic_load_n(&target->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) || (!__atomic_compare_exchange_n(&target->seq, &seq, seq + 1, 0,
+                                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)))
+        return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    target->hash = hash;
+    target->kind = kind;
+    target->keyLen = keyLen;
+    target->valLen = len;
+    target->ns = shNs[kind];
+    memcpy(target->gens, tag->gens, sizeof(target->gens));
+    target->stored = time(NULL);
+    memcpy(target->data, key, keyLen);
+    memcpy(target->data + keyLen, val, len);
+
+    __atomic_store_n(&target->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Invalidate the entries of the table along with the directories of its
+   database and the root, of the whole database if tab is NULL and
+   everything if db is NULL */
+void shmInvalidate(int kind, const char *db, const char *tab)
+{
+    tShmKind *k;
+
+    if (shHeader == NULL)
+        return;
+
+    k = &shHeader->kinds[kind];
+    if (db == NULL) {
+        __atomic_add_fetch(&k->global, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    if (tab == NULL)
+        __atomic_add_fetch(shmCounter(k, GEN_DB, db, NULL), 1, __ATOMIC_RELEASE);
+    else
+        __atomic_add_fetch(shmCounter(k, GEN_TAB, db, tab), 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(shmCounter(k, GEN_DIR, db, NULL), 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&k->root, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,107 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Snapshot mode: with --snapshot the mount is read-only and every
+  connection runs inside a REPEATABLE READ transaction started WITH
+  CONSISTENT SNAPSHOT, so the data cannot change under the mount and the
+  caches are kept without revalidation. SIGHUP requests a new snapshot,
+  the next operation drops all the cached data and every connection
+  commits its old transaction and starts a new one before its next query.
+  The mount runs single-threaded so there is one snapshot per server.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_SNAPSHOT
+
+#ifdef DEBUG_SNAPSHOT
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "snapshot: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+static volatile sig_atomic_t snRefresh = 0;
+static pthread_mutex_t snMutex = PTHREAD_MUTEX_INITIALIZER;
+static time_t snStarted = 0;
+static volatile unsigned int snGeneration = 0;
+
+int snapshotEnabled(void)
+{
+    return flagIsSet(FLAG_SNAPSHOT);
+}
+
+/* Start the snapshot transaction on the connection */
+int snapshotBegin(MYSQL *conn)
+{
+    if (!snapshotEnabled())
+        return 0;
+
+    if ((mysql_query(conn, "SET SESSION TRANSACTION ISOLATION LEVEL REPEATABLE READ") != 0)
+        || (mysql_query(conn, "START TRANSACTION WITH CONSISTENT SNAPSHOT, READ ONLY") != 0)) {
+        fprintf(stderr, "Error: Cannot start the snapshot: %s\n", mysql_error(conn));
+        return -EIO;
+    }
+
+    DPRINTF("%s: Snapshot started on connection %lu\n", __FUNCTION__, mysql_thread_id(conn));
+    return 0;
+}
+
+static void snapshotSignal(int sig)
+{
+    (void) sig;
+
+    snRefresh = 1;
+}
+
+/* Install the refresh signal handler, has to be called after fuse_main()
+   set up its own handlers as FUSE terminates on SIGHUP by default */
+void snapshotStart(void)
+{
+    struct sigaction sa;
+
+    if (!snapshotEnabled())
+        return;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = snapshotSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+
+    snStarted = time(NULL);
+}
+
+/* Connections whose snapshot is older than the generation start a new one */
+unsigned int snapshotGeneration(void)
+{
+    return snGeneration;
+}
+
+/* Rotate to a new snapshot if requested, called at the start of the
+   operations. The cached data belongs to the old snapshot */
+void snapshotCheck(void)
+{
+    if ((!snapshotEnabled()) || (!snRefresh))
+        return;
+
+    pthread_mutex_lock(&snMutex);
+    if (snRefresh) {
+        snRefresh = 0;
+        snGeneration++;
+
+        pathCacheClear();
+        rowCacheInvalidate(NULL, NULL, NULL);
+        catalogInvalidate(NULL, NULL);
+
+        DPRINTF("%s: Snapshot of %ld replaced\n", __FUNCTION__, (long)snStarted);
+        snStarted = time(NULL);
+    }
+    pthread_mutex_unlock(&snMutex);
+}
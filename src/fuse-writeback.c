@@ -0,0 +1,604 @@
+/*
+  MySQL FUSE Connector
+  Designed and written by Michal Novotny <mignov@gmail.com> in 2010
+
+  Write-behind queue: column values written through the mount are kept in
+  memory and write() returns immediately. A pool of flusher threads, each
+  using its own connection, applies the queued values using UPDATE queries.
+  Repeated writes to a column not being flushed yet are merged into one
+  update. Dirty columns of the same row are held for a short time and then
+  written together using a single multi-column UPDATE of the row. Flush and
+  fsync wait for the column (fsyncdir for the row) to be written and
+  failures are reported by the next operation on the file, -ENOENT if the
+  row was deleted before the values were written.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+//#define DEBUG_WRITEBACK
+
+#ifdef DEBUG_WRITEBACK
+#define DPRINTF(fmt, ...) \
+do { fprintf(stderr, "writeback: " fmt , ## __VA_ARGS__); } while (0)
+#else
+#define DPRINTF(fmt, ...) \
+do {} while(0)
+#endif
+
+#include "fuse-db.h"
+#include <pthread.h>
+
+#define WB_DIRTY        0
+#define WB_FLUSHING     1
+
+typedef struct tWriteback {
+    char *path;
+    char *db;
+    char *tab;
+    char *pkVal;
+    char *col;
+    char *data;
+    unsigned long len;
+    unsigned long gen;
+    unsigned long long dirtySince;
+    int state;
+    int urgent;
+    struct tWriteback *next;
+    struct tWriteback *batch;
+    unsigned long batchGen;
+    unsigned long batchLen;
+    char *batchData;
+} tWriteback;
+
+typedef struct tWritebackError {
+    char *path;
+    int err;
+    struct tWritebackError *next;
+} tWritebackError;
+
+static tWriteback *wbQueue = NULL;
+static tWritebackError *wbErrors = NULL;
+static pthread_mutex_t wbMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wbDirtyCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wbDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t *wbThreads = NULL;
+static int wbRunning = 0;
+
+static unsigned long long writebackNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int writebackSameRow(tWriteback *a, tWriteback *b)
+{
+    return ((strcmp(a->pkVal, b->pkVal) == 0) && (strcmp(a->tab, b->tab) == 0)
+            && (strcmp(a->db, b->db) == 0)) ? 1 : 0;
+}
+
+/* All the functions below expect wbMutex to be held */
+static tWriteback *writebackFind(const char *path)
+{
+    tWriteback *wb;
+
+    for (wb = wbQueue; wb != NULL; wb = wb->next)
+        if (strcmp(wb->path, path) == 0)
+            return wb;
+
+    return NULL;
+}
+
+static void writebackRemove(tWriteback *wb)
+{
+    tWriteback **p;
+
+    for (p = &wbQueue; *p != NULL; p = &(*p)->next)
+        if (*p == wb) {
+            *p = wb->next;
+            break;
+        }
+
+    free(wb->path);
+    free(wb->db);
+    free(wb->tab);
+    free(wb->pkVal);
+    free(wb->col);
+    free(wb->data);
+    free(wb);
+}
+
+static void writebackSetError(const char *path, int err)
+{
+    tWritebackError *we;
+
+    we = (tWritebackError *)malloc( sizeof(tWritebackError) );
+    we->path = strdup(path);
+    we->err = err;
+    we->next = wbErrors;
+    wbErrors = we;
+}
+
+static int writebackPopError(const char *path)
+{
+    tWritebackError **p, *we;
+    int err;
+
+    for (p = &wbErrors; *p != NULL; p = &(*p)->next)
+        if ((path == NULL) || (strcmp((*p)->path, path) == 0)) {
+            we = *p;
+            *p = we->next;
+            err = we->err;
+            free(we->path);
+            free(we);
+            return err;
+        }
+
+    return 0;
+}
+
+/* Read the current value of the column, expected to be called without
+   wbMutex held */
+static char *writebackLoad(const char *path, unsigned long *len)
+{
+    char qry[4096] = { 0 };
+    char *tab, *where, *val = NULL;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    *len = 0;
+    tab = getPathComponent(path, 1);
+
+    mysql_select_db(&sql, getPathComponent(path, 0));
+    if ((where = keyWhere(sql, tab, getPathComponent(path, 2))) == NULL)
+        return NULL;
+    snprintf(qry, sizeof(qry), "SELECT `%s` FROM `%s` WHERE %s",
+             getPathComponent(path, 3), tab, where);
+    free(where);
+
+    if (mysql_real_query(&sql, qry, strlen(qry)) != 0) {
+        DPRINTF("%s: Query '%s' failed: %s\n", __FUNCTION__, qry, mysql_error(&sql));
+        return NULL;
+    }
+
+    res = mysql_store_result(&sql);
+    if ((res != NULL) && ((row = mysql_fetch_row(res)) != NULL) && (row[0] != NULL)) {
+        *len = mysql_fetch_lengths(res)[0];
+        val = (char *)malloc( (*len + 1) * sizeof(char) );
+        memcpy(val, row[0], *len);
+        val[*len] = 0;
+    }
+    mysql_free_result(res);
+
+    if ((val != NULL) && (compressPath(path))) {
+        unsigned long dlen;
+        char *dec;
+
+        if ((dec = compressDecode(val, *len, &dlen)) != NULL) {
+            free(val);
+            val = dec;
+            *len = dlen;
+        }
+    }
+
+    return val;
+}
+
+/* Returns the queued entry for the path, creating it from the current
+   value in the database if necessary. Returns with wbMutex held */
+static tWriteback *writebackAcquire(const char *path, int loadValue)
+{
+    tWriteback *wb;
+    unsigned long len = 0;
+    char *data = NULL;
+
+    pthread_mutex_lock(&wbMutex);
+    if ((wb = writebackFind(path)) != NULL)
+        return wb;
+    pthread_mutex_unlock(&wbMutex);
+
+    if (loadValue)
+        data = writebackLoad(path, &len);
+
+    pthread_mutex_lock(&wbMutex);
+    if ((wb = writebackFind(path)) != NULL) {
+        /* Somebody else has queued the column meanwhile */
+        free(data);
+        return wb;
+    }
+
+    wb = (tWriteback *)malloc( sizeof(tWriteback) );
+    memset(wb, 0, sizeof(tWriteback));
+    wb->path = strdup(path);
+    wb->db = strdup(getPathComponent(path, 0));
+    wb->tab = strdup(getPathComponent(path, 1));
+    wb->pkVal = strdup(getPathComponent(path, 2));
+    wb->col = strdup(getPathComponent(path, 3));
+    wb->data = data;
+    wb->len = len;
+    wb->state = WB_DIRTY;
+    wb->dirtySince = writebackNow();
+
+    /* Append to keep the updates in the order of the first write */
+    if (wbQueue == NULL)
+        wbQueue = wb;
+    else {
+        tWriteback *last;
+
+        for (last = wbQueue; last->next != NULL; last = last->next) ;
+        last->next = wb;
+    }
+
+    return wb;
+}
+
+static void writebackResize(tWriteback *wb, unsigned long len)
+{
+    wb->data = (char *)realloc(wb->data, (len + 1) * sizeof(char));
+    if (len > wb->len)
+        memset(wb->data + wb->len, 0, len - wb->len);
+    wb->data[len] = 0;
+    wb->len = len;
+}
+
+int writebackEnabled(void)
+{
+    return (mWriteBehind > 0) ? 1 : 0;
+}
+
+/* Primary key columns are refused like by the direct writes */
+static int writebackIsReadOnly(const char *path)
+{
+    mysql_select_db(&sql, getPathComponent(path, 0));
+    return isReadOnly(sql, path, getPathComponent(path, 1));
+}
+
+int writebackWrite(const char *path, const char *buf, size_t size, off_t offset)
+{
+    tWriteback *wb;
+    int err;
+
+    if (writebackIsReadOnly(path))
+        return -EPERM;
+
+    pthread_mutex_lock(&wbMutex);
+    err = writebackPopError(path);
+    pthread_mutex_unlock(&wbMutex);
+    if (err != 0)
+        return err;
+
+    wb = writebackAcquire(path, 1);
+    if (offset + size > wb->len)
+        writebackResize(wb, offset + size);
+    memcpy(wb->data + offset, buf, size);
+    wb->gen++;
+    pthread_cond_signal(&wbDirtyCond);
+    pthread_mutex_unlock(&wbMutex);
+
+    DPRINTF("%s: Queued %lu bytes at %lld for %s\n", __FUNCTION__, (unsigned long)size,
+            (long long)offset, path);
+    return size;
+}
+
+int writebackTruncate(const char *path, off_t size)
+{
+    tWriteback *wb;
+
+    if (writebackIsReadOnly(path))
+        return -EPERM;
+
+    /* Truncating to zero doesn't need the old value */
+    wb = writebackAcquire(path, (size > 0));
+    writebackResize(wb, size);
+    wb->gen++;
+    pthread_cond_signal(&wbDirtyCond);
+    pthread_mutex_unlock(&wbMutex);
+
+    return 0;
+}
+
+/* Copy of the queued value of the column, NULL if nothing is queued */
+char *writebackRead(const char *path, unsigned long *len)
+{
+    tWriteback *wb;
+    char *val = NULL;
+
+    pthread_mutex_lock(&wbMutex);
+    if ((wb = writebackFind(path)) != NULL) {
+        val = (char *)malloc( (wb->len + 1) * sizeof(char) );
+        if (wb->len > 0)
+            memcpy(val, wb->data, wb->len);
+        val[wb->len] = 0;
+        *len = wb->len;
+    }
+    pthread_mutex_unlock(&wbMutex);
+
+    return val;
+}
+
+/* Size of the queued value as reported by getattr, consistent with the
+   trailing newline added by mysql_read() */
+int writebackStat(const char *path, struct stat *stbuf)
+{
+    tWriteback *wb;
+    int ret = 0;
+
+    pthread_mutex_lock(&wbMutex);
+    if ((wb = writebackFind(path)) != NULL) {
+        stbuf->st_size = (wb->len > 0) ? wb->len + 1 : 0;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&wbMutex);
+
+    return ret;
+}
+
+/* Mark the entries matching the path as not to be held any longer and
+   return their number. Level 3 paths match all the columns of the row,
+   NULL matches everything */
+static int writebackMarkUrgent(const char *path)
+{
+    tWriteback *wb;
+    int num = 0, len;
+
+    len = (path != NULL) ? strlen(path) : 0;
+    for (wb = wbQueue; wb != NULL; wb = wb->next)
+        if ((path == NULL) || (strcmp(wb->path, path) == 0)
+            || ((getLevel(path) == 3) && (strncmp(wb->path, path, len) == 0)
+                && (wb->path[len] == '/'))) {
+            wb->urgent = 1;
+            num++;
+        }
+
+    return num;
+}
+
+/* Wait until the queued value of the path, all the values of the row for
+   row directories or all queued values if path is NULL, is written to the
+   database and return the pending error */
+int writebackSync(const char *path)
+{
+    int err = 0, len;
+
+    pthread_mutex_lock(&wbMutex);
+    while (writebackMarkUrgent(path) > 0) {
+        pthread_cond_broadcast(&wbDirtyCond);
+        pthread_cond_wait(&wbDoneCond, &wbMutex);
+    }
+
+    if ((path != NULL) && (getLevel(path) == 3)) {
+        tWritebackError *we;
+
+        /* Report the first error of any column of the row */
+        len = strlen(path);
+        for (we = wbErrors; we != NULL; we = we->next)
+            if ((strncmp(we->path, path, len) == 0) && (we->path[len] == '/'))
+                break;
+        if (we != NULL)
+            err = writebackPopError(we->path);
+    }
+    else
+        err = writebackPopError(path);
+    pthread_mutex_unlock(&wbMutex);
+
+    return err;
+}
+
+/* Write the batch of columns of one row using a single UPDATE */
+static int writebackFlush(MYSQL *conn, tWriteback *batch)
+{
+    tWriteback *wb;
+    char *qry, *where, *enc;
+    unsigned long size, encLen;
+    int ret = 0;
+
+    if (mysql_select_db(conn, batch->db) != 0)
+        return -EIO;
+
+    if ((where = keyWhere(*conn, batch->tab, batch->pkVal)) == NULL)
+        return -EIO;
+
+    size = strlen(batch->tab) + strlen(where) + 64;
+    for (wb = batch; wb != NULL; wb = wb->batch) {
+        /* The batch copies are ours, replace them by the values to store */
+        if ((compressColumn(batch->db, batch->tab, wb->col))
+            && ((enc = compressEncode(wb->batchData, wb->batchLen, &encLen)) != NULL)) {
+            free(wb->batchData);
+            wb->batchData = enc;
+            wb->batchLen = encLen;
+        }
+        size += 2 * wb->batchLen + strlen(wb->col) + 16;
+    }
+
+    qry = (char *)malloc( size * sizeof(char) );
+    snprintf(qry, size, "UPDATE `%s` SET ", batch->tab);
+    for (wb = batch; wb != NULL; wb = wb->batch) {
+        snprintf(qry + strlen(qry), size - strlen(qry), "%s`%s` = '",
+                 (wb == batch) ? "" : ", ", wb->col);
+        mysql_real_escape_string(conn, qry + strlen(qry), wb->batchData, wb->batchLen);
+        strcat(qry, "'");
+    }
+    snprintf(qry + strlen(qry), size - strlen(qry), " WHERE %s", where);
+
+    DPRINTF("%s: Flushing row %s/%s/%s\n", __FUNCTION__, batch->db, batch->tab, batch->pkVal);
+    if (mysql_real_query(conn, qry, strlen(qry)) != 0) {
+        DPRINTF("%s: Query for %s failed: %s\n", __FUNCTION__, batch->path, mysql_error(conn));
+        ret = -EIO;
+    }
+    else
+    if (mysql_affected_rows(conn) == 0) {
+        /* The row was deleted since the write, the values are lost */
+        DPRINTF("%s: Row of %s is gone\n", __FUNCTION__, batch->path);
+        ret = -ENOENT;
+    }
+    routePin(batch->db, batch->tab);
+
+    free(qry);
+    free(where);
+    return ret;
+}
+
+/* Pick the row to be flushed next and chain its dirty columns using the
+   batch pointer. Rows are held until the oldest column is mCoalesceTime
+   ms old, mCoalesceColumns columns are dirty or a sync is requested.
+   Returns NULL and the time to wait in wait if nothing can be flushed */
+static tWriteback *writebackNextBatch(unsigned long long *wait)
+{
+    tWriteback *wb, *other, *last;
+    unsigned long long now, oldest, due;
+    int num, urgent, busy;
+
+    now = writebackNow();
+    *wait = 0;
+
+    for (wb = wbQueue; wb != NULL; wb = wb->next) {
+        if (wb->state != WB_DIRTY)
+            continue;
+
+        num = urgent = busy = 0;
+        oldest = wb->dirtySince;
+        for (other = wbQueue; other != NULL; other = other->next) {
+            if (!writebackSameRow(wb, other))
+                continue;
+            if (other->state == WB_FLUSHING)
+                busy = 1;
+            else {
+                num++;
+                urgent |= other->urgent;
+                if (other->dirtySince < oldest)
+                    oldest = other->dirtySince;
+            }
+        }
+
+        /* Another thread is writing the row, take it once it's done */
+        if (busy)
+            continue;
+
+        due = oldest + mCoalesceTime;
+        if ((!urgent) && (num < mCoalesceColumns) && (due > now) && (wbRunning)) {
+            if ((*wait == 0) || (due - now < *wait))
+                *wait = due - now;
+            continue;
+        }
+
+        last = NULL;
+        for (other = wbQueue; other != NULL; other = other->next)
+            if ((other->state == WB_DIRTY) && (writebackSameRow(wb, other))) {
+                /* Flush a snapshot of the value, writes may continue meanwhile */
+                other->state = WB_FLUSHING;
+                other->batch = NULL;
+                other->batchGen = other->gen;
+                other->batchLen = other->len;
+                other->batchData = (char *)malloc( (other->len + 1) * sizeof(char) );
+                if (other->len > 0)
+                    memcpy(other->batchData, other->data, other->len);
+                if (last != NULL)
+                    last->batch = other;
+                last = other;
+            }
+
+        return wb;
+    }
+
+    return NULL;
+}
+
+static void *writebackThread(void *arg)
+{
+    tWriteback *batch, *wb, *next;
+    unsigned long long wait;
+    struct timespec ts;
+    MYSQL **conns, *conn;
+    int ret;
+
+    mysql_thread_init();
+    /* The connections to the servers are opened on first use */
+    conns = (MYSQL **)calloc(routeServers(), sizeof(MYSQL *));
+
+    pthread_mutex_lock(&wbMutex);
+    while (wbRunning) {
+        if ((batch = writebackNextBatch(&wait)) == NULL) {
+            if (wait > 0) {
+                wait += writebackNow();
+                ts.tv_sec = wait / 1000;
+                ts.tv_nsec = (wait % 1000) * 1000000;
+                pthread_cond_timedwait(&wbDirtyCond, &wbMutex, &ts);
+            }
+            else
+                pthread_cond_wait(&wbDirtyCond, &wbMutex);
+            continue;
+        }
+        pthread_mutex_unlock(&wbMutex);
+
+        conn = routeConnection(conns, batch->db);
+        ret = (conn != NULL) ? writebackFlush(conn, batch) : -EIO;
+
+        pthread_mutex_lock(&wbMutex);
+        rowCacheInvalidate(batch->db, batch->tab, batch->pkVal);
+        for (wb = batch; wb != NULL; wb = next) {
+            next = wb->batch;
+            free(wb->batchData);
+            wb->batchData = NULL;
+            if (ret != 0)
+                writebackSetError(wb->path, ret);
+            /* Writes made during the flush are kept and flushed later */
+            if (wb->gen == wb->batchGen)
+                writebackRemove(wb);
+            else {
+                wb->state = WB_DIRTY;
+                wb->dirtySince = writebackNow();
+            }
+        }
+        pthread_cond_broadcast(&wbDoneCond);
+    }
+    pthread_mutex_unlock(&wbMutex);
+
+    routeCloseConnections(conns);
+    free(conns);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int writebackStart(void)
+{
+    int i;
+
+    if (mWriteBehind <= 0)
+        return 0;
+
+    wbRunning = 1;
+    wbThreads = (pthread_t *)malloc( mWriteBehind * sizeof(pthread_t) );
+    for (i = 0; i < mWriteBehind; i++)
+        if (pthread_create(&wbThreads[i], NULL, writebackThread, NULL) != 0) {
+            fprintf(stderr, "Error: Cannot start write-behind flusher thread\n");
+            mWriteBehind = i;
+            break;
+        }
+
+    DPRINTF("%s: Started %d flusher threads\n", __FUNCTION__, mWriteBehind);
+    return mWriteBehind;
+}
+
+void writebackStop(void)
+{
+    int i;
+
+    if (wbThreads == NULL)
+        return;
+
+    writebackSync(NULL);
+
+    pthread_mutex_lock(&wbMutex);
+    wbRunning = 0;
+    pthread_cond_broadcast(&wbDirtyCond);
+    pthread_mutex_unlock(&wbMutex);
+
+    for (i = 0; i < mWriteBehind; i++)
+        pthread_join(wbThreads[i], NULL);
+
+    free(wbThreads);
+    wbThreads = NULL;
+}